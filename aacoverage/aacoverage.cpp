@@ -0,0 +1,71 @@
+#include "aacoverage.h"
+
+#include "../aalinetest-parser/slope.h"
+
+#include <algorithm>
+#include <new>
+
+namespace {
+
+struct Edge {
+    Slope slope;
+    int32_t startY;
+    int32_t endY;
+};
+
+static_assert(sizeof(Edge) <= sizeof(aacov_edge), "aacov_edge is too small to hold an Edge");
+static_assert(alignof(Edge) <= alignof(aacov_edge), "aacov_edge is insufficiently aligned for an Edge");
+
+const Edge &asEdge(const aacov_edge *edge) {
+    return *reinterpret_cast<const Edge *>(edge->opaque);
+}
+
+void emitSpans(const Edge &edge, int32_t y, int32_t numLines, aacov_span *spans, uint8_t *coverage, size_t stride) {
+    for (int32_t i = 0; i < numLines; i++, y++, coverage += stride) {
+        aacov_span &span = spans[i];
+        if (y < edge.startY || y >= edge.endY) {
+            span.x = 0;
+            span.count = 0;
+            continue;
+        }
+        span.count = edge.slope.SpanAACoverage(y, span.x, coverage);
+    }
+}
+
+} // namespace
+
+uint32_t aacov_version(void) {
+    return AACOV_VERSION;
+}
+
+void aacov_setup_edges(aacov_edge *edges, const aacov_edge_desc *descs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const aacov_edge_desc &desc = descs[i];
+        Edge *edge = new (edges[i].opaque) Edge;
+        edge->slope.Setup(desc.x0, desc.y0, desc.x1, desc.y1, desc.left != 0);
+        edge->startY = std::min(desc.y0, desc.y1);
+        edge->endY = std::max(desc.y0, desc.y1);
+        if (edge->startY == edge->endY) {
+            // Horizontal edges cover a single scanline
+            edge->endY++;
+        }
+    }
+}
+
+int32_t aacov_max_span_width(const aacov_edge *edge) {
+    return asEdge(edge).slope.Width() + 1;
+}
+
+void aacov_emit_spans(const aacov_edge *edge, int32_t y, int32_t numLines, aacov_span *spans, uint8_t *coverage,
+                      size_t stride) {
+    emitSpans(asEdge(edge), y, numLines, spans, coverage, stride);
+}
+
+void aacov_emit_edges(const aacov_edge *edges, size_t numEdges, int32_t y, int32_t numLines, aacov_span *spans,
+                      uint8_t *coverage, size_t stride) {
+    for (size_t e = 0; e < numEdges; e++) {
+        emitSpans(asEdge(&edges[e]), y, numLines, spans, coverage, stride);
+        spans += numLines;
+        coverage += numLines * stride;
+    }
+}
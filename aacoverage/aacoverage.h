@@ -0,0 +1,75 @@
+#pragma once
+
+// C interface for computing Nintendo DS edge antialiasing coverage in batches.
+//
+// Edges are configured once with aacov_setup_edges, then queried for any number of scanlines at a time. Every scanline
+// produces a span (the leftmost X coordinate and the number of pixels covered by the edge on that scanline) and one
+// coverage value from 0 to 31 per pixel of the span.
+//
+// Edges cover the scanlines from min(Y0,Y1) up to but not including max(Y0,Y1); horizontal edges cover a single
+// scanline. Scanlines outside that range produce empty spans.
+//
+// Build with AACOV_STATIC defined (both the library and its users) to link the library statically.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(AACOV_STATIC)
+    #define AACOV_API
+#elif defined(_WIN32)
+    #if defined(AACOV_BUILD)
+        #define AACOV_API __declspec(dllexport)
+    #else
+        #define AACOV_API __declspec(dllimport)
+    #endif
+#else
+    #define AACOV_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AACOV_VERSION 2
+
+// Opaque, preconfigured edge. May be freely copied and shared across threads once configured.
+typedef struct aacov_edge {
+    uint64_t opaque[12];
+} aacov_edge;
+
+// Edge endpoints in screen coordinates
+typedef struct aacov_edge_desc {
+    int32_t x0, y0;
+    int32_t x1, y1;
+    int32_t left; // nonzero for left edges, zero for right edges
+} aacov_edge_desc;
+
+// Pixels covered by an edge on one scanline
+typedef struct aacov_span {
+    int32_t x;     // leftmost X coordinate
+    int32_t count; // number of pixels; zero if the edge does not cover the scanline
+} aacov_span;
+
+// Returns AACOV_VERSION as compiled into the library
+AACOV_API uint32_t aacov_version(void);
+
+// Configures count edges from their descriptions
+AACOV_API void aacov_setup_edges(aacov_edge *edges, const aacov_edge_desc *descs, size_t count);
+
+// Returns the largest number of pixels a span of the edge can contain; coverage strides must be at least this large
+AACOV_API int32_t aacov_max_span_width(const aacov_edge *edge);
+
+// Computes the spans and coverage of numLines consecutive scanlines of an edge starting at scanline y.
+// spans receives numLines entries. The coverage of scanline y+i is written to coverage + i*stride.
+AACOV_API void aacov_emit_spans(const aacov_edge *edge, int32_t y, int32_t numLines, aacov_span *spans,
+                                uint8_t *coverage, size_t stride);
+
+// Computes the spans and coverage of numLines consecutive scanlines of numEdges edges starting at scanline y.
+// Output is laid out edge by edge: scanline y+i of edge e is written to spans[e*numLines + i] and to
+// coverage + (e*numLines + i)*stride. The stride must fit the widest span of all edges.
+AACOV_API void aacov_emit_edges(const aacov_edge *edges, size_t numEdges, int32_t y, int32_t numLines,
+                                aacov_span *spans, uint8_t *coverage, size_t stride);
+
+#ifdef __cplusplus
+}
+#endif
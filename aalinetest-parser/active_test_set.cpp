@@ -0,0 +1,273 @@
+#include "active_test_set.h"
+
+#include "formula_columns.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// How often the validation thread checks for expired data points when no formulas are submitted
+constexpr auto kExpiryCheckInterval = std::chrono::seconds(1);
+
+void prepareDataPoint(ExtDataPoint &dp) {
+    if (dp.positive) {
+        dp.slope.Setup(0, 0, dp.dp.width, dp.dp.height, dp.left);
+    } else {
+        dp.slope.Setup(255, 0, 255 - dp.dp.width, dp.dp.height, dp.left);
+    }
+    Variables vars;
+    vars.Apply(dp.dp, dp.left);
+    dp.features = DataPointFeatures::Compute(dp.slope, vars);
+}
+
+bool isError(const ExtDataPoint &dp, i32 result) {
+    return result < dp.dp.expectedOutput || result > dp.upperBound;
+}
+
+} // namespace
+
+ActiveTestSet::ActiveTestSet()
+    : ActiveTestSet(Config{}) {}
+
+ActiveTestSet::ActiveTestSet(const Config &config)
+    : m_config(config) {
+    std::scoped_lock lk{m_mutex};
+    Publish();
+}
+
+ActiveTestSet::~ActiveTestSet() {
+    Stop();
+}
+
+void ActiveTestSet::SetFixedDataPoints(std::span<const ExtDataPoint> dataPoints) {
+    std::scoped_lock lk{m_mutex};
+    m_fixed.assign(dataPoints.begin(), dataPoints.end());
+    for (auto &dp : m_fixed) {
+        prepareDataPoint(dp);
+    }
+    for (uint32_t index : m_dynamic) {
+        m_expiry[index] = 0;
+    }
+    m_dynamic.clear();
+    m_solved = false;
+    Publish();
+}
+
+void ActiveTestSet::SetValidationDataPoints(std::span<const ExtDataPoint> dataPoints) {
+    auto validation = std::make_shared<ValidationSet>();
+    validation->dataPoints.assign(dataPoints.begin(), dataPoints.end());
+    for (auto &dp : validation->dataPoints) {
+        prepareDataPoint(dp);
+        validation->batch.Add(dp.features);
+    }
+
+    std::scoped_lock lk{m_mutex};
+    m_validation = std::move(validation);
+    m_dynamic.clear();
+    m_expiry.assign(m_validation->dataPoints.size(), 0);
+    m_solved = false;
+    Publish();
+}
+
+void ActiveTestSet::SetValidationDataSet(const DataSet &dataSet) {
+    std::vector<ExtDataPoint> dataPoints;
+    auto addGroup = [&](const std::vector<DataPoint> &group, bool left, bool positive) {
+        for (auto &dp : group) {
+            dataPoints.push_back({dp, dp.expectedOutput, left, positive});
+        }
+    };
+    addGroup(dataSet.lpx, true, true);
+    addGroup(dataSet.lnx, true, false);
+    addGroup(dataSet.rpx, false, true);
+    addGroup(dataSet.rnx, false, false);
+    SetValidationDataPoints(dataPoints);
+}
+
+void ActiveTestSet::Start() {
+    if (!m_validator.joinable()) {
+        m_validator = std::jthread{[this](std::stop_token stopToken) { RunValidator(stopToken); }};
+    }
+}
+
+void ActiveTestSet::Stop() {
+    if (m_validator.joinable()) {
+        m_validator.request_stop();
+        m_validator.join();
+    }
+}
+
+void ActiveTestSet::Submit(std::span<const Operation> ops, uint64_t versionId) {
+    if (versionId != CurrentId() || m_pending.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::scoped_lock lk{m_mutex};
+    if (m_pending || m_solved) {
+        return;
+    }
+    if (m_validation == nullptr || m_validation->dataPoints.empty()) {
+        // Nothing to validate against
+        m_solution.assign(ops.begin(), ops.end());
+        m_solved = true;
+        return;
+    }
+    m_pendingOps.assign(ops.begin(), ops.end());
+    m_pending = true;
+    m_cond.notify_one();
+}
+
+ActiveTestSet::Stats ActiveTestSet::GetStats() const {
+    std::scoped_lock lk{m_mutex};
+    return {
+        .versionId = m_current->id,
+        .numFixed = m_fixed.size(),
+        .numDynamic = m_dynamic.size(),
+        .numValidation = m_validation != nullptr ? m_validation->dataPoints.size() : 0,
+        .validations = m_validations,
+        .added = m_added,
+        .expired = m_expired,
+    };
+}
+
+void ActiveTestSet::RunValidator(std::stop_token stopToken) {
+    std::vector<Operation> ops;
+    std::vector<uint32_t> failed;
+    while (!stopToken.stop_requested()) {
+        std::shared_ptr<const ValidationSet> validation;
+        {
+            std::unique_lock lk{m_mutex};
+            m_cond.wait_for(lk, stopToken, kExpiryCheckInterval, [&] { return m_pending.load(); });
+            if (stopToken.stop_requested()) {
+                break;
+            }
+            failed.clear();
+            if (m_pending) {
+                ops.swap(m_pendingOps);
+                validation = m_validation;
+            }
+        }
+
+        if (validation != nullptr) {
+            Validate(*validation, ops, failed);
+        }
+
+        std::scoped_lock lk{m_mutex};
+        if (validation != nullptr) {
+            ++m_validations;
+            if (failed.empty()) {
+                m_solution = ops;
+                m_solved = true;
+            }
+            m_pending = false;
+        }
+        // Validation data points replaced while validating make the indices meaningless
+        if (validation != m_validation) {
+            failed.clear();
+        }
+        if (Update(failed)) {
+            Publish();
+        }
+    }
+}
+
+void ActiveTestSet::Validate(const ValidationSet &validation, std::span<const Operation> ops,
+                             std::vector<uint32_t> &failed) {
+    auto &dataPoints = validation.dataPoints;
+    std::vector<i32> results(dataPoints.size());
+    size_t stackSize;
+    ColumnInterpreter columns;
+    columns.Compile(ops);
+    if (columns.Evaluate(validation.batch, results, stackSize)) {
+        for (size_t i = 0; i < dataPoints.size(); i++) {
+            if (isError(dataPoints[i], results[i])) {
+                failed.push_back((uint32_t)i);
+            }
+        }
+        return;
+    }
+
+    // The formula fails to run on some data points; find them one at a time
+    CompiledFormula formula{ops};
+    FixedStack stack;
+    for (size_t i = 0; i < dataPoints.size(); i++) {
+        stack.clear();
+        if (!formula.Execute(dataPoints[i].features, stack) || stack.empty() ||
+            isError(dataPoints[i], stack.back())) {
+            failed.push_back((uint32_t)i);
+        }
+    }
+}
+
+bool ActiveTestSet::Update(std::span<const uint32_t> failed) {
+    const uint64_t generation = m_generation.load(std::memory_order_relaxed);
+    bool changed = false;
+
+    // Drop the data points that haven't failed a validation in a while
+    const size_t numDynamic = m_dynamic.size();
+    std::erase_if(m_dynamic, [&](uint32_t index) {
+        if (m_expiry[index] > generation) {
+            return false;
+        }
+        m_expiry[index] = 0;
+        return true;
+    });
+    m_expired += numDynamic - m_dynamic.size();
+    changed |= m_dynamic.size() != numDynamic;
+
+    // Renew the data points that are still active, and add a random sample of the others
+    const uint64_t expiry = generation + m_config.lifetime;
+    std::vector<uint32_t> sample;
+    size_t numCandidates = 0;
+    for (uint32_t index : failed) {
+        if (m_expiry[index] != 0) {
+            m_expiry[index] = expiry;
+            continue;
+        }
+        if (sample.size() < m_config.maxAddedPerValidation) {
+            sample.push_back(index);
+        } else {
+            std::uniform_int_distribution<size_t> dist{0, numCandidates};
+            if (const size_t slot = dist(m_rng); slot < sample.size()) {
+                sample[slot] = index;
+            }
+        }
+        ++numCandidates;
+    }
+    for (uint32_t index : sample) {
+        m_expiry[index] = expiry;
+        m_dynamic.push_back(index);
+    }
+    m_added += sample.size();
+    changed |= !sample.empty();
+
+    // Evict the data points closest to expiring once over capacity
+    if (m_dynamic.size() > m_config.maxDynamic) {
+        auto keep = m_dynamic.end() - m_config.maxDynamic;
+        std::nth_element(m_dynamic.begin(), keep, m_dynamic.end(),
+                         [&](uint32_t lhs, uint32_t rhs) { return m_expiry[lhs] < m_expiry[rhs]; });
+        for (auto it = m_dynamic.begin(); it != keep; ++it) {
+            m_expiry[*it] = 0;
+        }
+        m_expired += keep - m_dynamic.begin();
+        m_dynamic.erase(m_dynamic.begin(), keep);
+    }
+    return changed;
+}
+
+void ActiveTestSet::Publish() {
+    auto version = std::make_shared<Version>();
+    version->id = ++m_nextId;
+    version->dataPoints = m_fixed;
+    if (m_validation != nullptr) {
+        for (uint32_t index : m_dynamic) {
+            version->dataPoints.push_back(m_validation->dataPoints[index]);
+        }
+    }
+    for (auto &dp : version->dataPoints) {
+        version->batch.Add(dp.features);
+        version->targets.push_back({dp.dp.expectedOutput, dp.upperBound, (uint64_t)dp.errorWeight});
+    }
+    m_current = std::move(version);
+    m_currentId.store(m_current->id, std::memory_order_release);
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "dataset.h"
+#include "formula_batch.h"
+#include "formula_bounds.h"
+#include "func.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <thread>
+#include <vector>
+
+struct ExtDataPoint {
+    DataPoint dp;
+    i32 upperBound;
+    bool left;
+    bool positive;
+    i32 errorWeight = 1;
+    Slope slope;                // Set up by ActiveTestSet
+    DataPointFeatures features; // Precomputed from slope and dp by ActiveTestSet
+};
+
+// Data points the genetic algorithm evaluates chromosomes on, adapted to the search as it runs.
+//
+// The set starts out with the fixed data points, hand-picked corner cases and quirks that never leave it. Formulas that
+// pass every active data point are validated against the whole validation data set on a background thread. Data points
+// they fail join the active set and expire a number of generations after they last failed a validation. Each change
+// publishes a new immutable Version which the islands pick up at their next generation, so that chromosomes are
+// evaluated on a few hundred data points and the search still converges to formulas that hold on the whole data set.
+class ActiveTestSet {
+public:
+    struct Config {
+        size_t maxAddedPerValidation = 64; // Failed data points added to the active set per validation
+        size_t maxDynamic = 2048;          // Data points held on top of the fixed ones; the oldest are evicted first
+        uint64_t lifetime = 200000;        // Island generations a data point stays after it last failed a validation
+    };
+
+    // Immutable snapshot of the active data points
+    struct Version {
+        uint64_t id = 0;
+        std::vector<ExtDataPoint> dataPoints; // Fixed data points first
+        FormulaBatch batch;
+        std::vector<FormulaPruner::Target> targets;
+    };
+
+    struct Stats {
+        uint64_t versionId;
+        size_t numFixed;
+        size_t numDynamic;
+        size_t numValidation;
+        uint64_t validations;
+        uint64_t added;
+        uint64_t expired;
+    };
+
+    ActiveTestSet();
+    explicit ActiveTestSet(const Config &config);
+    ~ActiveTestSet();
+
+    // Replaces the fixed data points and drops the dynamic ones
+    void SetFixedDataPoints(std::span<const ExtDataPoint> dataPoints);
+
+    // Replaces the data points formulas are validated against and drops the dynamic ones. Without validation data
+    // points, passing the fixed data points is final.
+    void SetValidationDataPoints(std::span<const ExtDataPoint> dataPoints);
+
+    // Validates against every X-major data point of the data set, which must be matched exactly
+    void SetValidationDataSet(const DataSet &dataSet);
+
+    // Starts and stops the validation thread
+    void Start();
+    void Stop();
+
+    std::shared_ptr<const Version> Current() const {
+        std::scoped_lock lk{m_mutex};
+        return m_current;
+    }
+
+    // Cheap check for a new version
+    uint64_t CurrentId() const {
+        return m_currentId.load(std::memory_order_acquire);
+    }
+
+    // Counts an island generation towards the expiry of the dynamic data points
+    void CountGeneration() {
+        m_generation.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Queues a formula that passes every data point of the given version for validation. Never waits. Formulas
+    // submitted against an outdated version, or while another one is queued, are dropped.
+    void Submit(std::span<const Operation> ops, uint64_t versionId);
+
+    // Determines if a formula passed validation, and retrieves it
+    bool IsSolved() const {
+        return m_solved.load(std::memory_order_acquire);
+    }
+    std::vector<Operation> Solution() const {
+        std::scoped_lock lk{m_mutex};
+        return m_solution;
+    }
+
+    Stats GetStats() const;
+
+private:
+    // Validation data points along with their features laid out for batch evaluation
+    struct ValidationSet {
+        std::vector<ExtDataPoint> dataPoints;
+        FormulaBatch batch;
+    };
+
+    const Config m_config;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable_any m_cond;
+
+    std::vector<ExtDataPoint> m_fixed;
+    std::shared_ptr<const ValidationSet> m_validation;
+    std::vector<uint32_t> m_dynamic; // Indices of the active validation data points
+    std::vector<uint64_t> m_expiry;  // Generation at which each validation data point leaves the set; 0 if inactive
+    std::shared_ptr<const Version> m_current;
+    std::atomic_uint64_t m_currentId{0};
+    uint64_t m_nextId = 0;
+
+    std::atomic_uint64_t m_generation{0};
+    std::atomic_bool m_solved = false;
+    std::vector<Operation> m_solution;
+
+    // Formula waiting for validation
+    std::atomic_bool m_pending = false;
+    std::vector<Operation> m_pendingOps;
+
+    uint64_t m_validations = 0;
+    uint64_t m_added = 0;
+    uint64_t m_expired = 0;
+
+    std::mt19937 m_rng;
+    std::jthread m_validator;
+
+    void RunValidator(std::stop_token stopToken);
+
+    // Finds the validation data points the formula fails
+    static void Validate(const ValidationSet &validation, std::span<const Operation> ops,
+                         std::vector<uint32_t> &failed);
+
+    // Moves failed data points into the active set and drops the expired ones. Returns true if the set changed.
+    bool Update(std::span<const uint32_t> failed);
+
+    // Builds and publishes a new version from the fixed and dynamic data points. Requires m_mutex.
+    void Publish();
+};
@@ -0,0 +1,170 @@
+#include "coverage_lut.h"
+
+#include "parallel.h"
+#include "slope.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+constexpr char kMagic[4] = {'A', 'A', 'C', 'L'};
+constexpr uint32_t kVersion = 1;
+
+void setupSlope(Slope &slope, int32_t width, int32_t height, bool negative, bool left, int32_t originX = 0,
+                int32_t originY = 0) {
+    if (negative) {
+        slope.Setup(originX + width, originY, originX, originY + height, left);
+    } else {
+        slope.Setup(originX, originY, originX + width, originY + height, left);
+    }
+}
+
+} // namespace
+
+void CoverageLUT::Build(size_t numWorkers) {
+    if (numWorkers == 0) {
+        numWorkers = defaultWorkerCount();
+    }
+
+    // Every slope stores one row per scanline, from Y0 to Y1 inclusive
+    m_slopes.assign(kNumSlopes, {});
+    u32 rowOffset = 0;
+    for (size_t index = 0; index < kNumSlopes; index++) {
+        const i32 height = (index / (kMaxWidth + 1)) % (kMaxHeight + 1);
+        m_slopes[index].rowOffset = rowOffset;
+        rowOffset += height + 1;
+    }
+    m_rows.assign(rowOffset, 0);
+
+    // Each work item handles one height of one orientation
+    parallelFor(2 * (kMaxHeight + 1), numWorkers, [&](size_t item, size_t) {
+        const bool negative = item > kMaxHeight;
+        const i32 height = item % (kMaxHeight + 1);
+        for (i32 width = 0; width <= kMaxWidth; width++) {
+            Slope slope;
+            setupSlope(slope, width, height, negative, true);
+
+            // X-major coverage ignores the edge side and is inverted after stepping in negative slopes.
+            // Everything else is inverted on right edges. Zero by zero slopes have no coverage at all.
+            const bool xMajor = slope.IsXMajor() && width != 0 && height != 0;
+            SlopeInfo &info = m_slopes[SlopeIndex(width, height, negative)];
+            info.step = slope.AACoverageStep();
+            info.outputXor = (xMajor && negative) ? kAAFracRange - 1 : 0;
+            info.rightXor = (xMajor || (width == 0 && height == 0)) ? 0 : kAAFracRange - 1;
+
+            for (i32 y = 0; y <= height; y++) {
+                const i32 leftX = std::min(slope.XStart(y), slope.XEnd(y));
+                const i32 coverage = slope.FracAACoverage(leftX, y) ^ info.outputXor;
+                m_rows[info.rowOffset + y] = coverage & (kAAFracRange - 1);
+            }
+        }
+    });
+}
+
+uint64_t CoverageLUT::Verify(size_t numWorkers) const {
+    if (numWorkers == 0) {
+        numWorkers = defaultWorkerCount();
+    }
+
+    // Each work item handles one height of one of the four orientations
+    std::atomic<uint64_t> mismatches = 0;
+    parallelFor(4 * (kMaxHeight + 1), numWorkers, [&](size_t item, size_t) {
+        const bool negative = (item / (kMaxHeight + 1)) & 1;
+        const bool left = (item / (kMaxHeight + 1)) & 2;
+        const i32 height = item % (kMaxHeight + 1);
+        uint64_t count = 0;
+        for (i32 width = 0; width <= kMaxWidth; width++) {
+            // Slopes at the origin, at odd offsets and against the far screen edges
+            const i32 originsX[] = {0, 1, (kMaxWidth - width) | 1, kMaxWidth - width};
+            const i32 originsY[] = {0, 1, kMaxHeight - height};
+            for (i32 originX : originsX) {
+                for (i32 originY : originsY) {
+                    Slope slope;
+                    setupSlope(slope, width, height, negative, left, originX, originY);
+                    for (i32 y = 0; y <= height; y++) {
+                        const i32 startX = slope.XStart(originY + y);
+                        const i32 endX = slope.XEnd(originY + y);
+                        const i32 leftX = std::min(startX, endX);
+                        const i32 rightX = std::max(startX, endX);
+                        for (i32 x = leftX; x <= rightX; x++) {
+                            const i32 expected = slope.AACoverage(x, originY + y);
+                            const i32 actual = FracAACoverage(width, height, negative, left, x - leftX, y);
+                            if ((actual >> Slope::kAAFracBits) != expected) {
+                                count++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        mismatches += count;
+    });
+    return mismatches;
+}
+
+bool CoverageLUT::Save(const std::filesystem::path &path) const {
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        return false;
+    }
+
+    const u32 numSlopes = m_slopes.size();
+    const u32 numRows = m_rows.size();
+    out.write(kMagic, sizeof(kMagic));
+    out.write((const char *)&kVersion, sizeof(kVersion));
+    out.write((const char *)&numSlopes, sizeof(numSlopes));
+    out.write((const char *)&numRows, sizeof(numRows));
+    for (const SlopeInfo &info : m_slopes) {
+        out.write((const char *)&info.rowOffset, sizeof(info.rowOffset));
+        out.write((const char *)&info.step, sizeof(info.step));
+        out.write((const char *)&info.outputXor, sizeof(info.outputXor));
+        out.write((const char *)&info.rightXor, sizeof(info.rightXor));
+    }
+    out.write((const char *)m_rows.data(), m_rows.size() * sizeof(u16));
+    return (bool)out;
+}
+
+bool CoverageLUT::Load(const std::filesystem::path &path) {
+    std::ifstream in{path, std::ios::binary};
+    if (!in) {
+        return false;
+    }
+
+    char magic[sizeof(kMagic)];
+    u32 version, numSlopes, numRows;
+    in.read(magic, sizeof(magic));
+    in.read((char *)&version, sizeof(version));
+    in.read((char *)&numSlopes, sizeof(numSlopes));
+    in.read((char *)&numRows, sizeof(numRows));
+    if (!in || memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kVersion || numSlopes != kNumSlopes) {
+        return false;
+    }
+
+    std::vector<SlopeInfo> slopes(numSlopes);
+    for (SlopeInfo &info : slopes) {
+        in.read((char *)&info.rowOffset, sizeof(info.rowOffset));
+        in.read((char *)&info.step, sizeof(info.step));
+        in.read((char *)&info.outputXor, sizeof(info.outputXor));
+        in.read((char *)&info.rightXor, sizeof(info.rightXor));
+    }
+    std::vector<u16> rows(numRows);
+    in.read((char *)rows.data(), rows.size() * sizeof(u16));
+    if (!in) {
+        return false;
+    }
+
+    // Reject tables whose rows do not fit in the row array
+    for (size_t index = 0; index < kNumSlopes; index++) {
+        const u32 height = (index / (kMaxWidth + 1)) % (kMaxHeight + 1);
+        if (slopes[index].rowOffset > numRows || numRows - slopes[index].rowOffset < height + 1) {
+            return false;
+        }
+    }
+
+    m_slopes = std::move(slopes);
+    m_rows = std::move(rows);
+    return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+/// <summary>
+/// Precomputed antialiasing coverage table for every slope from 0x0 to 256x192.
+/// </summary>
+/// <remarks>
+/// Rows are gradient-compressed: each scanline of a slope stores only the fractional coverage of its leftmost pixel.
+/// The coverage of the remaining pixels of the span is obtained by stepping the gradient, which is constant for the
+/// whole slope, and wrapping around the coverage range. Only left edges are stored; right edges invert the gradient
+/// of every slope except X-major ones, whose coverage does not depend on the edge side.
+///
+/// Lookups use only additions, a multiplication and bit masks. Coverage values are relative to the slope origin, so
+/// the table applies to slopes at any screen position.
+/// </remarks>
+class CoverageLUT {
+    using u16 = uint16_t;
+    using u32 = uint32_t;
+    using i32 = int32_t;
+
+public:
+    static constexpr i32 kMaxWidth = 256;
+    static constexpr i32 kMaxHeight = 192;
+
+    /// <summary>
+    /// Computes the coverage table from Slope::FracAACoverage, spreading the work across the specified number of
+    /// threads.
+    /// </summary>
+    /// <param name="numWorkers">Number of worker threads; 0 uses all hardware threads</param>
+    void Build(size_t numWorkers = 0);
+
+    /// <summary>
+    /// Compares every coverage value in the table against Slope::AACoverage for all four edge orientations, with the
+    /// slopes placed at the origin and at several translated positions.
+    /// </summary>
+    /// <param name="numWorkers">Number of worker threads; 0 uses all hardware threads</param>
+    /// <returns>The number of mismatched pixels</returns>
+    uint64_t Verify(size_t numWorkers = 0) const;
+
+    /// <summary>
+    /// Writes the table to the specified file.
+    /// </summary>
+    /// <returns>true if the table was written successfully</returns>
+    bool Save(const std::filesystem::path &path) const;
+
+    /// <summary>
+    /// Replaces the table with the contents of the specified file.
+    /// </summary>
+    /// <returns>true if the file contains a valid table</returns>
+    bool Load(const std::filesystem::path &path);
+
+    /// <summary>
+    /// Determines if the table has been built or loaded.
+    /// </summary>
+    bool IsValid() const {
+        return !m_slopes.empty();
+    }
+
+    /// <summary>
+    /// Determines if the table covers a slope of the specified size.
+    /// </summary>
+    static constexpr bool Contains(i32 width, i32 height) {
+        return width >= 0 && width <= kMaxWidth && height >= 0 && height <= kMaxHeight;
+    }
+
+    /// <summary>
+    /// Looks up the antialiasing coverage of a pixel, including the fractional part.
+    /// </summary>
+    /// <param name="width">The slope width, which must be covered by the table</param>
+    /// <param name="height">The slope height, which must be covered by the table</param>
+    /// <param name="negative">true for negative slopes</param>
+    /// <param name="left">true for left edges</param>
+    /// <param name="xOffset">The offset of the pixel from the leftmost pixel of the span</param>
+    /// <param name="y">The scanline relative to the top of the slope, from 0 to height</param>
+    /// <returns>The antialiasing coverage value of the pixel</returns>
+    i32 FracAACoverage(i32 width, i32 height, bool negative, bool left, i32 xOffset, i32 y) const {
+        const SlopeInfo &slope = m_slopes[SlopeIndex(width, height, negative)];
+        const i32 coverage = (m_rows[slope.rowOffset + y] + xOffset * slope.step) & (kAAFracRange - 1);
+        return coverage ^ slope.outputXor ^ (left ? 0 : slope.rightXor);
+    }
+
+    /// <summary>
+    /// Returns the size of the table in bytes.
+    /// </summary>
+    size_t MemorySize() const {
+        return m_slopes.size() * sizeof(SlopeInfo) + m_rows.size() * sizeof(u16);
+    }
+
+private:
+    static constexpr i32 kAAFracRange = 1024;
+    static constexpr size_t kNumSlopes = (kMaxWidth + 1) * (kMaxHeight + 1) * 2;
+
+    struct SlopeInfo {
+        u32 rowOffset; // Offset of the slope's first row in m_rows
+        u16 step;      // Coverage gradient step per pixel
+        u16 outputXor; // Applied to the coverage of every pixel
+        u16 rightXor;  // Additionally applied to the coverage of right edges
+    };
+
+    static size_t SlopeIndex(i32 width, i32 height, bool negative) {
+        return ((size_t)negative * (kMaxHeight + 1) + height) * (kMaxWidth + 1) + width;
+    }
+
+    std::vector<SlopeInfo> m_slopes; // Parameters of every slope
+    std::vector<u16> m_rows;         // Fractional coverage of the leftmost pixel of every scanline of every slope
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "types.h"
+
+#include <algorithm>
+#include <bit>
+#include <istream>
+#include <ostream>
+#include <span>
+
+// xoshiro256++ (Blackman and Vigna), a small and fast generator with 256 bits of state, for the random decisions of
+// the genetic algorithm.
+//
+// It satisfies UniformRandomBitGenerator so that it works with the standard distributions, but the helpers below are
+// what the hot paths use: they take the bounds as arguments instead of rebuilding distribution objects, and
+// BernoulliMask decides 64 coin flips with a handful of draws instead of one draw per flip.
+class FastRng {
+public:
+    using result_type = u64;
+
+    FastRng()
+        : FastRng(0) {}
+
+    explicit FastRng(u64 seed) {
+        Seed(seed);
+    }
+
+    // Expands a 64-bit seed into the whole state with splitmix64, which never yields the all-zero state
+    void Seed(u64 seed) {
+        for (auto &word : m_state) {
+            seed += 0x9E3779B97F4A7C15ull;
+            u64 z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return ~0ull;
+    }
+
+    result_type operator()() {
+        const u64 result = std::rotl(m_state[0] + m_state[3], 23) + m_state[0];
+        const u64 t = m_state[1] << 17;
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= t;
+        m_state[3] = std::rotl(m_state[3], 45);
+        return result;
+    }
+
+    // Fills words with random bits
+    void Fill(std::span<u64> words) {
+        for (auto &word : words) {
+            word = (*this)();
+        }
+    }
+
+    // Maps 32 random bits to [0, bound) with a multiply and shift (Lemire). The bias is at most bound / 2^32.
+    static u32 Scale(u32 bits, u32 bound) {
+        return (u32)(((u64)bits * bound) >> 32);
+    }
+
+    // Uniform integer in [0, bound)
+    u32 Below(u32 bound) {
+        return Scale((u32)((*this)() >> 32), bound);
+    }
+
+    // Uniform integer in [lo, hi]; the range may span at most 2^32 - 1 values
+    size_t Range(size_t lo, size_t hi) {
+        return lo + Below((u32)(hi - lo + 1));
+    }
+
+    // Uniform float in [0, 1)
+    float NextFloat() {
+        return (float)((*this)() >> 40) * 0x1.0p-24f;
+    }
+
+    // Word whose bits are each set independently with probability p, rounded to a multiple of 2^-16.
+    //
+    // Combines random words from the lowest set bit of p upwards, ORing where p has a 1 and ANDing where it has a 0, so
+    // that each step halves the probability of a bit being set and adds the next bit of p. Costs at most 16 draws.
+    u64 BernoulliMask(float p) {
+        const u32 q = p <= 0.0f ? 0 : p >= 1.0f ? 1 << 16 : (u32)(p * 65536.0f + 0.5f);
+        if (q == 0) {
+            return 0;
+        }
+        if (q >= 1 << 16) {
+            return ~0ull;
+        }
+        u64 mask = 0;
+        for (int bit = std::countr_zero(q); bit < 16; bit++) {
+            const u64 bits = (*this)();
+            mask = (q >> bit) & 1 ? mask | bits : mask & bits;
+        }
+        return mask;
+    }
+
+    friend std::ostream &operator<<(std::ostream &out, const FastRng &rng) {
+        return out << rng.m_state[0] << ' ' << rng.m_state[1] << ' ' << rng.m_state[2] << ' ' << rng.m_state[3];
+    }
+
+    friend std::istream &operator>>(std::istream &in, FastRng &rng) {
+        u64 state[4];
+        if (in >> state[0] >> state[1] >> state[2] >> state[3]) {
+            std::copy(std::begin(state), std::end(state), rng.m_state);
+        }
+        return in;
+    }
+
+private:
+    u64 m_state[4];
+};
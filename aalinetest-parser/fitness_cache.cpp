@@ -0,0 +1,141 @@
+#include "fitness_cache.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+
+// Finalizer from SplitMix64
+uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+} // namespace
+
+FormulaKey FormulaKey::Of(std::span<const Operation> ops, uint64_t salt) {
+    // Two independently seeded hash chains
+    FormulaKey key{0x243F6A8885A308D3ull ^ salt, 0x13198A2E03707344ull + mix(salt)};
+    for (auto &op : ops) {
+        const uint64_t value = op.type == Operation::Type::Constant ? (u32)op.constVal : (u32)op.op;
+        const uint64_t word = ((uint64_t)op.type << 32) | value;
+        key.lo = mix(key.lo ^ word);
+        key.hi = mix(key.hi + word * 0x9E3779B97F4A7C15ull);
+    }
+    key.lo = mix(key.lo ^ ops.size());
+    key.hi = mix(key.hi + ops.size());
+    return key;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+
+FitnessCache::FitnessCache(size_t capacity) {
+    const size_t numSets = std::bit_ceil(std::max<size_t>(capacity / kWays, kShards));
+    m_entries.resize(numSets * kWays);
+    m_setMask = numSets - 1;
+    Clear();
+}
+
+bool FitnessCache::Lookup(const FormulaKey &key, Result &result) {
+    const size_t set = key.lo & m_setMask;
+    Entry *entries = &m_entries[set * kWays];
+    Shard &shard = m_shards[set % kShards];
+
+    std::scoped_lock lk{shard.mutex};
+    for (size_t i = 0; i < kWays; i++) {
+        Entry &entry = entries[i];
+        if (entry.lastUse != 0 && entry.key == key) {
+            entry.lastUse = shard.NextUse();
+            result.fitness = entry.fitness;
+            result.numErrors = entry.numErrors;
+            result.stackSize = entry.stackSize;
+            shard.hits++;
+            return true;
+        }
+    }
+    shard.misses++;
+    return false;
+}
+
+void FitnessCache::Insert(const FormulaKey &key, const Result &result) {
+    const size_t set = key.lo & m_setMask;
+    Entry *entries = &m_entries[set * kWays];
+    Shard &shard = m_shards[set % kShards];
+
+    std::scoped_lock lk{shard.mutex};
+
+    // Pick the matching entry, an empty one or the least recently used one, in that order
+    const uint32_t now = shard.NextUse();
+    Entry *target = nullptr;
+    for (size_t i = 0; i < kWays; i++) {
+        if (entries[i].lastUse != 0 && entries[i].key == key) {
+            target = &entries[i];
+            break;
+        }
+    }
+    if (target == nullptr) {
+        uint32_t oldestAge = 0;
+        for (size_t i = 0; i < kWays; i++) {
+            Entry &entry = entries[i];
+            if (entry.lastUse == 0) {
+                target = &entry;
+                break;
+            }
+            const uint32_t age = now - entry.lastUse;
+            if (target == nullptr || age > oldestAge) {
+                target = &entry;
+                oldestAge = age;
+            }
+        }
+    }
+
+    if (target->lastUse == 0) {
+        shard.numEntries++;
+    } else if (target->key != key) {
+        shard.evictions++;
+    }
+    target->key = key;
+    target->fitness = result.fitness;
+    target->numErrors = result.numErrors;
+    target->stackSize = (uint32_t)result.stackSize;
+    target->lastUse = now;
+    shard.insertions++;
+}
+
+void FitnessCache::Clear() {
+    for (size_t index = 0; index < kShards; index++) {
+        Shard &shard = m_shards[index];
+        std::scoped_lock lk{shard.mutex};
+        for (size_t set = index; set <= m_setMask; set += kShards) {
+            for (size_t i = 0; i < kWays; i++) {
+                m_entries[set * kWays + i].lastUse = 0;
+            }
+        }
+        shard.useCounter = 0;
+        shard.hits = 0;
+        shard.misses = 0;
+        shard.insertions = 0;
+        shard.evictions = 0;
+        shard.numEntries = 0;
+    }
+}
+
+FitnessCache::Stats FitnessCache::GetStats() const {
+    Stats stats{
+        .capacity = m_entries.size(),
+        .memorySize = m_entries.size() * sizeof(Entry),
+    };
+    for (const Shard &shard : m_shards) {
+        std::scoped_lock lk{shard.mutex};
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.insertions += shard.insertions;
+        stats.evictions += shard.evictions;
+        stats.entries += shard.numEntries;
+    }
+    return stats;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "func.h"
+
+#include <array>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// 128-bit hash of a sequence of operations
+struct FormulaKey {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator==(const FormulaKey &) const = default;
+
+    // Different salts give unrelated keys for the same formula, e.g. to keep results on different data sets apart
+    static FormulaKey Of(std::span<const Operation> ops, uint64_t salt = 0);
+};
+
+// Bounded cache of fitness results keyed by formula, safe to share between threads.
+//
+// Entries are stored in a set-associative table split into independently locked shards. When a set is full, the least
+// recently used entry in the set is evicted. Each shard keeps its own use clock and statistics, so lookups never touch
+// state shared with other shards.
+class FitnessCache {
+public:
+    struct Result {
+        uint64_t fitness;
+        uint64_t numErrors;
+        size_t stackSize;
+    };
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t insertions;
+        uint64_t evictions;
+        size_t entries;
+        size_t capacity;
+        size_t memorySize;
+
+        double HitRate() const {
+            const uint64_t lookups = hits + misses;
+            return lookups > 0 ? (double)hits / lookups : 0.0;
+        }
+    };
+
+    // Creates a cache holding up to capacity entries, rounded up to a power of two
+    explicit FitnessCache(size_t capacity);
+
+    bool Lookup(const FormulaKey &key, Result &result);
+    void Insert(const FormulaKey &key, const Result &result);
+
+    // Removes all entries and resets the statistics
+    void Clear();
+
+    Stats GetStats() const;
+
+private:
+    static constexpr size_t kWays = 4;
+    static constexpr size_t kShards = 64;
+
+    struct Entry {
+        FormulaKey key;
+        uint64_t fitness;
+        uint64_t numErrors;
+        uint32_t stackSize;
+        uint32_t lastUse; // 0 if the entry is empty
+    };
+
+    // Mutable state of the sets in a shard, guarded by its mutex
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        uint32_t useCounter = 0; // Orders the uses of the shard's entries
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        size_t numEntries = 0;
+
+        uint32_t NextUse() {
+            // Skip 0 on wraparound, which marks empty entries
+            const uint32_t use = ++useCounter;
+            return use != 0 ? use : ++useCounter;
+        }
+    };
+
+    std::vector<Entry> m_entries;
+    size_t m_setMask;
+    std::array<Shard, kShards> m_shards;
+};
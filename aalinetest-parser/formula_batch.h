@@ -0,0 +1,49 @@
+#pragma once
+
+#include "func.h"
+
+#include <array>
+#include <vector>
+
+// Data points laid out column by column for batched formula evaluation.
+//
+// Each column holds one DataPointFeatures value across all data points, so batched evaluators turn every operator that
+// reads the data point into a load and never touch a Slope. The same features are also kept row by row for
+// interpreters that evaluate one data point at a time.
+struct FormulaBatch {
+    using Column = DataPointFeatures::Feature;
+    static constexpr size_t kNumColumns = DataPointFeatures::kNumFeatures;
+
+    std::array<std::vector<i32>, kNumColumns> columns;
+    std::vector<DataPointFeatures> rows;
+
+    size_t Size() const {
+        return rows.size();
+    }
+
+    void Clear() {
+        for (auto &column : columns) {
+            column.clear();
+        }
+        rows.clear();
+    }
+
+    void Add(const DataPointFeatures &features) {
+        for (size_t i = 0; i < kNumColumns; i++) {
+            columns[i].push_back(features.values[i]);
+        }
+        rows.push_back(features);
+    }
+
+    void Add(const Slope &slope, const Variables &vars) {
+        Add(DataPointFeatures::Compute(slope, vars));
+    }
+
+    std::array<const i32 *, kNumColumns> ColumnPointers() const {
+        std::array<const i32 *, kNumColumns> pointers;
+        for (size_t i = 0; i < kNumColumns; i++) {
+            pointers[i] = columns[i].data();
+        }
+        return pointers;
+    }
+};
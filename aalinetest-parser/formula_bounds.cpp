@@ -0,0 +1,526 @@
+#include "formula_bounds.h"
+
+#include <algorithm>
+#include <bit>
+#include <map>
+
+namespace {
+
+using Feature = DataPointFeatures::Feature;
+
+constexpr size_t kStackSize = std::tuple_size_v<decltype(FixedStack::stack)>;
+
+AbstractValue top(u32 deps) {
+    AbstractValue value{};
+    value.deps = deps;
+    return value;
+}
+
+// Tightens the range and the known bits of a value using each other
+AbstractValue normalize(AbstractValue v) {
+    // Every value in a range that doesn't cross zero shares the bits above the highest differing bit
+    if ((v.lo < 0) == (v.hi < 0)) {
+        const u32 diff = (u32)v.lo ^ (u32)v.hi;
+        const u32 common = diff == 0 ? ~0u : ~((std::bit_floor(diff) << 1) - 1);
+        v.knownOne |= (u32)v.lo & common;
+        v.knownZero |= ~(u32)v.lo & common;
+    }
+
+    // Smallest and largest values allowed by the known bits
+    const u32 unknown = ~(v.knownZero | v.knownOne);
+    v.lo = std::max(v.lo, (i32)(v.knownOne | (unknown & 0x80000000u)));
+    v.hi = std::min(v.hi, (i32)(v.knownOne | (unknown & 0x7FFFFFFFu)));
+    if (v.lo >= v.hi) {
+        return AbstractValue::Constant(v.lo);
+    }
+    return v;
+}
+
+// Builds a value from a range computed without wraparound; ranges that don't fit in an i32 may wrap to anything
+AbstractValue fromRange(i64 lo, i64 hi, u32 deps) {
+    if (lo < INT32_MIN || hi > INT32_MAX) {
+        return top(deps);
+    }
+    AbstractValue value{};
+    value.lo = (i32)lo;
+    value.hi = (i32)hi;
+    value.deps = deps;
+    return normalize(value);
+}
+
+// Adds known bits to a value. Bit facts survive wraparound, so they also refine values that lost their range.
+AbstractValue withBits(AbstractValue value, u32 knownZero, u32 knownOne) {
+    value.knownZero |= knownZero;
+    value.knownOne |= knownOne;
+    return normalize(value);
+}
+
+u32 lowMask(u32 bits) {
+    return bits >= 32 ? ~0u : (1u << bits) - 1;
+}
+
+u32 trailingZeros(const AbstractValue &value) {
+    return std::countr_one(value.knownZero);
+}
+
+// Smallest value that includes both values
+AbstractValue hull(const AbstractValue &a, const AbstractValue &b) {
+    AbstractValue value{};
+    value.lo = std::min(a.lo, b.lo);
+    value.hi = std::max(a.hi, b.hi);
+    value.knownZero = a.knownZero & b.knownZero;
+    value.knownOne = a.knownOne & b.knownOne;
+    value.deps = a.deps | b.deps;
+    return value;
+}
+
+// Tracks the bounds of a set of candidate results
+struct RangeBuilder {
+    i64 lo = INT64_MAX;
+    i64 hi = INT64_MIN;
+
+    void Include(i64 value) {
+        lo = std::min(lo, value);
+        hi = std::max(hi, value);
+    }
+
+    AbstractValue Build(u32 deps) const {
+        return fromRange(lo, hi, deps);
+    }
+};
+
+// Bounds f(x, y) for functions that are monotonic in both arguments over the given ranges
+template <typename Func>
+void includeCorners(RangeBuilder &range, i64 xlo, i64 xhi, i64 ylo, i64 yhi, Func &&func) {
+    for (i64 x : {xlo, xhi}) {
+        for (i64 y : {ylo, yhi}) {
+            range.Include(func(x, y));
+        }
+    }
+}
+
+// ----- Arithmetic ---------------------------------------------------------------------------------------------------
+
+AbstractValue add(const AbstractValue &a, const AbstractValue &b) {
+    const AbstractValue value = fromRange((i64)a.lo + b.lo, (i64)a.hi + b.hi, a.deps | b.deps);
+    return withBits(value, lowMask(std::min(trailingZeros(a), trailingZeros(b))), 0);
+}
+
+AbstractValue subtract(const AbstractValue &a, const AbstractValue &b) {
+    const AbstractValue value = fromRange((i64)a.lo - b.hi, (i64)a.hi - b.lo, a.deps | b.deps);
+    return withBits(value, lowMask(std::min(trailingZeros(a), trailingZeros(b))), 0);
+}
+
+AbstractValue multiply(const AbstractValue &a, const AbstractValue &b) {
+    RangeBuilder range;
+    includeCorners(range, a.lo, a.hi, b.lo, b.hi, [](i64 x, i64 y) { return x * y; });
+    return withBits(range.Build(a.deps | b.deps), lowMask(trailingZeros(a) + trailingZeros(b)), 0);
+}
+
+AbstractValue divide(const AbstractValue &a, const AbstractValue &b) {
+    auto func = [](i64 x, i64 y) -> i64 { return y == 0 || (x == INT32_MIN && y == -1) ? INT32_MAX : x / y; };
+
+    // The quotient is monotonic over divisors of a single sign
+    RangeBuilder range;
+    if (b.lo < 0) {
+        includeCorners(range, a.lo, a.hi, b.lo, std::min(b.hi, -1), func);
+    }
+    if (b.hi > 0) {
+        includeCorners(range, a.lo, a.hi, std::max(b.lo, 1), b.hi, func);
+    }
+    if (b.MayBeZero()) {
+        range.Include(INT32_MAX);
+    }
+    return range.Build(a.deps | b.deps);
+}
+
+AbstractValue modulo(const AbstractValue &a, const AbstractValue &b) {
+    // The remainder is smaller than the divisor in magnitude and takes the sign of the dividend.
+    // Division by zero yields 0, which is always in range.
+    const i64 bound = std::max(std::abs((i64)b.lo), std::abs((i64)b.hi)) - 1;
+    if (bound < 0) {
+        return AbstractValue::Constant(0);
+    }
+    const i64 lo = a.lo >= 0 ? 0 : std::max((i64)a.lo, -bound);
+    const i64 hi = a.hi <= 0 ? 0 : std::min((i64)a.hi, bound);
+    return fromRange(lo, hi, a.deps | b.deps);
+}
+
+AbstractValue negate(const AbstractValue &a) {
+    if (a.lo == INT32_MIN) {
+        return withBits(top(a.deps), lowMask(trailingZeros(a)), 0);
+    }
+    return withBits(fromRange(-(i64)a.hi, -(i64)a.lo, a.deps), lowMask(trailingZeros(a)), 0);
+}
+
+// Range of shift amounts after x86 masking
+std::pair<u32, u32> shiftRange(const AbstractValue &amount) {
+    if (amount.IsConstant()) {
+        const u32 shift = (u32)amount.lo & 31;
+        return {shift, shift};
+    }
+    if (amount.lo >= 0 && amount.hi <= 31) {
+        return {(u32)amount.lo, (u32)amount.hi};
+    }
+    return {0, 31};
+}
+
+AbstractValue leftShift(const AbstractValue &a, const AbstractValue &b) {
+    const auto [minShift, maxShift] = shiftRange(b);
+    RangeBuilder range;
+    includeCorners(range, a.lo, a.hi, minShift, maxShift, [](i64 x, i64 s) { return x * (1ll << s); });
+    const AbstractValue value = range.Build(a.deps | b.deps);
+    if (minShift == maxShift) {
+        return withBits(value, (a.knownZero << minShift) | lowMask(minShift), a.knownOne << minShift);
+    }
+    return withBits(value, lowMask(trailingZeros(a) + minShift), 0);
+}
+
+AbstractValue arithmeticRightShift(const AbstractValue &a, const AbstractValue &b) {
+    const auto [minShift, maxShift] = shiftRange(b);
+    RangeBuilder range;
+    includeCorners(range, a.lo, a.hi, minShift, maxShift, [](i64 x, i64 s) { return x >> s; });
+    const AbstractValue value = range.Build(a.deps | b.deps);
+    if (minShift == maxShift) {
+        return withBits(value, (u32)((i32)a.knownZero >> minShift), (u32)((i32)a.knownOne >> minShift));
+    }
+    return value;
+}
+
+AbstractValue logicRightShift(const AbstractValue &a, const AbstractValue &b) {
+    const auto [minShift, maxShift] = shiftRange(b);
+    RangeBuilder range;
+    // Nonnegative values shift like signed values
+    if (a.hi >= 0) {
+        includeCorners(range, std::max(a.lo, 0), a.hi, minShift, maxShift, [](i64 x, i64 s) { return x >> s; });
+    }
+    // Negative values are unchanged by a zero shift and become large positive values otherwise
+    if (a.lo < 0) {
+        if (minShift == 0) {
+            range.Include(a.lo);
+            range.Include(std::min(a.hi, -1));
+        }
+        if (maxShift > 0) {
+            includeCorners(range, (u32)a.lo, (u32)std::min(a.hi, -1), std::max(minShift, 1u), maxShift,
+                           [](i64 x, i64 s) { return x >> s; });
+        }
+    }
+    const AbstractValue value = range.Build(a.deps | b.deps);
+    if (minShift == maxShift) {
+        return withBits(value, (a.knownZero >> minShift) | ~(~0u >> minShift), a.knownOne >> minShift);
+    }
+    return value;
+}
+
+// ----- Bitwise ------------------------------------------------------------------------------------------------------
+
+// Smallest all-ones mask that covers a nonnegative value
+i64 coveringMask(i64 value) {
+    return (i64)std::bit_ceil((u64)value + 1) - 1;
+}
+
+AbstractValue bitwiseAnd(const AbstractValue &a, const AbstractValue &b) {
+    AbstractValue value = top(a.deps | b.deps);
+    // Clearing bits of a nonnegative value can only make it smaller
+    if (a.lo >= 0 || b.lo >= 0) {
+        value.lo = 0;
+        value.hi = (i32)std::min(a.lo >= 0 ? (i64)a.hi : INT32_MAX, b.lo >= 0 ? (i64)b.hi : INT32_MAX);
+    }
+    return withBits(value, a.knownZero | b.knownZero, a.knownOne & b.knownOne);
+}
+
+AbstractValue bitwiseOr(const AbstractValue &a, const AbstractValue &b) {
+    AbstractValue value = top(a.deps | b.deps);
+    if (a.lo >= 0 && b.lo >= 0) {
+        value.lo = std::max(a.lo, b.lo);
+        value.hi = (i32)coveringMask(std::max(a.hi, b.hi));
+    }
+    return withBits(value, a.knownZero & b.knownZero, a.knownOne | b.knownOne);
+}
+
+AbstractValue bitwiseXor(const AbstractValue &a, const AbstractValue &b) {
+    AbstractValue value = top(a.deps | b.deps);
+    if (a.lo >= 0 && b.lo >= 0) {
+        value.lo = 0;
+        value.hi = (i32)coveringMask(std::max(a.hi, b.hi));
+    }
+    const u32 knownZero = (a.knownZero & b.knownZero) | (a.knownOne & b.knownOne);
+    const u32 knownOne = (a.knownZero & b.knownOne) | (a.knownOne & b.knownZero);
+    return withBits(value, knownZero, knownOne);
+}
+
+AbstractValue bitwiseNot(const AbstractValue &a) {
+    AbstractValue value{};
+    value.lo = ~a.hi;
+    value.hi = ~a.lo;
+    value.knownZero = a.knownOne;
+    value.knownOne = a.knownZero;
+    value.deps = a.deps;
+    return value;
+}
+
+// ----- Selection ----------------------------------------------------------------------------------------------------
+
+// Picks one of two values depending on whether the selector is nonzero
+AbstractValue select(const AbstractValue &selector, const AbstractValue &ifNonZero, const AbstractValue &ifZero) {
+    if (!selector.MayBeZero()) {
+        return ifNonZero;
+    }
+    if (!selector.MayBeNonZero()) {
+        return ifZero;
+    }
+    AbstractValue value = hull(ifNonZero, ifZero);
+    value.deps |= selector.deps;
+    return value;
+}
+
+// Flips the bits of a contiguous low bit mask
+AbstractValue flipBits(const AbstractValue &a, u32 mask) {
+    AbstractValue value{};
+    value.lo = (i32)((u32)a.lo & ~mask);
+    value.hi = (i32)((u32)a.hi | mask);
+    value.knownZero = (a.knownZero & ~mask) | (a.knownOne & mask);
+    value.knownOne = (a.knownOne & ~mask) | (a.knownZero & mask);
+    value.deps = a.deps;
+    return normalize(value);
+}
+
+// ----- Data point operators -----------------------------------------------------------------------------------------
+
+AbstractValue divideByFeature(const AbstractValue &a, const AbstractValue &divisor) {
+    if (divisor.lo < 1) {
+        return top(a.deps | divisor.deps);
+    }
+    RangeBuilder range;
+    includeCorners(range, a.lo, a.hi, divisor.lo, divisor.hi, [](i64 x, i64 y) { return x / y; });
+    return range.Build(a.deps | divisor.deps);
+}
+
+AbstractValue mulHeightDivWidthAA(const AbstractValue &a, const AbstractValue &height, const AbstractValue &width) {
+    // Evaluated in u32 arithmetic; only tracked while the product can't wrap
+    const u32 deps = a.deps | height.deps | width.deps;
+    if (a.lo < 0 || height.lo < 0 || width.lo < 1) {
+        return top(deps);
+    }
+    const i64 maxProduct = (i64)a.hi * height.hi * Slope::kAAFracRange;
+    if (maxProduct > UINT32_MAX) {
+        return top(deps);
+    }
+    const i64 minProduct = (i64)a.lo * height.lo * Slope::kAAFracRange;
+    return fromRange(minProduct / width.hi, maxProduct / width.lo, deps);
+}
+
+} // namespace
+
+// -------------------------------------------------------------------------------------------------------------------
+
+FeatureRanges FeatureRanges::Of(std::span<const DataPointFeatures> features) {
+    FeatureRanges ranges;
+    ranges.lo.fill(INT32_MAX);
+    ranges.hi.fill(INT32_MIN);
+    for (auto &point : features) {
+        for (size_t i = 0; i < DataPointFeatures::kNumFeatures; i++) {
+            ranges.lo[i] = std::min(ranges.lo[i], point.values[i]);
+            ranges.hi[i] = std::max(ranges.hi[i], point.values[i]);
+        }
+    }
+    if (features.empty()) {
+        ranges.lo.fill(INT32_MIN);
+        ranges.hi.fill(INT32_MAX);
+    }
+    return ranges;
+}
+
+AbstractValue FeatureRanges::Value(Feature feature) const {
+    AbstractValue value{};
+    value.lo = lo[feature];
+    value.hi = hi[feature];
+    value.deps = 1u << feature;
+    return normalize(value);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+
+AbstractStack::State AbstractStack::Apply(const Operation &op) {
+    if (m_state != State::Valid) {
+        return m_state;
+    }
+
+    auto &values = m_values;
+    auto pop = [&] {
+        const AbstractValue value = values.back();
+        values.pop_back();
+        return value;
+    };
+
+    if (op.type == Operation::Type::Constant) {
+        values.push_back(AbstractValue::Constant(op.constVal));
+    } else if (Feature feature; DataPointFeatures::PushedBy(op.op, feature)) {
+        values.push_back(m_ranges->Value(feature));
+    } else if (op.op == Operator::Rot || op.op == Operator::RevRot) {
+        if (values.empty()) {
+            return Fail(State::Fails);
+        }
+        const AbstractValue count = pop();
+        if (count.hi < 1 || count.lo > (i64)values.size()) {
+            return Fail(State::Fails);
+        }
+        if (!count.IsConstant()) {
+            return Fail(State::Unknown);
+        }
+        auto begin = values.end() - count.lo;
+        if (op.op == Operator::Rot) {
+            std::rotate(begin, values.end() - 1, values.end());
+        } else {
+            std::rotate(begin, begin + 1, values.end());
+        }
+    } else {
+        if (values.size() < StackProfile::RequiredDepth(op.op)) {
+            return Fail(State::Fails);
+        }
+        auto unary = [&](auto &&func) { values.back() = func(values.back()); };
+        auto binary = [&](auto &&func) {
+            const AbstractValue y = pop();
+            values.back() = func(values.back(), y);
+        };
+        auto feature = [&](Feature feature) { return m_ranges->Value(feature); };
+
+        switch (op.op) {
+        case Operator::Add: binary(add); break;
+        case Operator::Subtract: binary(subtract); break;
+        case Operator::Multiply: binary(multiply); break;
+        case Operator::Divide: binary(divide); break;
+        case Operator::Modulo: binary(modulo); break;
+        case Operator::Negate: unary(negate); break;
+        case Operator::LeftShift: binary(leftShift); break;
+        case Operator::ArithmeticRightShift: binary(arithmeticRightShift); break;
+        case Operator::LogicRightShift: binary(logicRightShift); break;
+        case Operator::And: binary(bitwiseAnd); break;
+        case Operator::Or: binary(bitwiseOr); break;
+        case Operator::Xor: binary(bitwiseXor); break;
+        case Operator::Not: unary(bitwiseNot); break;
+
+        case Operator::Dup: values.push_back(values.back()); break;
+        case Operator::Over: values.push_back(values[values.size() - 2]); break;
+        case Operator::Swap: std::swap(values[values.size() - 1], values[values.size() - 2]); break;
+        case Operator::Drop: values.pop_back(); break;
+        case Operator::IfElse: {
+            const AbstractValue selector = pop();
+            const AbstractValue first = pop();
+            values.back() = select(selector, first, values.back());
+            break;
+        }
+
+        case Operator::InsertAAFracBits:
+            unary([](const AbstractValue &x) { return multiply(x, AbstractValue::Constant(Slope::kAAFracRange)); });
+            break;
+        case Operator::InvertAA:
+            binary([](const AbstractValue &x, const AbstractValue &y) {
+                return select(x, flipBits(y, Slope::kAARange - 1), y);
+            });
+            break;
+        case Operator::InvertAAFrac:
+            binary([](const AbstractValue &x, const AbstractValue &y) {
+                return select(x, flipBits(y, Slope::kAAFracRange - 1), y);
+            });
+            break;
+        case Operator::MulWidth: values.back() = multiply(values.back(), feature(DataPointFeatures::kWidth)); break;
+        case Operator::MulHeight: values.back() = multiply(values.back(), feature(DataPointFeatures::kHeight)); break;
+        case Operator::DivWidth:
+            values.back() = divideByFeature(values.back(), feature(DataPointFeatures::kWidth));
+            break;
+        case Operator::DivHeight:
+            values.back() = divideByFeature(values.back(), feature(DataPointFeatures::kHeight));
+            break;
+        case Operator::Add1: values.back() = add(values.back(), AbstractValue::Constant(1)); break;
+        case Operator::Sub1: values.back() = subtract(values.back(), AbstractValue::Constant(1)); break;
+        case Operator::Mul2: values.back() = leftShift(values.back(), AbstractValue::Constant(1)); break;
+        case Operator::Div2: values.back() = arithmeticRightShift(values.back(), AbstractValue::Constant(1)); break;
+        case Operator::MulHeightDivWidthAA:
+            values.back() = mulHeightDivWidthAA(values.back(), feature(DataPointFeatures::kHeight),
+                                                feature(DataPointFeatures::kWidth));
+            break;
+        case Operator::And1: values.back() = bitwiseAnd(values.back(), AbstractValue::Constant(1)); break;
+
+        default: return Fail(State::Unknown);
+        }
+    }
+
+    if (values.size() > kStackSize) {
+        return Fail(State::Fails);
+    }
+    return m_state;
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+
+void FormulaPruner::SetDataPoints(std::span<const DataPointFeatures> features, std::span<const Target> targets) {
+    m_features.assign(features.begin(), features.end());
+    m_targets.assign(targets.begin(), targets.end());
+    m_ranges = FeatureRanges::Of(features);
+    m_totalWeight = 0;
+    for (auto &target : targets) {
+        m_totalWeight += target.weight;
+    }
+    m_groups.clear();
+}
+
+uint64_t FormulaPruner::MinErrors(const AbstractValue &value) {
+    uint64_t errors = 0;
+    for (auto &group : GroupsFor(value.deps)) {
+        if (group.size() == 1) {
+            const Target &target = m_targets[group[0]];
+            if (target.hi < value.lo || target.lo > value.hi) {
+                errors += target.weight;
+            }
+            continue;
+        }
+
+        // Every point in the group gets the same result, so the best case passes the heaviest set of windows that
+        // share a common value within the range of the result
+        uint64_t groupWeight = 0;
+        m_events.clear();
+        for (uint32_t index : group) {
+            const Target &target = m_targets[index];
+            groupWeight += target.weight;
+            const i32 lo = std::max(target.lo, value.lo);
+            const i32 hi = std::min(target.hi, value.hi);
+            if (lo <= hi) {
+                m_events.emplace_back(lo, (i64)target.weight);
+                m_events.emplace_back((i64)hi + 1, -(i64)target.weight);
+            }
+        }
+        // Windows that end before a position are removed before the ones starting there are added
+        std::sort(m_events.begin(), m_events.end());
+        i64 weight = 0;
+        i64 maxWeight = 0;
+        for (auto &[pos, delta] : m_events) {
+            weight += delta;
+            maxWeight = std::max(maxWeight, weight);
+        }
+        errors += groupWeight - (uint64_t)maxWeight;
+    }
+    return errors;
+}
+
+const FormulaPruner::Groups &FormulaPruner::GroupsFor(u32 deps) {
+    if (auto it = m_groups.find(deps); it != m_groups.end()) {
+        return it->second;
+    }
+
+    Groups groups;
+    std::map<std::vector<i32>, size_t> groupIndices;
+    std::vector<i32> key;
+    for (uint32_t i = 0; i < m_features.size(); i++) {
+        key.clear();
+        for (u32 mask = deps; mask != 0; mask &= mask - 1) {
+            key.push_back(m_features[i].values[std::countr_zero(mask)]);
+        }
+        auto [it, inserted] = groupIndices.try_emplace(key, groups.size());
+        if (inserted) {
+            groups.emplace_back();
+        }
+        groups[it->second].push_back(i);
+    }
+    return m_groups.emplace(deps, std::move(groups)).first->second;
+}
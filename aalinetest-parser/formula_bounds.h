@@ -0,0 +1,149 @@
+#pragma once
+
+#include "func.h"
+
+#include <array>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+// Abstract interpretation of formulas over whole data sets.
+//
+// Instead of concrete numbers, formulas are run on abstract values that describe every value an expression can take
+// across a set of data points. This proves facts such as "the result is always negative" or "the result only depends
+// on the width" without evaluating the formula on any data point, which lets the searches discard hopeless candidates
+// cheaply. All rules are sound with respect to the i32 wraparound semantics of the evaluators.
+
+static_assert(DataPointFeatures::kNumFeatures <= 32, "feature dependencies must fit in a 32-bit mask");
+
+// Set of possible values of an expression
+struct AbstractValue {
+    i32 lo = INT32_MIN; // Signed range of the value
+    i32 hi = INT32_MAX;
+    u32 knownZero = 0; // Bits that are always clear
+    u32 knownOne = 0;  // Bits that are always set
+    u32 deps = 0;      // Bit mask of the DataPointFeatures the value may depend on; 0 for constants
+
+    static AbstractValue Constant(i32 value) {
+        return {value, value, ~(u32)value, (u32)value, 0};
+    }
+
+    bool IsConstant() const {
+        return lo == hi;
+    }
+
+    // Determines if the value can be nonzero or zero, respectively
+    bool MayBeNonZero() const {
+        return lo != 0 || hi != 0;
+    }
+    bool MayBeZero() const {
+        return lo <= 0 && hi >= 0 && knownOne == 0;
+    }
+};
+
+// Range of every feature over a set of data points
+struct FeatureRanges {
+    std::array<i32, DataPointFeatures::kNumFeatures> lo;
+    std::array<i32, DataPointFeatures::kNumFeatures> hi;
+
+    static FeatureRanges Of(std::span<const DataPointFeatures> features);
+
+    AbstractValue Value(DataPointFeatures::Feature feature) const;
+};
+
+// Formula stack made of abstract values, built one operation at a time
+class AbstractStack {
+public:
+    enum class State {
+        Valid,   // Every data point runs every operation so far
+        Fails,   // Every data point fails on some operation
+        Unknown, // Rot or RevRot with a count that isn't constant; nothing more can be said
+    };
+
+    explicit AbstractStack(const FeatureRanges &ranges)
+        : m_ranges(&ranges) {}
+
+    void Clear() {
+        m_values.clear();
+        m_state = State::Valid;
+    }
+
+    // Applies an operation to the stack. Once the state leaves Valid, further operations are ignored.
+    State Apply(const Operation &op);
+
+    State Apply(std::span<const Operation> ops) {
+        for (auto &op : ops) {
+            Apply(op);
+        }
+        return m_state;
+    }
+
+    State GetState() const {
+        return m_state;
+    }
+
+    size_t Size() const {
+        return m_values.size();
+    }
+
+    const AbstractValue &Top() const {
+        return m_values.back();
+    }
+
+private:
+    const FeatureRanges *m_ranges;
+    std::vector<AbstractValue> m_values;
+    State m_state = State::Valid;
+
+    State Fail(State state) {
+        m_state = state;
+        return state;
+    }
+};
+
+// Bounds the number of errors of formulas on a data set using their abstract results.
+//
+// Every data point has a target window of accepted results and an error weight. Two rules bound the error weight of
+// a formula from below:
+// - data points whose window doesn't overlap the range of the result always fail
+// - data points that agree on every feature the result depends on get the same result, so at most one group of
+//   overlapping windows among them can pass
+//
+// Not thread-safe: the data point groupings for each dependency mask are built on demand and memoized.
+class FormulaPruner {
+public:
+    struct Target {
+        i32 lo;
+        i32 hi;
+        uint64_t weight;
+    };
+
+    FormulaPruner()
+        : m_ranges(FeatureRanges::Of({})) {}
+
+    void SetDataPoints(std::span<const DataPointFeatures> features, std::span<const Target> targets);
+
+    const FeatureRanges &Ranges() const {
+        return m_ranges;
+    }
+
+    uint64_t TotalWeight() const {
+        return m_totalWeight;
+    }
+
+    // Returns a lower bound on the error weight of a formula whose result is described by value
+    uint64_t MinErrors(const AbstractValue &value);
+
+private:
+    using Groups = std::vector<std::vector<uint32_t>>;
+
+    std::vector<DataPointFeatures> m_features;
+    std::vector<Target> m_targets;
+    FeatureRanges m_ranges;
+    uint64_t m_totalWeight = 0;
+
+    std::unordered_map<u32, Groups> m_groups;  // Data points grouped by the features in a dependency mask
+    std::vector<std::pair<i64, i64>> m_events; // Scratch space for MinErrors
+
+    const Groups &GroupsFor(u32 deps);
+};
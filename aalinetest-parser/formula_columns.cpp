@@ -0,0 +1,279 @@
+#include "formula_columns.h"
+
+#include <algorithm>
+
+ColumnArena &ColumnArena::ThreadLocal() {
+    thread_local ColumnArena arena;
+    return arena;
+}
+
+ColumnArena::Column *ColumnArena::Acquire(size_t count) {
+    if (m_columns.size() < count) {
+        m_columns.resize(count);
+    }
+    return m_columns.data();
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+
+bool ColumnInterpreter::Evaluate(const FormulaBatch &batch, std::span<i32> results, size_t &stackSize) const {
+    stackSize = 0;
+    if (!m_formula.Profile().CanSucceed(0)) {
+        return false;
+    }
+
+    ColumnArena::Column *columns = ColumnArena::ThreadLocal().Acquire(kMaxDepth);
+    for (size_t first = 0; first < batch.Size(); first += kBlockSize) {
+        const size_t count = std::min(kBlockSize, batch.Size() - first);
+        switch (EvaluateBlock(batch, first, count, columns, &results[first], stackSize)) {
+        case BlockResult::Valid: break;
+        case BlockResult::Invalid: return false;
+        case BlockResult::Diverged:
+            if (!EvaluateScalar(batch, first, count, &results[first], stackSize)) {
+                return false;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+ColumnInterpreter::BlockResult ColumnInterpreter::EvaluateBlock(const FormulaBatch &batch, size_t first, size_t count,
+                                                                ColumnArena::Column *columns, i32 *results,
+                                                                size_t &stackSize) const {
+    using C = FormulaBatch::Column;
+
+    // Stack slots; always a permutation of the arena columns
+    std::array<i32 *, kMaxDepth> slots;
+    for (size_t i = 0; i < kMaxDepth; i++) {
+        slots[i] = columns[i].values.data();
+    }
+    size_t depth = 0;
+
+    auto col = [&](C column) -> const i32 * { return batch.columns[column].data() + first; };
+
+    auto push = [&](auto &&func) -> bool {
+        if (depth >= kMaxDepth) {
+            return false;
+        }
+        i32 *dst = slots[depth++];
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = func(i);
+        }
+        return true;
+    };
+    auto pushColumn = [&](C column) -> bool {
+        const i32 *src = col(column);
+        return push([=](size_t i) { return src[i]; });
+    };
+    auto unary = [&](auto &&func) -> bool {
+        if (depth < 1) {
+            return false;
+        }
+        i32 *x = slots[depth - 1];
+        for (size_t i = 0; i < count; i++) {
+            x[i] = func(x[i], i);
+        }
+        return true;
+    };
+    auto binary = [&](auto &&func) -> bool {
+        if (depth < 2) {
+            return false;
+        }
+        i32 *x = slots[depth - 2];
+        const i32 *y = slots[depth - 1];
+        for (size_t i = 0; i < count; i++) {
+            x[i] = func(x[i], y[i]);
+        }
+        depth--;
+        return true;
+    };
+    // Pops the count of a Rot or RevRot, which must be the same for every data point
+    auto popCount = [&](i32 &rotCount) -> BlockResult {
+        if (depth < 1) {
+            return BlockResult::Invalid;
+        }
+        const i32 *counts = slots[depth - 1];
+        rotCount = counts[0];
+        if (!std::all_of(counts, counts + count, [&](i32 c) { return c == rotCount; })) {
+            return BlockResult::Diverged;
+        }
+        if (rotCount < 1 || (size_t)rotCount >= depth) {
+            return BlockResult::Invalid;
+        }
+        depth--;
+        return BlockResult::Valid;
+    };
+
+    for (auto &op : m_formula.Source()) {
+        bool valid = true;
+        if (op.type == Operation::Type::Constant) {
+            const i32 value = op.constVal;
+            valid = push([=](size_t) { return value; });
+        } else {
+            switch (op.op) {
+            case Operator::PushX: valid = pushColumn(C::kX); break;
+            case Operator::PushY: valid = pushColumn(C::kY); break;
+            case Operator::PushWidth: valid = pushColumn(C::kWidth); break;
+            case Operator::PushHeight: valid = pushColumn(C::kHeight); break;
+            case Operator::PushPositive: valid = pushColumn(C::kPositive); break;
+            case Operator::PushNegative: valid = pushColumn(C::kNegative); break;
+            case Operator::PushXMajor: valid = pushColumn(C::kXMajor); break;
+            case Operator::PushYMajor: valid = pushColumn(C::kYMajor); break;
+            case Operator::PushLeft: valid = pushColumn(C::kLeft); break;
+            case Operator::PushRight: valid = pushColumn(C::kRight); break;
+
+            case Operator::Add: valid = binary([](i32 x, i32 y) { return x + y; }); break;
+            case Operator::Subtract: valid = binary([](i32 x, i32 y) { return x - y; }); break;
+            case Operator::Multiply: valid = binary([](i32 x, i32 y) { return x * y; }); break;
+            case Operator::Divide:
+                valid = binary([](i32 x, i32 y) { return y == 0 || (x == 0x80000000 && y == -1) ? INT32_MAX : x / y; });
+                break;
+            case Operator::Modulo:
+                valid = binary([](i32 x, i32 y) { return y == 0 || (x == 0x80000000 && y == -1) ? 0 : x % y; });
+                break;
+            case Operator::Negate: valid = unary([](i32 x, size_t) { return -x; }); break;
+            case Operator::LeftShift: valid = binary([](i32 x, i32 y) { return x << y; }); break;
+            case Operator::ArithmeticRightShift: valid = binary([](i32 x, i32 y) { return x >> y; }); break;
+            case Operator::LogicRightShift: valid = binary([](i32 x, i32 y) -> i32 { return (u32)x >> (u32)y; }); break;
+            case Operator::And: valid = binary([](i32 x, i32 y) { return x & y; }); break;
+            case Operator::Or: valid = binary([](i32 x, i32 y) { return x | y; }); break;
+            case Operator::Xor: valid = binary([](i32 x, i32 y) { return x ^ y; }); break;
+            case Operator::Not: valid = unary([](i32 x, size_t) { return ~x; }); break;
+
+            case Operator::Dup:
+                if (depth < 1) {
+                    return BlockResult::Invalid;
+                } else {
+                    const i32 *src = slots[depth - 1];
+                    valid = push([=](size_t i) { return src[i]; });
+                }
+                break;
+            case Operator::Over:
+                if (depth < 2) {
+                    return BlockResult::Invalid;
+                } else {
+                    const i32 *src = slots[depth - 2];
+                    valid = push([=](size_t i) { return src[i]; });
+                }
+                break;
+            case Operator::Swap:
+                if (depth < 2) {
+                    return BlockResult::Invalid;
+                }
+                std::swap(slots[depth - 1], slots[depth - 2]);
+                break;
+            case Operator::Drop:
+                if (depth < 1) {
+                    return BlockResult::Invalid;
+                }
+                depth--;
+                break;
+            case Operator::Rot:
+            case Operator::RevRot: {
+                i32 rotCount;
+                if (auto result = popCount(rotCount); result != BlockResult::Valid) {
+                    return result;
+                }
+                auto begin = slots.begin() + depth - rotCount;
+                auto end = slots.begin() + depth;
+                if (op.op == Operator::Rot) {
+                    std::rotate(begin, end - 1, end);
+                } else {
+                    std::rotate(begin, begin + 1, end);
+                }
+                break;
+            }
+            case Operator::IfElse:
+                if (depth < 3) {
+                    return BlockResult::Invalid;
+                } else {
+                    const i32 *selector = slots[depth - 1];
+                    const i32 *firstVal = slots[depth - 2];
+                    i32 *secondVal = slots[depth - 3];
+                    for (size_t i = 0; i < count; i++) {
+                        secondVal[i] = selector[i] ? firstVal[i] : secondVal[i];
+                    }
+                    depth -= 2;
+                }
+                break;
+
+            case Operator::FracXStart: valid = pushColumn(C::kFracXStart); break;
+            case Operator::FracXEnd: valid = pushColumn(C::kFracXEnd); break;
+            case Operator::FracXWidth: valid = pushColumn(C::kFracXWidth); break;
+            case Operator::XStart: valid = pushColumn(C::kXStart); break;
+            case Operator::XEnd: valid = pushColumn(C::kXEnd); break;
+            case Operator::XWidth: valid = pushColumn(C::kXWidth); break;
+            case Operator::X0: valid = pushColumn(C::kX0); break;
+
+            case Operator::InsertAAFracBits:
+                valid = unary([](i32 x, size_t) -> i32 { return x * Slope::kAAFracRange; });
+                break;
+            case Operator::InvertAA:
+                valid = binary([](i32 x, i32 y) -> i32 { return x ? (y ^ (Slope::kAARange - 1)) : y; });
+                break;
+            case Operator::InvertAAFrac:
+                valid = binary([](i32 x, i32 y) -> i32 { return x ? (y ^ (Slope::kAAFracRange - 1)) : y; });
+                break;
+            case Operator::MulWidth: {
+                const i32 *width = col(C::kWidth);
+                valid = unary([=](i32 x, size_t i) { return x * width[i]; });
+                break;
+            }
+            case Operator::MulHeight: {
+                const i32 *height = col(C::kHeight);
+                valid = unary([=](i32 x, size_t i) { return x * height[i]; });
+                break;
+            }
+            case Operator::DivWidth: {
+                const i32 *width = col(C::kWidth);
+                valid = unary([=](i32 x, size_t i) { return x / width[i]; });
+                break;
+            }
+            case Operator::DivHeight: {
+                const i32 *height = col(C::kHeight);
+                valid = unary([=](i32 x, size_t i) { return x / height[i]; });
+                break;
+            }
+            case Operator::Add1: valid = unary([](i32 x, size_t) { return x + 1; }); break;
+            case Operator::Sub1: valid = unary([](i32 x, size_t) { return x - 1; }); break;
+            case Operator::Mul2: valid = unary([](i32 x, size_t) { return x << 1; }); break;
+            case Operator::Div2: valid = unary([](i32 x, size_t) { return x >> 1; }); break;
+            case Operator::MulHeightDivWidthAA: {
+                const i32 *width = col(C::kWidth);
+                const i32 *height = col(C::kHeight);
+                valid = unary([=](i32 x, size_t i) -> i32 { return x * height[i] * Slope::kAAFracRange / width[i]; });
+                break;
+            }
+            case Operator::AAStep: valid = pushColumn(C::kAAStep); break;
+            case Operator::And1: valid = unary([](i32 x, size_t) { return x & 1; }); break;
+
+            default: valid = false; break;
+            }
+        }
+        if (!valid) {
+            return BlockResult::Invalid;
+        }
+    }
+
+    if (depth == 0) {
+        return BlockResult::Invalid;
+    }
+    std::copy_n(slots[depth - 1], count, results);
+    stackSize = depth;
+    return BlockResult::Valid;
+}
+
+bool ColumnInterpreter::EvaluateScalar(const FormulaBatch &batch, size_t first, size_t count, i32 *results,
+                                       size_t &stackSize) const {
+    FixedStack stack;
+    for (size_t i = 0; i < count; i++) {
+        stack.clear();
+        if (!m_formula.Execute(batch.rows[first + i], stack) || stack.empty()) {
+            return false;
+        }
+        results[i] = stack.back();
+    }
+    stackSize = stack.size();
+    return true;
+}
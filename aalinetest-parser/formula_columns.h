@@ -0,0 +1,76 @@
+#pragma once
+
+#include "formula_batch.h"
+#include "func.h"
+
+#include <array>
+#include <span>
+#include <vector>
+
+// Per-thread pool of column buffers used as stack slots by ColumnInterpreter
+class ColumnArena {
+public:
+    static constexpr size_t kColumnSize = 256;
+
+    struct alignas(64) Column {
+        std::array<i32, kColumnSize> values;
+    };
+
+    // Retrieves the arena owned by the calling thread
+    static ColumnArena &ThreadLocal();
+
+    // Retrieves at least count columns. The pointer remains valid until a call requests more columns than the arena
+    // currently holds.
+    Column *Acquire(size_t count);
+
+    size_t MemorySize() const {
+        return m_columns.size() * sizeof(Column);
+    }
+
+private:
+    std::vector<Column> m_columns;
+};
+
+// Evaluates formulas over batches of data points one operator at a time.
+//
+// Every stack slot is a column holding one value per data point in a block of ColumnArena::kColumnSize data points, so
+// each operator runs as a tight loop over the block and dispatch is paid once per block instead of once per data
+// point. Stack manipulation operators only permute column pointers.
+//
+// Since all data points in a block share the same stack layout, Rot and RevRot require the same count on every data
+// point of the block. Blocks where the counts diverge are evaluated one data point at a time with CompiledFormula.
+class ColumnInterpreter {
+public:
+    static constexpr size_t kBlockSize = ColumnArena::kColumnSize;
+
+    void Compile(std::span<const Operation> ops) {
+        m_formula.Compile(ops);
+    }
+
+    // Compiles the enabled genes of a chromosome, skipping disabled genes entirely
+    template <typename GeneRange>
+    void CompileGenes(const GeneRange &genes) {
+        m_formula.CompileGenes(genes);
+    }
+
+    const std::vector<Operation> &Source() const {
+        return m_formula.Source();
+    }
+
+    // Evaluates the formula over every data point in the batch, writing the top of the stack of each into results.
+    // Returns false if the formula fails on any data point, in which case the results are unspecified.
+    // stackSize receives the final stack depth of the last data point.
+    bool Evaluate(const FormulaBatch &batch, std::span<i32> results, size_t &stackSize) const;
+
+private:
+    // Maximum stack depth, matching FixedStack
+    static constexpr size_t kMaxDepth = std::tuple_size_v<decltype(FixedStack::stack)>;
+
+    enum class BlockResult { Valid, Invalid, Diverged };
+
+    CompiledFormula m_formula;
+
+    BlockResult EvaluateBlock(const FormulaBatch &batch, size_t first, size_t count, ColumnArena::Column *columns,
+                              i32 *results, size_t &stackSize) const;
+    bool EvaluateScalar(const FormulaBatch &batch, size_t first, size_t count, i32 *results, size_t &stackSize) const;
+};
@@ -0,0 +1,416 @@
+#include "formula_ir.h"
+
+#include "formula_columns.h"
+
+#include <algorithm>
+#include <ostream>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+using Node = FormulaIR::Node;
+using Feature = DataPointFeatures::Feature;
+
+constexpr size_t kStackSize = std::tuple_size_v<decltype(FixedStack::stack)>;
+
+// Operator that pushes a feature, used for naming feature nodes
+Operator featureOperator(Feature feature) {
+    switch (feature) {
+    case DataPointFeatures::kX: return Operator::PushX;
+    case DataPointFeatures::kY: return Operator::PushY;
+    case DataPointFeatures::kWidth: return Operator::PushWidth;
+    case DataPointFeatures::kHeight: return Operator::PushHeight;
+    case DataPointFeatures::kLeft: return Operator::PushLeft;
+    case DataPointFeatures::kRight: return Operator::PushRight;
+    case DataPointFeatures::kPositive: return Operator::PushPositive;
+    case DataPointFeatures::kNegative: return Operator::PushNegative;
+    case DataPointFeatures::kXMajor: return Operator::PushXMajor;
+    case DataPointFeatures::kYMajor: return Operator::PushYMajor;
+    case DataPointFeatures::kFracXStart: return Operator::FracXStart;
+    case DataPointFeatures::kFracXEnd: return Operator::FracXEnd;
+    case DataPointFeatures::kFracXWidth: return Operator::FracXWidth;
+    case DataPointFeatures::kXStart: return Operator::XStart;
+    case DataPointFeatures::kXEnd: return Operator::XEnd;
+    case DataPointFeatures::kXWidth: return Operator::XWidth;
+    case DataPointFeatures::kX0: return Operator::X0;
+    case DataPointFeatures::kAAStep: return Operator::AAStep;
+    default: return Operator::PushX;
+    }
+}
+
+// Features read by operators that transform the top of the stack using the data point, appended as extra arguments
+std::span<const Feature> readFeatures(Operator op) {
+    static constexpr Feature kWidth[] = {DataPointFeatures::kWidth};
+    static constexpr Feature kHeight[] = {DataPointFeatures::kHeight};
+    static constexpr Feature kHeightWidth[] = {DataPointFeatures::kHeight, DataPointFeatures::kWidth};
+    switch (op) {
+    case Operator::MulWidth:
+    case Operator::DivWidth: return kWidth;
+    case Operator::MulHeight:
+    case Operator::DivHeight: return kHeight;
+    case Operator::MulHeightDivWidthAA: return kHeightWidth;
+    default: return {};
+    }
+}
+
+bool isCommutative(Operator op) {
+    switch (op) {
+    case Operator::Add:
+    case Operator::Multiply:
+    case Operator::And:
+    case Operator::Or:
+    case Operator::Xor: return true;
+    default: return false;
+    }
+}
+
+struct NodeHash {
+    size_t operator()(const Node &node) const {
+        size_t hash = ((size_t)node.kind << 8) ^ (size_t)node.op ^ ((size_t)(u32)node.value << 16);
+        for (size_t i = 0; i < node.numArgs; i++) {
+            hash = hash * 0x9E3779B97F4A7C15ull + node.args[i];
+        }
+        return hash;
+    }
+};
+
+// Builds the node list with value numbering and constant folding
+class Builder {
+public:
+    explicit Builder(std::vector<Node> &nodes)
+        : m_nodes(nodes) {}
+
+    u32 AddConstant(i32 value) {
+        return Add(Node{.kind = Node::Kind::Constant, .value = value});
+    }
+
+    u32 AddFeature(Feature feature) {
+        return Add(Node{.kind = Node::Kind::Feature, .op = featureOperator(feature), .value = (i32)feature});
+    }
+
+    u32 AddOperator(Node node) {
+        if (isCommutative(node.op) && node.args[0] > node.args[1]) {
+            std::swap(node.args[0], node.args[1]);
+        }
+        i32 folded;
+        if (Fold(node, folded)) {
+            return AddConstant(folded);
+        }
+        return Add(node);
+    }
+
+    bool IsConstant(u32 index, i32 &value) const {
+        if (m_nodes[index].kind != Node::Kind::Constant) {
+            return false;
+        }
+        value = m_nodes[index].value;
+        return true;
+    }
+
+private:
+    std::vector<Node> &m_nodes;
+    std::unordered_map<Node, u32, NodeHash> m_index;
+
+    u32 Add(const Node &node) {
+        auto [it, inserted] = m_index.try_emplace(node, (u32)m_nodes.size());
+        if (inserted) {
+            m_nodes.push_back(node);
+        }
+        return it->second;
+    }
+
+    // Runs the operator itself on constant arguments so that the result matches evaluation bit for bit.
+    // Operators that read the data point always have a feature argument and are never folded.
+    bool Fold(const Node &node, i32 &result) const {
+        Slope slope{};
+        Variables vars{};
+        FixedStack stack;
+        for (size_t i = 0; i < node.numArgs; i++) {
+            i32 value;
+            if (!IsConstant(node.args[i], value)) {
+                return false;
+            }
+            stack.push_back(value);
+        }
+        const Operation op{.type = Operation::Type::Operator, .op = node.op};
+        if (!op.Execute(slope, stack, vars) || stack.size() != 1) {
+            return false;
+        }
+        result = stack.back();
+        return true;
+    }
+};
+
+} // namespace
+
+// -------------------------------------------------------------------------------------------------------------------
+
+void FormulaIR::Clear() {
+    m_nodes.clear();
+    m_stackSize = 0;
+}
+
+bool FormulaIR::Build(std::span<const Operation> ops) {
+    Clear();
+
+    std::vector<Node> nodes;
+    Builder builder{nodes};
+    std::vector<u32> stack; // Node index of each stack slot
+
+    auto fail = [&] {
+        Clear();
+        return false;
+    };
+
+    for (auto &op : ops) {
+        if (op.type == Operation::Type::Constant) {
+            stack.push_back(builder.AddConstant(op.constVal));
+        } else if (Feature feature; DataPointFeatures::PushedBy(op.op, feature)) {
+            stack.push_back(builder.AddFeature(feature));
+        } else {
+            switch (op.op) {
+            case Operator::Dup:
+                if (stack.size() < 1) {
+                    return fail();
+                }
+                stack.push_back(stack.back());
+                break;
+            case Operator::Over:
+                if (stack.size() < 2) {
+                    return fail();
+                }
+                stack.push_back(stack[stack.size() - 2]);
+                break;
+            case Operator::Swap:
+                if (stack.size() < 2) {
+                    return fail();
+                }
+                std::swap(stack[stack.size() - 1], stack[stack.size() - 2]);
+                break;
+            case Operator::Drop:
+                if (stack.size() < 1) {
+                    return fail();
+                }
+                stack.pop_back();
+                break;
+            case Operator::Rot:
+            case Operator::RevRot: {
+                i32 count;
+                if (stack.size() < 1 || !builder.IsConstant(stack.back(), count)) {
+                    return fail();
+                }
+                if (count < 1 || (size_t)count >= stack.size()) {
+                    return fail();
+                }
+                stack.pop_back();
+                const auto end = stack.end();
+                if (op.op == Operator::Rot) {
+                    std::rotate(end - count, end - 1, end);
+                } else {
+                    std::rotate(end - count, end - count + 1, end);
+                }
+                break;
+            }
+            default: {
+                const auto features = readFeatures(op.op);
+                Node node{.kind = Node::Kind::Operator, .op = op.op};
+                node.numArgs = (u8)StackProfile::RequiredDepth(op.op);
+                if (node.numArgs == 0 || node.numArgs + features.size() > kMaxArgs || stack.size() < node.numArgs) {
+                    return fail();
+                }
+                std::copy(stack.end() - node.numArgs, stack.end(), node.args.begin());
+                stack.resize(stack.size() - node.numArgs);
+                for (auto feature : features) {
+                    node.args[node.numArgs++] = builder.AddFeature(feature);
+                }
+                stack.push_back(builder.AddOperator(node));
+                break;
+            }
+            }
+        }
+        if (stack.size() > kStackSize) {
+            return fail();
+        }
+    }
+    if (stack.empty()) {
+        return fail();
+    }
+
+    // Keep only the nodes that contribute to the result. Arguments always precede their users, so the result ends up
+    // being the last node.
+    std::vector<bool> live(nodes.size(), false);
+    live[stack.back()] = true;
+    for (size_t i = nodes.size(); i-- > 0;) {
+        if (live[i]) {
+            for (size_t arg = 0; arg < nodes[i].numArgs; arg++) {
+                live[nodes[i].args[arg]] = true;
+            }
+        }
+    }
+    std::vector<u32> remap(nodes.size());
+    for (size_t i = 0; i <= stack.back(); i++) {
+        if (live[i]) {
+            remap[i] = (u32)m_nodes.size();
+            Node node = nodes[i];
+            for (size_t arg = 0; arg < node.numArgs; arg++) {
+                node.args[arg] = remap[node.args[arg]];
+            }
+            m_nodes.push_back(node);
+        }
+    }
+    m_stackSize = stack.size();
+    return true;
+}
+
+size_t FormulaIR::NumOperations() const {
+    return std::count_if(m_nodes.begin(), m_nodes.end(), [](const Node &node) {
+        return node.kind == Node::Kind::Operator;
+    });
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+
+i32 FormulaIR::Evaluate(const DataPointFeatures &features) {
+    std::array<const i32 *, DataPointFeatures::kNumFeatures> columns;
+    for (size_t i = 0; i < columns.size(); i++) {
+        columns[i] = &features.values[i];
+    }
+    i32 result;
+    EvaluateBlock(columns.data(), 1, &result);
+    return result;
+}
+
+bool FormulaIR::Evaluate(const FormulaBatch &batch, std::span<i32> results, size_t &stackSize) {
+    if (!IsValid()) {
+        stackSize = 0;
+        return false;
+    }
+
+    const auto columns = batch.ColumnPointers();
+    std::array<const i32 *, FormulaBatch::kNumColumns> block;
+    for (size_t first = 0; first < batch.Size(); first += ColumnArena::kColumnSize) {
+        const size_t count = std::min(ColumnArena::kColumnSize, batch.Size() - first);
+        for (size_t i = 0; i < block.size(); i++) {
+            block[i] = columns[i] + first;
+        }
+        EvaluateBlock(block.data(), count, &results[first]);
+    }
+    stackSize = m_stackSize;
+    return true;
+}
+
+void FormulaIR::EvaluateBlock(const i32 *const *features, size_t count, i32 *results) {
+    ColumnArena::Column *columns = ColumnArena::ThreadLocal().Acquire(m_nodes.size());
+    m_values.resize(m_nodes.size());
+
+    for (size_t index = 0; index < m_nodes.size(); index++) {
+        const Node &node = m_nodes[index];
+        if (node.kind == Node::Kind::Feature) {
+            m_values[index] = features[node.value];
+            continue;
+        }
+        i32 *dst = columns[index].values.data();
+        m_values[index] = dst;
+        if (node.kind == Node::Kind::Constant) {
+            std::fill_n(dst, count, node.value);
+            continue;
+        }
+
+        const i32 *a = m_values[node.args[0]];
+        const i32 *b = node.numArgs > 1 ? m_values[node.args[1]] : nullptr;
+        const i32 *c = node.numArgs > 2 ? m_values[node.args[2]] : nullptr;
+        auto unary = [&](auto &&func) {
+            for (size_t i = 0; i < count; i++) {
+                dst[i] = func(a[i]);
+            }
+        };
+        auto binary = [&](auto &&func) {
+            for (size_t i = 0; i < count; i++) {
+                dst[i] = func(a[i], b[i]);
+            }
+        };
+
+        switch (node.op) {
+        case Operator::Add: binary([](i32 x, i32 y) { return x + y; }); break;
+        case Operator::Subtract: binary([](i32 x, i32 y) { return x - y; }); break;
+        case Operator::Multiply: binary([](i32 x, i32 y) { return x * y; }); break;
+        case Operator::Divide:
+            binary([](i32 x, i32 y) { return y == 0 || (x == 0x80000000 && y == -1) ? INT32_MAX : x / y; });
+            break;
+        case Operator::Modulo:
+            binary([](i32 x, i32 y) { return y == 0 || (x == 0x80000000 && y == -1) ? 0 : x % y; });
+            break;
+        case Operator::Negate: unary([](i32 x) { return -x; }); break;
+        case Operator::LeftShift: binary([](i32 x, i32 y) { return x << y; }); break;
+        case Operator::ArithmeticRightShift: binary([](i32 x, i32 y) { return x >> y; }); break;
+        case Operator::LogicRightShift: binary([](i32 x, i32 y) -> i32 { return (u32)x >> (u32)y; }); break;
+        case Operator::And: binary([](i32 x, i32 y) { return x & y; }); break;
+        case Operator::Or: binary([](i32 x, i32 y) { return x | y; }); break;
+        case Operator::Xor: binary([](i32 x, i32 y) { return x ^ y; }); break;
+        case Operator::Not: unary([](i32 x) { return ~x; }); break;
+
+        case Operator::IfElse:
+            // (second, first, selector) -> selector ? first : second
+            for (size_t i = 0; i < count; i++) {
+                dst[i] = c[i] ? b[i] : a[i];
+            }
+            break;
+
+        case Operator::InsertAAFracBits: unary([](i32 x) -> i32 { return x * Slope::kAAFracRange; }); break;
+        case Operator::InvertAA: binary([](i32 x, i32 y) -> i32 { return x ? (y ^ (Slope::kAARange - 1)) : y; }); break;
+        case Operator::InvertAAFrac:
+            binary([](i32 x, i32 y) -> i32 { return x ? (y ^ (Slope::kAAFracRange - 1)) : y; });
+            break;
+        case Operator::MulWidth:
+        case Operator::MulHeight: binary([](i32 x, i32 size) { return x * size; }); break;
+        case Operator::DivWidth:
+        case Operator::DivHeight: binary([](i32 x, i32 size) { return x / size; }); break;
+        case Operator::Add1: unary([](i32 x) { return x + 1; }); break;
+        case Operator::Sub1: unary([](i32 x) { return x - 1; }); break;
+        case Operator::Mul2: unary([](i32 x) { return x << 1; }); break;
+        case Operator::Div2: unary([](i32 x) { return x >> 1; }); break;
+        case Operator::MulHeightDivWidthAA:
+            for (size_t i = 0; i < count; i++) {
+                dst[i] = a[i] * b[i] * Slope::kAAFracRange / c[i];
+            }
+            break;
+        case Operator::And1: unary([](i32 x) { return x & 1; }); break;
+
+        default: break;
+        }
+    }
+
+    std::copy_n(m_values.back(), count, results);
+}
+
+// -------------------------------------------------------------------------------------------------------------------
+
+void FormulaIR::Print(std::ostream &os) const {
+    if (!IsValid()) {
+        os << "(invalid)\n";
+        return;
+    }
+    for (size_t i = 0; i < m_nodes.size(); i++) {
+        const Node &node = m_nodes[i];
+        os << "%" << i << " = ";
+        switch (node.kind) {
+        case Node::Kind::Constant: os << node.value; break;
+        case Node::Kind::Feature: os << OperatorName(node.op); break;
+        case Node::Kind::Operator:
+            os << OperatorName(node.op);
+            for (size_t arg = 0; arg < node.numArgs; arg++) {
+                os << (arg == 0 ? " %" : ", %") << node.args[arg];
+            }
+            break;
+        }
+        os << "\n";
+    }
+    os << "result %" << m_nodes.size() - 1 << ", stack size " << m_stackSize << "\n";
+}
+
+std::string FormulaIR::Str() const {
+    std::ostringstream os;
+    Print(os);
+    return os.str();
+}
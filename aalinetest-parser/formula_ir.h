@@ -0,0 +1,91 @@
+#pragma once
+
+#include "formula_batch.h"
+#include "func.h"
+
+#include <array>
+#include <iosfwd>
+#include <span>
+#include <string>
+#include <vector>
+
+// Register-based SSA form of a formula.
+//
+// Every value the formula would push on the stack becomes a node computed from earlier nodes, so stack manipulation
+// operators (Dup, Over, Swap, Drop, Rot, RevRot) disappear at build time. Identical nodes are merged, which evaluates
+// repeated subexpressions once per data point, and only the nodes that reach the top of the final stack are kept.
+//
+// Operators that read the data point take the corresponding DataPointFeatures value as an extra argument node, so
+// MulWidth becomes mul_width(x, width) and features are shared like any other node.
+//
+// Formulas whose Rot or RevRot counts are not constants cannot be represented; Build rejects them along with formulas
+// that fail on every data point.
+class FormulaIR {
+public:
+    static constexpr size_t kMaxArgs = 3;
+
+    struct Node {
+        enum class Kind : u8 { Constant, Feature, Operator };
+
+        Kind kind;
+        u8 numArgs = 0;
+        Operator op{};                    // Operator that computes the node; for features, the operator that pushes it
+        i32 value = 0;                    // Constant value or DataPointFeatures::Feature index
+        std::array<u32, kMaxArgs> args{}; // Indices of earlier nodes, in stack order (deepest first)
+
+        bool operator==(const Node &) const = default;
+    };
+
+    // Translates the formula, starting from an empty stack.
+    // Returns false if the formula cannot be represented or fails regardless of data, leaving the IR empty.
+    bool Build(std::span<const Operation> ops);
+
+    // Translates the enabled genes of a chromosome
+    template <typename GeneRange>
+    bool BuildGenes(const GeneRange &genes) {
+        std::vector<Operation> ops;
+        for (auto &gene : genes) {
+            if (gene.enabled) {
+                ops.push_back(gene.op);
+            }
+        }
+        return Build(ops);
+    }
+
+    void Clear();
+
+    bool IsValid() const {
+        return !m_nodes.empty();
+    }
+
+    // Nodes in evaluation order; the last node is the result
+    const std::vector<Node> &Nodes() const {
+        return m_nodes;
+    }
+
+    // Final stack depth of the formula
+    size_t StackSize() const {
+        return m_stackSize;
+    }
+
+    // Number of operator nodes, i.e. the amount of work per data point
+    size_t NumOperations() const;
+
+    // Evaluates the formula on a single data point. The IR must be valid.
+    i32 Evaluate(const DataPointFeatures &features);
+
+    // Evaluates the formula over every data point in the batch, writing the result of each into results.
+    // Returns false if the IR is not valid. stackSize receives the final stack depth.
+    bool Evaluate(const FormulaBatch &batch, std::span<i32> results, size_t &stackSize);
+
+    void Print(std::ostream &os) const;
+    std::string Str() const;
+
+private:
+    std::vector<Node> m_nodes;
+    size_t m_stackSize = 0;
+
+    std::vector<const i32 *> m_values; // Per-node value columns used during evaluation
+
+    void EvaluateBlock(const i32 *const *features, size_t count, i32 *results);
+};
@@ -0,0 +1,792 @@
+#include "formula_jit.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(_M_X64) || defined(__x86_64__)
+    #define FORMULA_JIT_X64 1
+#else
+    #define FORMULA_JIT_X64 0
+#endif
+
+#if FORMULA_JIT_X64 && defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <Windows.h>
+#elif FORMULA_JIT_X64
+    #include <atomic>
+    #include <cstdio>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+
+// --- Executable memory ---------------------------------------------------------------------------------------------
+
+#if FORMULA_JIT_X64 && defined(_WIN32)
+
+// The arena starts with the RUNTIME_FUNCTION of the last generated function, which is handed to the unwinder for any
+// address in the arena
+constexpr size_t kCodeStart = 64;
+
+PRUNTIME_FUNCTION CALLBACK lookupRuntimeFunction(DWORD64, PVOID context) {
+    return static_cast<PRUNTIME_FUNCTION>(context);
+}
+
+// Identifies the function table of an arena; the low two bits mark tables backed by a callback
+DWORD64 functionTableId(const void *exec) {
+    return (DWORD64)exec | 3;
+}
+
+// Maps the same shared memory twice, writable at write and executable at exec, so that code can be emitted without
+// ever changing page protections, and registers the arena with the unwinder
+bool mapCodeViews(size_t size, u8 *&write, const u8 *&exec) {
+    HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_EXECUTE_READWRITE, (DWORD)((u64)size >> 32),
+                                        (DWORD)size, nullptr);
+    if (mapping == nullptr) {
+        return false;
+    }
+    void *writeView = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    void *execView = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_EXECUTE, 0, 0, size);
+    CloseHandle(mapping);
+    if (writeView == nullptr || execView == nullptr ||
+        !RtlInstallFunctionTableCallback(functionTableId(execView), (DWORD64)execView, (DWORD)size,
+                                         &lookupRuntimeFunction, execView, nullptr)) {
+        if (writeView != nullptr) {
+            UnmapViewOfFile(writeView);
+        }
+        if (execView != nullptr) {
+            UnmapViewOfFile(execView);
+        }
+        return false;
+    }
+    write = static_cast<u8 *>(writeView);
+    exec = static_cast<const u8 *>(execView);
+    return true;
+}
+
+void unmapCodeViews(u8 *write, const u8 *exec, size_t) {
+    RtlDeleteFunctionTable(reinterpret_cast<PRUNTIME_FUNCTION>(functionTableId(exec)));
+    UnmapViewOfFile(write);
+    UnmapViewOfFile(exec);
+}
+
+#elif FORMULA_JIT_X64
+
+constexpr size_t kCodeStart = 0;
+
+// Maps the same shared memory twice, writable at write and executable at exec, so that code can be emitted without
+// ever changing page protections
+bool mapCodeViews(size_t size, u8 *&write, const u8 *&exec) {
+    #if defined(__linux__)
+    const int fd = memfd_create("formula-jit", MFD_CLOEXEC);
+    #else
+    static std::atomic<u32> nextId = 0;
+    char name[32];
+    snprintf(name, sizeof(name), "/fjit-%d-%u", (int)getpid(), nextId++);
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+    #endif
+    if (fd < 0) {
+        return false;
+    }
+
+    void *writeView = MAP_FAILED;
+    void *execView = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        writeView = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        execView = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (writeView == MAP_FAILED || execView == MAP_FAILED) {
+        if (writeView != MAP_FAILED) {
+            munmap(writeView, size);
+        }
+        if (execView != MAP_FAILED) {
+            munmap(execView, size);
+        }
+        return false;
+    }
+    write = static_cast<u8 *>(writeView);
+    exec = static_cast<const u8 *>(execView);
+    return true;
+}
+
+void unmapCodeViews(u8 *write, const u8 *exec, size_t size) {
+    munmap(write, size);
+    munmap(const_cast<u8 *>(exec), size);
+}
+
+#endif
+
+// --- x86-64 emitter ------------------------------------------------------------------------------------------------
+
+enum Reg : u8 { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Condition codes for Jcc and CMOVcc
+enum Cond : u8 { CondB = 0x2, CondE = 0x4, CondNE = 0x5 };
+
+// Extensions of the ModRM reg field for group opcodes
+enum Ext : u8 {
+    ExtAdd = 0,
+    ExtOr = 1,
+    ExtAnd = 4,
+    ExtSub = 5,
+    ExtXor = 6,
+    ExtCmp = 7,
+
+    ExtNot = 2,
+    ExtNeg = 3,
+    ExtDiv = 6,
+    ExtIdiv = 7,
+
+    ExtShl = 4,
+    ExtShr = 5,
+    ExtSar = 7,
+};
+
+// Opcodes of "op r32, r/m32" ALU instructions
+enum AluOp : u8 { OpAdd = 0x03, OpOr = 0x0B, OpAnd = 0x23, OpSub = 0x2B, OpXor = 0x33, OpCmp = 0x3B };
+
+// A register or a memory operand [reg + disp]
+struct Loc {
+    bool memory;
+    Reg reg;
+    i32 disp;
+};
+
+constexpr Loc R(Reg reg) {
+    return {false, reg, 0};
+}
+
+constexpr Loc M(Reg base, i32 disp) {
+    return {true, base, disp};
+}
+
+class Emitter {
+public:
+    Emitter(std::vector<u8> &code)
+        : m_code(code) {}
+
+    size_t Pos() const {
+        return m_code.size();
+    }
+
+    void Byte(u8 value) {
+        m_code.push_back(value);
+    }
+
+    void Dword(u32 value) {
+        for (int i = 0; i < 4; i++) {
+            Byte((u8)(value >> (i * 8)));
+        }
+    }
+
+    void PatchRel32(size_t pos, size_t target) {
+        const u32 rel = (u32)(target - (pos + 4));
+        for (int i = 0; i < 4; i++) {
+            m_code[pos + i] = (u8)(rel >> (i * 8));
+        }
+    }
+
+    // Encodes <opcode> with a ModRM byte selecting the register field and the r/m operand
+    void RM(bool w, std::initializer_list<u8> opcode, u8 reg, Loc rm) {
+        Rex(w, reg, 0, rm.reg);
+        for (u8 op : opcode) {
+            Byte(op);
+        }
+        if (!rm.memory) {
+            Byte(0xC0 | ((reg & 7) << 3) | (rm.reg & 7));
+            return;
+        }
+        Byte(0x80 | ((reg & 7) << 3) | (rm.reg & 7)); // [base + disp32]
+        if ((rm.reg & 7) == RSP) {
+            Byte(0x24); // SIB with no index, required for RSP and R12 bases
+        }
+        Dword(rm.disp);
+    }
+
+    // Encodes <opcode> with a ModRM byte selecting the register field and [base + index*4]
+    void RMIndexed(bool w, std::initializer_list<u8> opcode, u8 reg, Reg base, Reg index) {
+        Rex(w, reg, index, base);
+        for (u8 op : opcode) {
+            Byte(op);
+        }
+        const bool needsDisp = (base & 7) == RBP; // RBP and R13 bases have no displacement-free encoding
+        Byte((needsDisp ? 0x40 : 0x00) | ((reg & 7) << 3) | 0x04);
+        Byte(0x80 | ((index & 7) << 3) | (base & 7));
+        if (needsDisp) {
+            Byte(0);
+        }
+    }
+
+    void Mov(Reg dst, Loc src) {
+        RM(false, {0x8B}, dst, src);
+    }
+    void Mov(Loc dst, Reg src) {
+        RM(false, {0x89}, src, dst);
+    }
+    void MovImm(Loc dst, u32 imm) {
+        RM(false, {0xC7}, 0, dst);
+        Dword(imm);
+    }
+    void Mov64(Reg dst, Loc src) {
+        RM(true, {0x8B}, dst, src);
+    }
+    void Alu(AluOp op, Reg dst, Loc src) {
+        RM(false, {op}, dst, src);
+    }
+    void AluImm(Ext ext, Loc dst, u32 imm) {
+        RM(false, {0x81}, ext, dst);
+        Dword(imm);
+    }
+    void Imul(Reg dst, Loc src) {
+        RM(false, {0x0F, 0xAF}, dst, src);
+    }
+    void Group3(Ext ext, Loc dst) {
+        RM(false, {0xF7}, ext, dst);
+    }
+    void ShiftCl(Ext ext, Loc dst) {
+        RM(false, {0xD3}, ext, dst);
+    }
+    void ShiftImm(Ext ext, Loc dst, u8 imm) {
+        RM(false, {0xC1}, ext, dst);
+        Byte(imm);
+    }
+    void Cmov(Cond cond, Reg dst, Loc src) {
+        RM(false, {0x0F, (u8)(0x40 | cond)}, dst, src);
+    }
+    void Cdq() {
+        Byte(0x99);
+    }
+    size_t Jcc(Cond cond) {
+        Byte(0x0F);
+        Byte(0x80 | cond);
+        Dword(0);
+        return Pos() - 4;
+    }
+    size_t Jmp() {
+        Byte(0xE9);
+        Dword(0);
+        return Pos() - 4;
+    }
+    void Push(Reg reg) {
+        Rex(false, 0, 0, reg);
+        Byte(0x50 | (reg & 7));
+    }
+    void Pop(Reg reg) {
+        Rex(false, 0, 0, reg);
+        Byte(0x58 | (reg & 7));
+    }
+    void Ret() {
+        Byte(0xC3);
+    }
+
+private:
+    std::vector<u8> &m_code;
+
+    void Rex(bool w, u8 reg, u8 index, u8 base) {
+        const u8 rex = (u8)(0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+        if (rex != 0x40) {
+            Byte(rex);
+        }
+    }
+};
+
+// --- Translation ---------------------------------------------------------------------------------------------------
+
+// Stack slots mapped to registers; deeper slots are spilled to the native stack frame
+constexpr Reg kSlotRegs[] = {RSI, RDI, R8, R9, R10, R11, R12, RBP};
+constexpr size_t kNumSlotRegs = std::size(kSlotRegs);
+
+// Registers preserved by the generated function; covers the callee-saved registers of both the Windows and System V
+// calling conventions
+constexpr Reg kSavedRegs[] = {RBX, RBP, RSI, RDI, R12, R13, R14, R15};
+
+// Fixed registers of the generated function
+constexpr Reg kIndexReg = RBX;   // Data point index
+constexpr Reg kCountReg = R14;   // Number of data points
+constexpr Reg kColumnsReg = R15; // Pointer to the array of column pointers
+constexpr Reg kResultsReg = R13; // Pointer to the results array
+
+constexpr Loc slotLoc(size_t slot) {
+    if (slot < kNumSlotRegs) {
+        return R(kSlotRegs[slot]);
+    }
+    return M(RSP, (i32)((slot - kNumSlotRegs) * sizeof(i32)));
+}
+
+class Translator {
+public:
+    Translator(std::vector<u8> &code)
+        : m_emit(code) {}
+
+    void Translate(std::span<const Operation> ops, size_t maxDepth) {
+        const u32 spillSize = (u32)(((maxDepth > kNumSlotRegs ? maxDepth - kNumSlotRegs : 0) * sizeof(i32) + 15) & ~15);
+
+        // Prologue
+        m_prologue.clear();
+        for (Reg reg : kSavedRegs) {
+            m_emit.Push(reg);
+            m_prologue.push_back({(u8)m_emit.Pos(), reg});
+        }
+        if (spillSize > 0) {
+            m_emit.RM(true, {0x81}, ExtSub, R(RSP));
+            m_emit.Dword(spillSize);
+            m_prologue.push_back({(u8)m_emit.Pos(), RSP});
+        }
+        m_spillSize = spillSize;
+#if defined(_WIN32)
+        m_emit.Mov64(kColumnsReg, R(RCX));
+        m_emit.Mov64(kCountReg, R(RDX));
+        m_emit.Mov64(kResultsReg, R(R8));
+#else
+        m_emit.Mov64(kColumnsReg, R(RDI));
+        m_emit.Mov64(kCountReg, R(RSI));
+        m_emit.Mov64(kResultsReg, R(RDX));
+#endif
+        m_emit.Alu(OpXor, kIndexReg, R(kIndexReg));
+        m_emit.RM(true, {0x85}, kCountReg, R(kCountReg)); // test count, count
+        const size_t skipLoop = m_emit.Jcc(CondE);
+
+        // Loop over every data point
+        const size_t loopStart = m_emit.Pos();
+        m_depth = 0;
+        for (size_t i = 0; i < ops.size(); i++) {
+            const Operation &op = ops[i];
+            if (op.type == Operation::Type::Constant) {
+                m_emit.MovImm(slotLoc(m_depth++), op.constVal);
+            } else if (op.op == Operator::Rot || op.op == Operator::RevRot) {
+                EmitRotate(op.op == Operator::Rot, ops[i - 1].constVal);
+            } else {
+                EmitOperator(op.op);
+            }
+        }
+        m_emit.Mov(RAX, slotLoc(m_depth - 1));
+        m_emit.RMIndexed(false, {0x89}, RAX, kResultsReg, kIndexReg); // mov [results + index*4], eax
+        m_emit.RM(true, {0xFF}, 0, R(kIndexReg));                   // inc index
+        m_emit.RM(true, {0x3B}, kIndexReg, R(kCountReg));           // cmp index, count
+        m_emit.PatchRel32(m_emit.Jcc(CondB), loopStart);
+
+        // Epilogue
+        m_emit.PatchRel32(skipLoop, m_emit.Pos());
+        if (spillSize > 0) {
+            m_emit.RM(true, {0x81}, ExtAdd, R(RSP));
+            m_emit.Dword(spillSize);
+        }
+        for (size_t i = std::size(kSavedRegs); i > 0; i--) {
+            m_emit.Pop(kSavedRegs[i - 1]);
+        }
+        m_emit.Ret();
+    }
+
+#if defined(_WIN32)
+    // Appends the UNWIND_INFO that lets Windows unwind through the function and returns its offset. The unwind codes
+    // undo the prologue steps in reverse order.
+    size_t AppendUnwindInfo() {
+        enum : u8 { UwopPushNonvol = 0, UwopAllocLarge = 1, UwopAllocSmall = 2 };
+
+        std::vector<u8> codes; // Pairs of bytes, one per UNWIND_CODE slot
+        for (size_t i = m_prologue.size(); i > 0; i--) {
+            const PrologueStep &step = m_prologue[i - 1];
+            if (step.reg != RSP) {
+                codes.insert(codes.end(), {step.end, (u8)(UwopPushNonvol | (step.reg << 4))});
+            } else if (m_spillSize <= 128) {
+                codes.insert(codes.end(), {step.end, (u8)(UwopAllocSmall | (((m_spillSize - 8) / 8) << 4))});
+            } else {
+                const u32 scaledSize = m_spillSize / 8;
+                codes.insert(codes.end(), {step.end, UwopAllocLarge, (u8)scaledSize, (u8)(scaledSize >> 8)});
+            }
+        }
+
+        while (m_emit.Pos() % 4 != 0) {
+            m_emit.Byte(0xCC); // int3
+        }
+        const size_t offset = m_emit.Pos();
+        m_emit.Byte(1); // Version 1, no flags
+        m_emit.Byte(m_prologue.empty() ? 0 : m_prologue.back().end);
+        m_emit.Byte((u8)(codes.size() / 2));
+        m_emit.Byte(0); // No frame register
+        for (u8 byte : codes) {
+            m_emit.Byte(byte);
+        }
+        if (codes.size() % 4 != 0) {
+            // The slot array always has an even length
+            m_emit.Byte(0);
+            m_emit.Byte(0);
+        }
+        return offset;
+    }
+#endif
+
+private:
+    // A prologue instruction, for the unwind information
+    struct PrologueStep {
+        u8 end;  // Offset just past the instruction
+        Reg reg; // Register pushed, or RSP for the spill area allocation
+    };
+
+    Emitter m_emit;
+    size_t m_depth = 0;
+    std::vector<PrologueStep> m_prologue;
+    u32 m_spillSize = 0;
+
+    Loc Slot(size_t offsetFromTop) const {
+        return slotLoc(m_depth - 1 - offsetFromTop);
+    }
+
+    void LoadColumn(Reg dst, FormulaBatch::Column column) {
+        m_emit.Mov64(dst, M(kColumnsReg, (i32)(column * sizeof(void *))));
+        m_emit.RMIndexed(false, {0x8B}, dst, dst, kIndexReg); // mov dst32, [dst + index*4]
+    }
+
+    void Move(Loc dst, Loc src) {
+        if (dst.memory && src.memory) {
+            m_emit.Mov(RCX, src);
+            m_emit.Mov(dst, RCX);
+        } else if (dst.memory) {
+            m_emit.Mov(dst, src.reg);
+        } else {
+            m_emit.Mov(dst.reg, src);
+        }
+    }
+
+    // Pushes the value in EAX
+    void PushEax() {
+        m_emit.Mov(slotLoc(m_depth++), RAX);
+    }
+
+    void PushColumn(FormulaBatch::Column column) {
+        LoadColumn(RAX, column);
+        PushEax();
+    }
+
+    // Replaces the top two items with (x <op> y)
+    void BinaryAlu(AluOp op) {
+        const Loc x = Slot(1);
+        const Loc y = Slot(0);
+        if (x.memory) {
+            m_emit.Mov(RAX, x);
+            m_emit.Alu(op, RAX, y);
+            m_emit.Mov(x, RAX);
+        } else {
+            m_emit.Alu(op, x.reg, y);
+        }
+        m_depth--;
+    }
+
+    void BinaryShift(Ext ext) {
+        m_emit.Mov(RCX, Slot(0));
+        m_emit.ShiftCl(ext, Slot(1));
+        m_depth--;
+    }
+
+    // Multiplies the top of the stack by the value in ECX
+    void MulTopByEcx() {
+        const Loc x = Slot(0);
+        if (x.memory) {
+            m_emit.Mov(RAX, x);
+            m_emit.Imul(RAX, R(RCX));
+            m_emit.Mov(x, RAX);
+        } else {
+            m_emit.Imul(x.reg, R(RCX));
+        }
+    }
+
+    // EAX = EAX / ECX or EAX % ECX with the guards of Operation::Execute
+    void GuardedDivide(bool modulo) {
+        m_emit.RM(false, {0x85}, RCX, R(RCX)); // test ecx, ecx
+        const size_t divByZero = m_emit.Jcc(CondE);
+        m_emit.AluImm(ExtCmp, R(RCX), 0xFFFFFFFF);
+        const size_t safe = m_emit.Jcc(CondNE);
+        m_emit.AluImm(ExtCmp, R(RAX), 0x80000000);
+        const size_t overflow = m_emit.Jcc(CondE);
+        m_emit.PatchRel32(safe, m_emit.Pos());
+        m_emit.Cdq();
+        m_emit.Group3(ExtIdiv, R(RCX));
+        if (modulo) {
+            m_emit.Mov(RAX, R(RDX));
+        }
+        const size_t done = m_emit.Jmp();
+        m_emit.PatchRel32(divByZero, m_emit.Pos());
+        m_emit.PatchRel32(overflow, m_emit.Pos());
+        m_emit.MovImm(R(RAX), modulo ? 0 : INT32_MAX);
+        m_emit.PatchRel32(done, m_emit.Pos());
+    }
+
+    // EAX = (u32)EAX * 1024 / (u32)width, as computed with Slope::kAAFracRange
+    void MulAAFracRangeDivWidth() {
+        m_emit.ShiftImm(ExtShl, R(RAX), Slope::kAAFracBits * 2);
+        LoadColumn(RCX, DataPointFeatures::kWidth);
+        m_emit.Alu(OpXor, RDX, R(RDX));
+        m_emit.Group3(ExtDiv, R(RCX));
+    }
+
+    // Replaces the top two items with (x ? y ^ mask : y)
+    void InvertIf(u32 mask) {
+        m_emit.Mov(RAX, Slot(0));
+        m_emit.Mov(RCX, R(RAX));
+        m_emit.AluImm(ExtXor, R(RCX), mask);
+        m_emit.AluImm(ExtCmp, Slot(1), 0);
+        m_emit.Cmov(CondNE, RAX, R(RCX));
+        m_emit.Mov(Slot(1), RAX);
+        m_depth--;
+    }
+
+    void EmitRotate(bool rot, i32 count) {
+        m_depth--; // drop the count
+        const size_t top = m_depth - 1;
+        const size_t bottom = m_depth - count;
+        if (rot) {
+            // Moves the top item down to the Nth position
+            m_emit.Mov(RAX, slotLoc(top));
+            for (size_t slot = top; slot > bottom; slot--) {
+                Move(slotLoc(slot), slotLoc(slot - 1));
+            }
+            m_emit.Mov(slotLoc(bottom), RAX);
+        } else {
+            // Moves the Nth item up to the top
+            m_emit.Mov(RAX, slotLoc(bottom));
+            for (size_t slot = bottom; slot < top; slot++) {
+                Move(slotLoc(slot), slotLoc(slot + 1));
+            }
+            m_emit.Mov(slotLoc(top), RAX);
+        }
+    }
+
+    void EmitOperator(Operator op) {
+        using C = FormulaBatch::Column;
+
+        switch (op) {
+        case Operator::PushX: PushColumn(C::kX); break;
+        case Operator::PushY: PushColumn(C::kY); break;
+        case Operator::PushWidth: PushColumn(C::kWidth); break;
+        case Operator::PushHeight: PushColumn(C::kHeight); break;
+        case Operator::PushPositive: PushColumn(C::kPositive); break;
+        case Operator::PushNegative: PushColumn(C::kNegative); break;
+        case Operator::PushXMajor: PushColumn(C::kXMajor); break;
+        case Operator::PushYMajor: PushColumn(C::kYMajor); break;
+        case Operator::PushLeft: PushColumn(C::kLeft); break;
+        case Operator::PushRight: PushColumn(C::kRight); break;
+
+        case Operator::Add: BinaryAlu(OpAdd); break;
+        case Operator::Subtract: BinaryAlu(OpSub); break;
+        case Operator::Multiply:
+            m_emit.Mov(RCX, Slot(0));
+            m_depth--;
+            MulTopByEcx();
+            break;
+        case Operator::Divide:
+        case Operator::Modulo:
+            m_emit.Mov(RAX, Slot(1));
+            m_emit.Mov(RCX, Slot(0));
+            GuardedDivide(op == Operator::Modulo);
+            m_emit.Mov(Slot(1), RAX);
+            m_depth--;
+            break;
+        case Operator::Negate: m_emit.Group3(ExtNeg, Slot(0)); break;
+        case Operator::LeftShift: BinaryShift(ExtShl); break;
+        case Operator::ArithmeticRightShift: BinaryShift(ExtSar); break;
+        case Operator::LogicRightShift: BinaryShift(ExtShr); break;
+        case Operator::And: BinaryAlu(OpAnd); break;
+        case Operator::Or: BinaryAlu(OpOr); break;
+        case Operator::Xor: BinaryAlu(OpXor); break;
+        case Operator::Not: m_emit.Group3(ExtNot, Slot(0)); break;
+
+        case Operator::Dup:
+            Move(slotLoc(m_depth), Slot(0));
+            m_depth++;
+            break;
+        case Operator::Over:
+            Move(slotLoc(m_depth), Slot(1));
+            m_depth++;
+            break;
+        case Operator::Swap:
+            m_emit.Mov(RAX, Slot(0));
+            Move(Slot(0), Slot(1));
+            m_emit.Mov(Slot(1), RAX);
+            break;
+        case Operator::Drop: m_depth--; break;
+        case Operator::IfElse:
+            // selector ? first : second
+            m_emit.Mov(RAX, Slot(2));
+            m_emit.AluImm(ExtCmp, Slot(0), 0);
+            m_emit.Cmov(CondNE, RAX, Slot(1));
+            m_emit.Mov(Slot(2), RAX);
+            m_depth -= 2;
+            break;
+
+        case Operator::FracXStart: PushColumn(C::kFracXStart); break;
+        case Operator::FracXEnd: PushColumn(C::kFracXEnd); break;
+        case Operator::FracXWidth: PushColumn(C::kFracXWidth); break;
+        case Operator::XStart: PushColumn(C::kXStart); break;
+        case Operator::XEnd: PushColumn(C::kXEnd); break;
+        case Operator::XWidth: PushColumn(C::kXWidth); break;
+        case Operator::X0: PushColumn(C::kX0); break;
+
+        case Operator::InsertAAFracBits: m_emit.ShiftImm(ExtShl, Slot(0), Slope::kAAFracBits * 2); break;
+        case Operator::InvertAA: InvertIf(Slope::kAARange - 1); break;
+        case Operator::InvertAAFrac: InvertIf(Slope::kAAFracRange - 1); break;
+        case Operator::MulWidth:
+            LoadColumn(RCX, C::kWidth);
+            MulTopByEcx();
+            break;
+        case Operator::MulHeight:
+            LoadColumn(RCX, C::kHeight);
+            MulTopByEcx();
+            break;
+        case Operator::DivWidth:
+        case Operator::DivHeight:
+            m_emit.Mov(RAX, Slot(0));
+            LoadColumn(RCX, op == Operator::DivWidth ? C::kWidth : C::kHeight);
+            m_emit.Cdq();
+            m_emit.Group3(ExtIdiv, R(RCX));
+            m_emit.Mov(Slot(0), RAX);
+            break;
+        case Operator::Add1: m_emit.AluImm(ExtAdd, Slot(0), 1); break;
+        case Operator::Sub1: m_emit.AluImm(ExtSub, Slot(0), 1); break;
+        case Operator::Mul2: m_emit.ShiftImm(ExtShl, Slot(0), 1); break;
+        case Operator::Div2: m_emit.ShiftImm(ExtSar, Slot(0), 1); break;
+        case Operator::MulHeightDivWidthAA:
+            m_emit.Mov(RAX, Slot(0));
+            LoadColumn(RCX, C::kHeight);
+            m_emit.Imul(RAX, R(RCX));
+            MulAAFracRangeDivWidth();
+            m_emit.Mov(Slot(0), RAX);
+            break;
+        case Operator::AAStep: PushColumn(C::kAAStep); break;
+        case Operator::And1: m_emit.AluImm(ExtAnd, Slot(0), 1); break;
+
+        default: break;
+        }
+    }
+};
+
+} // namespace
+
+// -------------------------------------------------------------------------------------------------------------------
+
+FormulaJIT::FormulaJIT() = default;
+
+FormulaJIT::~FormulaJIT() {
+    FreeExecMem();
+}
+
+bool FormulaJIT::IsSupported() {
+    return FORMULA_JIT_X64;
+}
+
+void FormulaJIT::Compile(std::span<const Operation> ops) {
+    m_formula.Compile(ops);
+    Translate();
+}
+
+void FormulaJIT::Translate() {
+    const auto ops = std::span<const Operation>(m_formula.Source());
+    const StackProfile &profile = m_formula.Profile();
+    m_staticallyValid = profile.CanSucceed(0);
+    m_staticDepth = profile.Verify(0);
+    m_finalDepth = profile.FinalDepth(0);
+    m_native = nullptr;
+
+    const bool translatable = m_staticDepth && profile.maxGrowth <= m_stack.stack.size();
+    if (!FORMULA_JIT_X64 || m_mode == Mode::Interpret || !translatable) {
+        return;
+    }
+
+    m_codeBuffer.clear();
+    Translator translator{m_codeBuffer};
+    translator.Translate(ops, profile.maxGrowth);
+#if defined(_WIN32)
+    const size_t codeSize = m_codeBuffer.size();
+    const size_t unwindOffset = translator.AppendUnwindInfo();
+#endif
+
+#if FORMULA_JIT_X64
+    // Append the code to the arena, wrapping around once it fills up; only the last function is ever called
+    const size_t size = m_codeBuffer.size();
+    if (kCodeStart + size > m_codeCapacity) {
+        FreeExecMem();
+        const size_t capacity = std::max<size_t>((kCodeStart + size + 0xFFFF) & ~0xFFFF, kCodeArenaSize);
+        if (!mapCodeViews(capacity, m_codeWrite, m_codeExec)) {
+            return;
+        }
+        m_codeCapacity = capacity;
+    }
+    if (m_codeOffset < kCodeStart || m_codeOffset + size > m_codeCapacity) {
+        m_codeOffset = kCodeStart;
+    }
+    memcpy(m_codeWrite + m_codeOffset, m_codeBuffer.data(), size);
+    #if defined(_WIN32)
+    auto &function = *reinterpret_cast<RUNTIME_FUNCTION *>(m_codeWrite);
+    function.BeginAddress = (DWORD)m_codeOffset;
+    function.EndAddress = (DWORD)(m_codeOffset + codeSize);
+    function.UnwindData = (DWORD)(m_codeOffset + unwindOffset);
+    #endif
+    m_native = reinterpret_cast<NativeFunc>(m_codeExec + m_codeOffset);
+    m_codeOffset = (m_codeOffset + size + 63) & ~63;
+#endif
+}
+
+bool FormulaJIT::Evaluate(const FormulaBatch &batch, std::span<i32> results, size_t &stackSize) {
+    if (!m_staticallyValid) {
+        stackSize = 0;
+        return false;
+    }
+    if (m_native == nullptr || m_mode == Mode::Interpret) {
+        return Interpret(batch, results, stackSize);
+    }
+
+    const auto columns = batch.ColumnPointers();
+    m_native(columns.data(), batch.Size(), results.data());
+    stackSize = m_finalDepth;
+
+    if (m_mode == Mode::SelfCheck) {
+        for (size_t i = 0; i < batch.Size(); i++) {
+            m_stack.clear();
+            const bool valid = m_formula.Execute(batch.rows[i], m_stack);
+            if (!valid || m_stack.size() != m_finalDepth || m_stack.back() != results[i]) {
+                if (m_selfCheckFailures++ == 0) {
+                    std::cerr << "FormulaJIT self-check failed on data point " << i << ":";
+                    for (auto &op : m_formula.Source()) {
+                        std::cerr << " " << op.Str();
+                    }
+                    std::cerr << "\n";
+                }
+                return Interpret(batch, results, stackSize);
+            }
+        }
+    }
+    return true;
+}
+
+bool FormulaJIT::Interpret(const FormulaBatch &batch, std::span<i32> results, size_t &stackSize) {
+    for (size_t i = 0; i < batch.Size(); i++) {
+        m_stack.clear();
+        if (!m_formula.Execute(batch.rows[i], m_stack) || m_stack.empty()) {
+            stackSize = 0;
+            return false;
+        }
+        results[i] = m_stack.back();
+    }
+    stackSize = m_stack.size();
+    return true;
+}
+
+void FormulaJIT::FreeExecMem() {
+#if FORMULA_JIT_X64
+    if (m_codeWrite != nullptr) {
+        unmapCodeViews(m_codeWrite, m_codeExec, m_codeCapacity);
+    }
+#endif
+    m_codeWrite = nullptr;
+    m_codeExec = nullptr;
+    m_codeCapacity = 0;
+    m_codeOffset = 0;
+    m_native = nullptr;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "formula_batch.h"
+#include "func.h"
+
+#include <span>
+#include <vector>
+
+// Evaluates formulas over batches of data points, translating them into native x86-64 code when possible.
+//
+// The generated function loops over the columns of a FormulaBatch and writes the top of the stack of every data point
+// into an output array. Stack slots are mapped to registers, spilling to memory only on deep stacks. Divide and modulo
+// are guarded exactly as in Operation::Execute.
+//
+// Stack effects are resolved during translation, so formulas that underflow or end with an empty stack are rejected
+// without evaluating any data point. Formulas whose stack effects depend on data (Rot and RevRot with a computed
+// count) and builds that are not x86-64 are evaluated with CompiledFormula instead.
+class FormulaJIT {
+public:
+    enum class Mode {
+        Interpret, // Always use CompiledFormula
+        Native,    // Use native code whenever possible
+        SelfCheck, // Use native code and compare every result against CompiledFormula
+    };
+
+    FormulaJIT();
+    ~FormulaJIT();
+
+    FormulaJIT(const FormulaJIT &) = delete;
+    FormulaJIT &operator=(const FormulaJIT &) = delete;
+
+    // Determines if native code generation is supported on this platform
+    static bool IsSupported();
+
+    void SetMode(Mode mode) {
+        m_mode = mode;
+    }
+
+    Mode GetMode() const {
+        return m_mode;
+    }
+
+    void Compile(std::span<const Operation> ops);
+
+    // Compiles the enabled genes of a chromosome, skipping disabled genes entirely
+    template <typename GeneRange>
+    void CompileGenes(const GeneRange &genes) {
+        m_formula.CompileGenes(genes);
+        Translate();
+    }
+
+    // Determines if the last compiled formula runs as native code
+    bool IsNative() const {
+        return m_native != nullptr;
+    }
+
+    // Evaluates the formula over every data point in the batch, writing the top of the stack of each into results.
+    // Returns false if the formula fails on any data point, in which case the results are unspecified.
+    // stackSize receives the final stack depth of the last data point.
+    bool Evaluate(const FormulaBatch &batch, std::span<i32> results, size_t &stackSize);
+
+    // Number of data points whose native results differed from the interpreter in self-check mode
+    uint64_t SelfCheckFailures() const {
+        return m_selfCheckFailures;
+    }
+
+private:
+    using NativeFunc = void (*)(const i32 *const *columns, size_t count, i32 *results);
+
+    Mode m_mode = Mode::Native;
+
+    CompiledFormula m_formula;
+    FixedStack m_stack;
+
+    // Translation results
+    bool m_staticallyValid = false; // false if the formula fails regardless of data
+    bool m_staticDepth = false;     // true if the final stack depth is known without evaluating
+    size_t m_finalDepth = 0;
+    NativeFunc m_native = nullptr;
+
+    // Arena holding the native code, mapped twice so that it is written through m_codeWrite and run from m_codeExec
+    static constexpr size_t kCodeArenaSize = 1024 * 1024;
+    std::vector<u8> m_codeBuffer;
+    u8 *m_codeWrite = nullptr;
+    const u8 *m_codeExec = nullptr;
+    size_t m_codeCapacity = 0;
+    size_t m_codeOffset = 0;
+
+    uint64_t m_selfCheckFailures = 0;
+
+    void Translate();
+    bool Interpret(const FormulaBatch &batch, std::span<i32> results, size_t &stackSize);
+    void FreeExecMem();
+};
@@ -0,0 +1,308 @@
+#include "formula_opt.h"
+
+#include <initializer_list>
+
+namespace {
+
+// Upper bound on optimization passes; every pass shrinks or simplifies the formula, so this is rarely reached
+constexpr size_t kMaxPasses = 64;
+
+constexpr size_t kStackSize = std::tuple_size_v<decltype(FixedStack::stack)>;
+
+Operation makeConstant(i32 value) {
+    return Operation{.type = Operation::Type::Constant, .constVal = value};
+}
+
+Operation makeOperator(Operator op) {
+    return Operation{.type = Operation::Type::Operator, .op = op};
+}
+
+bool isConstant(const Operation &op) {
+    return op.type == Operation::Type::Constant;
+}
+
+bool isOperator(const Operation &op, Operator oper) {
+    return op.type == Operation::Type::Operator && op.op == oper;
+}
+
+bool isRotate(const Operation &op) {
+    return isOperator(op, Operator::Rot) || isOperator(op, Operator::RevRot);
+}
+
+// Determines if an operator reads the slope or the variables of the data point
+bool readsData(Operator op) {
+    switch (op) {
+    case Operator::PushX:
+    case Operator::PushY:
+    case Operator::PushWidth:
+    case Operator::PushHeight:
+    case Operator::PushPositive:
+    case Operator::PushNegative:
+    case Operator::PushXMajor:
+    case Operator::PushYMajor:
+    case Operator::PushLeft:
+    case Operator::PushRight:
+    case Operator::FracXStart:
+    case Operator::FracXEnd:
+    case Operator::FracXWidth:
+    case Operator::XStart:
+    case Operator::XEnd:
+    case Operator::XWidth:
+    case Operator::X0:
+    case Operator::MulWidth:
+    case Operator::MulHeight:
+    case Operator::DivWidth:
+    case Operator::DivHeight:
+    case Operator::MulHeightDivWidthAA:
+    case Operator::AAStep: return true;
+    default: return false;
+    }
+}
+
+// Pushes a value without consuming anything
+bool isPush(const Operation &op) {
+    if (isConstant(op)) {
+        return true;
+    }
+    return StackProfile::RequiredDepth(op.op) == 0 && StackProfile::DepthChange(op.op) == +1;
+}
+
+// Replaces the top of the stack with a function of it
+bool isUnary(const Operation &op) {
+    return !isConstant(op) && !isRotate(op) && StackProfile::RequiredDepth(op.op) == 1 &&
+           StackProfile::DepthChange(op.op) == 0;
+}
+
+// Replaces the top two items with a function of them
+bool isBinary(const Operation &op) {
+    return !isConstant(op) && StackProfile::RequiredDepth(op.op) == 2 && StackProfile::DepthChange(op.op) == -1;
+}
+
+bool isCommutative(const Operation &op) {
+    if (isConstant(op)) {
+        return false;
+    }
+    switch (op.op) {
+    case Operator::Add:
+    case Operator::Multiply:
+    case Operator::And:
+    case Operator::Or:
+    case Operator::Xor: return true;
+    default: return false;
+    }
+}
+
+void replace(std::vector<Operation> &ops, size_t first, size_t count, std::initializer_list<Operation> with) {
+    ops.erase(ops.begin() + first, ops.begin() + first + count);
+    ops.insert(ops.begin() + first, with);
+}
+
+// Number of operations before the first Rot or RevRot whose count is not pushed as a constant right before it.
+// Stack depths are only known statically up to that point.
+size_t staticPrefixLength(const std::vector<Operation> &ops) {
+    for (size_t i = 0; i < ops.size(); i++) {
+        if (isRotate(ops[i]) && (i == 0 || !isConstant(ops[i - 1]))) {
+            return i;
+        }
+    }
+    return ops.size();
+}
+
+// Folds the operation at index i if all of its inputs are constants pushed right before it.
+// The fold runs the operation itself so that the result matches evaluation bit for bit.
+bool foldConstants(std::vector<Operation> &ops, size_t i) {
+    const Operation &op = ops[i];
+    if (isConstant(op) || readsData(op.op)) {
+        return false;
+    }
+
+    size_t inputs;
+    if (isRotate(op)) {
+        if (i == 0 || !isConstant(ops[i - 1]) || ops[i - 1].constVal < 1) {
+            return false;
+        }
+        inputs = (size_t)ops[i - 1].constVal + 1;
+    } else {
+        inputs = StackProfile::RequiredDepth(op.op);
+    }
+    if (inputs == 0 || inputs > i) {
+        return false;
+    }
+    const size_t first = i - inputs;
+    for (size_t j = first; j < i; j++) {
+        if (!isConstant(ops[j])) {
+            return false;
+        }
+    }
+
+    Slope slope{};
+    Variables vars{};
+    FixedStack stack;
+    for (size_t j = first; j <= i; j++) {
+        if (!ops[j].Execute(slope, stack, vars)) {
+            return false;
+        }
+    }
+
+    ops.erase(ops.begin() + first, ops.begin() + i + 1);
+    for (size_t j = 0; j < stack.size(); j++) {
+        ops.insert(ops.begin() + first + j, makeConstant(stack[j]));
+    }
+    return true;
+}
+
+// Applies peephole rules to the pair of operations ending at index i
+bool simplifyPair(std::vector<Operation> &ops, size_t i) {
+    if (i == 0) {
+        return false;
+    }
+    const Operation a = ops[i - 1];
+    const Operation b = ops[i];
+
+    // Pairs that cancel out
+    static constexpr std::pair<Operator, Operator> kCancellingPairs[] = {
+        {Operator::Dup, Operator::Drop},
+        {Operator::Over, Operator::Drop},
+        {Operator::Swap, Operator::Swap},
+        {Operator::Not, Operator::Not},
+        {Operator::Negate, Operator::Negate},
+        {Operator::Add1, Operator::Sub1},
+        {Operator::Sub1, Operator::Add1},
+    };
+    for (auto [first, second] : kCancellingPairs) {
+        if (isOperator(a, first) && isOperator(b, second)) {
+            replace(ops, i - 1, 2, {});
+            return true;
+        }
+    }
+
+    // Dead values
+    if (isOperator(b, Operator::Drop)) {
+        if (isPush(a)) {
+            replace(ops, i - 1, 2, {});
+            return true;
+        }
+        if (isUnary(a)) {
+            replace(ops, i - 1, 2, {b});
+            return true;
+        }
+        if (isBinary(a)) {
+            replace(ops, i - 1, 2, {b, b});
+            return true;
+        }
+        return false;
+    }
+
+    // Operand order doesn't matter for commutative operators
+    if (isOperator(a, Operator::Swap) && isCommutative(b)) {
+        replace(ops, i - 1, 2, {b});
+        return true;
+    }
+
+    if (!isConstant(a) || isConstant(b)) {
+        return false;
+    }
+    const i32 value = a.constVal;
+
+    // Identities
+    switch (b.op) {
+    case Operator::Add:
+    case Operator::Subtract:
+    case Operator::Or:
+    case Operator::Xor:
+    case Operator::LeftShift:
+    case Operator::ArithmeticRightShift:
+    case Operator::LogicRightShift:
+        if (value == 0) {
+            replace(ops, i - 1, 2, {});
+            return true;
+        }
+        break;
+    case Operator::Multiply:
+    case Operator::Divide:
+    case Operator::Rot:
+    case Operator::RevRot:
+        if (value == 1) {
+            replace(ops, i - 1, 2, {});
+            return true;
+        }
+        break;
+    case Operator::And:
+        if (value == -1) {
+            replace(ops, i - 1, 2, {});
+            return true;
+        }
+        break;
+    default: break;
+    }
+
+    // Canonical forms
+    struct Rule {
+        i32 value;
+        Operator op;
+        Operator replacement;
+    };
+    static constexpr Rule kRules[] = {
+        {1, Operator::Add, Operator::Add1},
+        {-1, Operator::Add, Operator::Sub1},
+        {1, Operator::Subtract, Operator::Sub1},
+        {-1, Operator::Subtract, Operator::Add1},
+        {2, Operator::Multiply, Operator::Mul2},
+        {-1, Operator::Multiply, Operator::Negate},
+        {(i32)Slope::kAAFracRange, Operator::Multiply, Operator::InsertAAFracBits},
+        {1, Operator::LeftShift, Operator::Mul2},
+        {1, Operator::ArithmeticRightShift, Operator::Div2},
+        {1, Operator::And, Operator::And1},
+        {-1, Operator::Xor, Operator::Not},
+        {2, Operator::Rot, Operator::Swap},
+        {2, Operator::RevRot, Operator::Swap},
+    };
+    for (auto &rule : kRules) {
+        if (value == rule.value && b.op == rule.op) {
+            replace(ops, i - 1, 2, {makeOperator(rule.replacement)});
+            return true;
+        }
+    }
+
+    // Constant selector
+    if (b.op == Operator::IfElse) {
+        if (value != 0) {
+            replace(ops, i - 1, 2, {makeOperator(Operator::Swap), makeOperator(Operator::Drop)});
+        } else {
+            replace(ops, i - 1, 2, {makeOperator(Operator::Drop)});
+        }
+        return true;
+    }
+
+    return false;
+}
+
+} // namespace
+
+void OptimizeFormula(std::vector<Operation> &ops) {
+    for (size_t pass = 0; pass < kMaxPasses; pass++) {
+        // Only touch formulas that can succeed, within the range where stack depths are known. Since the original
+        // never underflows there, rewriting any window into one with the same stack effect is safe.
+        const StackProfile profile = StackProfile::Analyze(ops);
+        if (!profile.CanSucceed(0) || profile.maxGrowth > kStackSize) {
+            return;
+        }
+
+        bool changed = false;
+        size_t limit = staticPrefixLength(ops);
+        for (size_t i = 0; i < limit;) {
+            const size_t prevSize = ops.size();
+            if (foldConstants(ops, i) || simplifyPair(ops, i)) {
+                changed = true;
+                limit = limit + ops.size() - prevSize;
+                // Revisit the neighborhood of the rewrite, which may enable further rules
+                i = i >= 3 ? i - 3 : 0;
+            } else {
+                i++;
+            }
+        }
+        if (!changed) {
+            return;
+        }
+    }
+}
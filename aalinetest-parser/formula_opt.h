@@ -0,0 +1,19 @@
+#pragma once
+
+#include "func.h"
+
+#include <vector>
+
+// Simplifies a formula in place with constant folding, stack-level dead code elimination and peephole rules.
+//
+// The optimized formula leaves exactly the same stack contents as the original on every data point, so both the
+// result and the final stack size are preserved. Formulas that fail regardless of data are left untouched, and
+// optimization stops at the first Rot or RevRot whose count is not known statically.
+void OptimizeFormula(std::vector<Operation> &ops);
+
+// Convenience overload that returns an optimized copy
+inline std::vector<Operation> OptimizedFormula(std::span<const Operation> ops) {
+    std::vector<Operation> result{ops.begin(), ops.end()};
+    OptimizeFormula(result);
+    return result;
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <iostream>
 #include <ostream>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -205,6 +208,90 @@ struct Variables {
     }
 };
 
+// Values read by the formula operators that depend only on the data point, never on the formula.
+//
+// Computing them once per data point turns the slope math behind operators like FracXEnd or AAStep into plain loads
+// during evaluation.
+struct DataPointFeatures {
+    enum Feature : size_t {
+        kX,
+        kY,
+        kWidth,
+        kHeight,
+        kLeft,
+        kRight,
+        kPositive,
+        kNegative,
+        kXMajor,
+        kYMajor,
+        kFracXStart, // Slope::FracXStart(y)
+        kFracXEnd,   // Slope::FracXEnd(y)
+        kFracXWidth, // Slope::DX()
+        kXStart,     // Slope::XStart(y)
+        kXEnd,       // Slope::XEnd(y)
+        kXWidth,     // Slope::XEnd(y) - Slope::XStart(y) + 1
+        kX0,         // Slope::X0()
+        kAAStep,     // height * Slope::kAAFracRange / width, or 0 if width is 0
+
+        kNumFeatures
+    };
+
+    std::array<i32, kNumFeatures> values;
+
+    i32 operator[](Feature feature) const {
+        return values[feature];
+    }
+
+    // Determines which feature is pushed by an operator, if any
+    static bool PushedBy(Operator op, Feature &feature) {
+        switch (op) {
+        case Operator::PushX: feature = kX; return true;
+        case Operator::PushY: feature = kY; return true;
+        case Operator::PushWidth: feature = kWidth; return true;
+        case Operator::PushHeight: feature = kHeight; return true;
+        case Operator::PushPositive: feature = kPositive; return true;
+        case Operator::PushNegative: feature = kNegative; return true;
+        case Operator::PushXMajor: feature = kXMajor; return true;
+        case Operator::PushYMajor: feature = kYMajor; return true;
+        case Operator::PushLeft: feature = kLeft; return true;
+        case Operator::PushRight: feature = kRight; return true;
+        case Operator::FracXStart: feature = kFracXStart; return true;
+        case Operator::FracXEnd: feature = kFracXEnd; return true;
+        case Operator::FracXWidth: feature = kFracXWidth; return true;
+        case Operator::XStart: feature = kXStart; return true;
+        case Operator::XEnd: feature = kXEnd; return true;
+        case Operator::XWidth: feature = kXWidth; return true;
+        case Operator::X0: feature = kX0; return true;
+        case Operator::AAStep: feature = kAAStep; return true;
+        default: return false;
+        }
+    }
+
+    static DataPointFeatures Compute(const Slope &slope, const Variables &vars) {
+        DataPointFeatures features;
+        auto &v = features.values;
+        v[kX] = vars.x;
+        v[kY] = vars.y;
+        v[kWidth] = vars.width;
+        v[kHeight] = vars.height;
+        v[kLeft] = vars.left;
+        v[kRight] = !vars.left;
+        v[kPositive] = !slope.IsNegative();
+        v[kNegative] = slope.IsNegative();
+        v[kXMajor] = slope.IsXMajor();
+        v[kYMajor] = !slope.IsXMajor();
+        v[kFracXStart] = slope.FracXStart(vars.y);
+        v[kFracXEnd] = slope.FracXEnd(vars.y);
+        v[kFracXWidth] = slope.DX();
+        v[kXStart] = slope.XStart(vars.y);
+        v[kXEnd] = slope.XEnd(vars.y);
+        v[kXWidth] = v[kXEnd] - v[kXStart] + 1;
+        v[kX0] = slope.X0();
+        v[kAAStep] = vars.width != 0 ? (i32)(vars.height * Slope::kAAFracRange / vars.width) : 0;
+        return features;
+    }
+};
+
 struct FixedStack {
     std::array<i32, 256> stack{};
     size_t pos = 0;
@@ -221,6 +308,10 @@ struct FixedStack {
         return stack[pos - 1];
     }
 
+    bool full() const {
+        return pos == stack.size();
+    }
+
     void push_back(i32 value) {
         stack[pos++] = value;
     }
@@ -267,6 +358,13 @@ private:
 struct Operation {
     enum class Type { Operator, Constant };
 
+    bool operator==(const Operation &rhs) const {
+        if (type != rhs.type) {
+            return false;
+        }
+        return type == Type::Operator ? op == rhs.op : constVal == rhs.constVal;
+    }
+
     Type type;
     union {
         Operator op;
@@ -310,6 +408,15 @@ private:
             return true;
         };
 
+        // Fails instead of overflowing the stack
+        auto push = [&](i32 value) -> bool {
+            if (stack.full()) {
+                return false;
+            }
+            stack.push_back(value);
+            return true;
+        };
+
         auto unaryFunc = [&](auto &&func) -> bool {
             if (stack.size() < 1) {
                 return false;
@@ -322,16 +429,16 @@ private:
         };
 
         switch (op) {
-        case Operator::PushX: stack.push_back(vars.x); return true;
-        case Operator::PushY: stack.push_back(vars.y); return true;
-        case Operator::PushWidth: stack.push_back(vars.width); return true;
-        case Operator::PushHeight: stack.push_back(vars.height); return true;
-        case Operator::PushPositive: stack.push_back(!slope.IsNegative()); return true;
-        case Operator::PushNegative: stack.push_back(slope.IsNegative()); return true;
-        case Operator::PushXMajor: stack.push_back(slope.IsXMajor()); return true;
-        case Operator::PushYMajor: stack.push_back(!slope.IsXMajor()); return true;
-        case Operator::PushLeft: stack.push_back(vars.left); return true;
-        case Operator::PushRight: stack.push_back(!vars.left); return true;
+        case Operator::PushX: return push(vars.x);
+        case Operator::PushY: return push(vars.y);
+        case Operator::PushWidth: return push(vars.width);
+        case Operator::PushHeight: return push(vars.height);
+        case Operator::PushPositive: return push(!slope.IsNegative());
+        case Operator::PushNegative: return push(slope.IsNegative());
+        case Operator::PushXMajor: return push(slope.IsXMajor());
+        case Operator::PushYMajor: return push(!slope.IsXMajor());
+        case Operator::PushLeft: return push(vars.left);
+        case Operator::PushRight: return push(!vars.left);
 
         case Operator::Add: return binaryFunc([](i32 x, i32 y) { return x + y; });
         case Operator::Subtract: return binaryFunc([](i32 x, i32 y) { return x - y; });
@@ -353,15 +460,13 @@ private:
             if (stack.empty()) {
                 return false;
             } else {
-                stack.push_back(stack.back());
-                return true;
+                return push(stack.back());
             }
         case Operator::Over:
             if (stack.size() < 2) {
                 return false;
             } else {
-                stack.push_back(stack[stack.size() - 2]);
-                return true;
+                return push(stack[stack.size() - 2]);
             }
         case Operator::Swap:
             if (stack.size() < 2) {
@@ -422,14 +527,14 @@ private:
                 return true;
             }
 
-        case Operator::FracXStart: stack.push_back(slope.FracXStart(vars.y)); return true;
-        case Operator::FracXEnd: stack.push_back(slope.FracXEnd(vars.y)); return true;
-        case Operator::FracXWidth: stack.push_back(slope.DX()); return true;
+        case Operator::FracXStart: return push(slope.FracXStart(vars.y));
+        case Operator::FracXEnd: return push(slope.FracXEnd(vars.y));
+        case Operator::FracXWidth: return push(slope.DX());
 
-        case Operator::XStart: stack.push_back(slope.XStart(vars.y)); return true;
-        case Operator::XEnd: stack.push_back(slope.XEnd(vars.y)); return true;
-        case Operator::XWidth: stack.push_back(slope.XEnd(vars.y) - slope.XStart(vars.y) + 1); return true;
-        case Operator::X0: stack.push_back(slope.X0()); return true;
+        case Operator::XStart: return push(slope.XStart(vars.y));
+        case Operator::XEnd: return push(slope.XEnd(vars.y));
+        case Operator::XWidth: return push(slope.XEnd(vars.y) - slope.XStart(vars.y) + 1);
+        case Operator::X0: return push(slope.X0());
 
         case Operator::InsertAAFracBits: return unaryFunc([](i32 x) { return x * Slope::kAAFracRange; });
         case Operator::InvertAA: return binaryFunc([](i32 x, i32 y) { return x ? (y ^ (Slope::kAARange - 1)) : y; });
@@ -445,21 +550,580 @@ private:
         case Operator::Div2: return unaryFunc([&](i32 x) { return x >> 1; });
         case Operator::MulHeightDivWidthAA:
             return unaryFunc([&](i32 x) { return x * vars.height * Slope::kAAFracRange / vars.width; });
-        case Operator::AAStep: stack.push_back(vars.height * Slope::kAAFracRange / vars.width); return true;
+        case Operator::AAStep: return push(vars.width != 0 ? vars.height * Slope::kAAFracRange / vars.width : 0);
         case Operator::And1: return unaryFunc([&](i32 x) { return x & 1; });
         }
         return false;
     }
 
     bool ExecuteConstant(FixedStack &stack) const {
+        if (stack.full()) {
+            return false;
+        }
         stack.push_back(constVal);
         return true;
     }
 };
 
+// Stack depth profile of a formula, computed without evaluating it.
+//
+// Every operator has a fixed stack effect except for Rot and RevRot, whose effect depends on the count on top of the
+// stack. Counts pushed as constants right before the operator are resolved statically; any other count makes the rest
+// of the formula dynamic, and the profile only describes the operations before it.
+struct StackProfile {
+    bool valid = true;        // false if the formula fails regardless of the initial stack contents
+    bool dynamic = false;     // true if the stack effects depend on data
+    size_t minEntryDepth = 0; // minimum initial stack depth that avoids underflows
+    size_t maxGrowth = 0;     // maximum stack depth reached above the initial depth
+    i32 netChange = 0;        // stack depth difference between the start and the end of the formula
+
+    static StackProfile Analyze(std::span<const Operation> ops) {
+        StackProfile profile{};
+        for (size_t i = 0; i < ops.size(); i++) {
+            profile.Append(ops[i], i > 0 ? &ops[i - 1] : nullptr);
+        }
+        return profile;
+    }
+
+    // Extends the profile with an operation; prev is the operation before it, if any
+    void Append(const Operation &op, const Operation *prev) {
+        if (!valid || dynamic) {
+            return;
+        }
+        if (op.type == Operation::Type::Constant) {
+            Apply(0, +1);
+        } else if (op.op == Operator::Rot || op.op == Operator::RevRot) {
+            if (prev == nullptr || prev->type != Operation::Type::Constant) {
+                dynamic = true;
+            } else if (prev->constVal < 1) {
+                valid = false;
+            } else {
+                // The count sits on top of the items to rotate
+                Apply((size_t)prev->constVal + 1, -1);
+            }
+        } else {
+            Apply(RequiredDepth(op.op), DepthChange(op.op));
+        }
+    }
+
+    // Determines if the formula can run to completion and leave a result when started with the given stack depth
+    bool CanSucceed(size_t entryDepth) const {
+        if (!valid || entryDepth < minEntryDepth) {
+            return false;
+        }
+        return dynamic || (i64)entryDepth + netChange > 0;
+    }
+
+    // Determines if the formula is guaranteed to succeed when started with the given stack depth
+    bool Verify(size_t entryDepth) const {
+        return !dynamic && CanSucceed(entryDepth);
+    }
+
+    // Final stack depth when started with the given stack depth; only meaningful for verified formulas
+    size_t FinalDepth(size_t entryDepth) const {
+        return entryDepth + netChange;
+    }
+
+    // Minimum stack depth required by an operator, excluding Rot and RevRot
+    static size_t RequiredDepth(Operator op) {
+        switch (op) {
+        case Operator::Add:
+        case Operator::Subtract:
+        case Operator::Multiply:
+        case Operator::Divide:
+        case Operator::Modulo:
+        case Operator::LeftShift:
+        case Operator::ArithmeticRightShift:
+        case Operator::LogicRightShift:
+        case Operator::And:
+        case Operator::Or:
+        case Operator::Xor:
+        case Operator::Over:
+        case Operator::Swap:
+        case Operator::InvertAA:
+        case Operator::InvertAAFrac: return 2;
+
+        case Operator::Negate:
+        case Operator::Not:
+        case Operator::Dup:
+        case Operator::Drop:
+        case Operator::InsertAAFracBits:
+        case Operator::MulWidth:
+        case Operator::MulHeight:
+        case Operator::DivWidth:
+        case Operator::DivHeight:
+        case Operator::Add1:
+        case Operator::Sub1:
+        case Operator::Mul2:
+        case Operator::Div2:
+        case Operator::MulHeightDivWidthAA:
+        case Operator::And1: return 1;
+
+        case Operator::IfElse: return 3;
+
+        default: return 0;
+        }
+    }
+
+    // Net stack depth change of an operator, excluding Rot and RevRot
+    static i32 DepthChange(Operator op) {
+        switch (op) {
+        case Operator::PushX:
+        case Operator::PushY:
+        case Operator::PushWidth:
+        case Operator::PushHeight:
+        case Operator::PushPositive:
+        case Operator::PushNegative:
+        case Operator::PushXMajor:
+        case Operator::PushYMajor:
+        case Operator::PushLeft:
+        case Operator::PushRight:
+        case Operator::Dup:
+        case Operator::Over:
+        case Operator::FracXStart:
+        case Operator::FracXEnd:
+        case Operator::FracXWidth:
+        case Operator::XStart:
+        case Operator::XEnd:
+        case Operator::XWidth:
+        case Operator::X0:
+        case Operator::AAStep: return +1;
+
+        case Operator::Add:
+        case Operator::Subtract:
+        case Operator::Multiply:
+        case Operator::Divide:
+        case Operator::Modulo:
+        case Operator::LeftShift:
+        case Operator::ArithmeticRightShift:
+        case Operator::LogicRightShift:
+        case Operator::And:
+        case Operator::Or:
+        case Operator::Xor:
+        case Operator::Drop:
+        case Operator::InvertAA:
+        case Operator::InvertAAFrac: return -1;
+
+        case Operator::IfElse: return -2;
+
+        default: return 0;
+        }
+    }
+
+private:
+    // Current depth relative to the initial depth
+    i64 m_depth = 0;
+
+    void Apply(size_t required, i32 change) {
+        // Depth relative to the start must be at least <required> at this point
+        if (m_depth < (i64)required) {
+            minEntryDepth = std::max(minEntryDepth, (size_t)((i64)required - m_depth));
+        }
+        m_depth += change;
+        netChange = (i32)m_depth;
+        if (m_depth > 0) {
+            maxGrowth = std::max(maxGrowth, (size_t)m_depth);
+        }
+    }
+};
+
+// GCC and Clang (including clang-cl) thread CompiledFormula instructions with computed gotos; MSVC falls back to a
+// loop that switches on the opcode
+#if defined(__clang__) || defined(__GNUC__)
+    #define FORMULA_OPCODE(name) \
+        case Opcode::name:       \
+        Op##name
+    #define FORMULA_NEXT(ok) \
+        if (!(ok)) {         \
+            return false;    \
+        }                    \
+        goto *kTargets[(size_t)(++ip)->opcode]
+#else
+    #define FORMULA_OPCODE(name) case Opcode::name
+    #define FORMULA_NEXT(ok) \
+        if (!(ok)) {         \
+            return false;    \
+        }                    \
+        continue
+#endif
+
+// A formula lowered into a compact stream of direct-threaded instructions.
+//
+// Every instruction holds an opcode along with its constant operand, if any. Constants and all operators that read data
+// point features lower to the same push instructions, so the operators left in the stream are pure stack operations.
+// Each operation jumps straight to the code of the next one, so there is no central dispatch. The stream ends with a
+// return instruction that stores the final stack depth.
+//
+// Execution follows the exact semantics of Operation::Execute, including the stack depth checks and guards. Formulas
+// with fully static stack effects are verified once at compile time and run without per-operation depth checks.
+class CompiledFormula {
+public:
+    CompiledFormula() {
+        Clear();
+    }
+
+    explicit CompiledFormula(std::span<const Operation> ops) {
+        Compile(ops);
+    }
+
+    void Clear() {
+        m_code.clear();
+        m_code.push_back({Opcode::Return});
+        m_source.clear();
+        m_profile = {};
+        m_verified = false;
+    }
+
+    // Appends an operation with stack depth checks; Compile and CompileGenes drop the checks on verified formulas
+    void Append(const Operation &op) {
+        m_code.back() = Lower(op);
+        m_code.push_back({Opcode::Return});
+        m_profile.Append(op, m_source.empty() ? nullptr : &m_source.back());
+        m_source.push_back(op);
+        m_verified = false;
+    }
+
+    void Compile(std::span<const Operation> ops) {
+        Clear();
+        for (auto &op : ops) {
+            Append(op);
+        }
+        Link();
+    }
+
+    // Compiles the enabled genes of a chromosome, skipping disabled genes entirely
+    template <typename GeneRange>
+    void CompileGenes(const GeneRange &genes) {
+        Clear();
+        for (auto &gene : genes) {
+            if (gene.enabled) {
+                Append(gene.op);
+            }
+        }
+        Link();
+    }
+
+    const std::vector<Operation> &Source() const {
+        return m_source;
+    }
+
+    size_t Size() const {
+        return m_source.size();
+    }
+
+    const StackProfile &Profile() const {
+        return m_profile;
+    }
+
+    // Determines if the formula runs without stack depth checks
+    bool IsVerified() const {
+        return m_verified;
+    }
+
+    // Runs the formula on top of the current stack contents using precomputed data point features.
+    // Returns false if any operation fails, in which case the stack contents are unspecified.
+    bool Execute(const DataPointFeatures &features, FixedStack &stack) const {
+        if (!m_verified) {
+            return Run<true>(features, stack);
+        }
+        if (stack.pos < m_profile.minEntryDepth || stack.pos + m_profile.maxGrowth > kStackSize) {
+            return false;
+        }
+        return Run<false>(features, stack);
+    }
+
+private:
+    static constexpr size_t kStackSize = std::tuple_size_v<decltype(FixedStack::stack)>;
+
+    enum class Opcode : u8 {
+        PushConstant,
+        PushFeature,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Modulo,
+        Negate,
+        LeftShift,
+        ArithmeticRightShift,
+        LogicRightShift,
+        And,
+        Or,
+        Xor,
+        Not,
+        Dup,
+        Over,
+        Swap,
+        Drop,
+        Rot,
+        RevRot,
+        IfElse,
+        InsertAAFracBits,
+        InvertAA,
+        InvertAAFrac,
+        MulWidth,
+        MulHeight,
+        DivWidth,
+        DivHeight,
+        Add1,
+        Sub1,
+        Mul2,
+        Div2,
+        MulHeightDivWidthAA,
+        And1,
+        Fail,
+        Return,
+    };
+
+    struct Instruction {
+        Opcode opcode;
+        i32 operand;
+    };
+
+    std::vector<Instruction> m_code; // One instruction per operation, terminated by a return instruction
+    std::vector<Operation> m_source; // Operations the code was compiled from
+    StackProfile m_profile;          // Stack depth profile of m_source
+    bool m_verified = false;         // true if m_code runs without stack depth checks
+
+    // Drops the per-operation stack depth checks if the formula's stack effects are fully static. Execute then checks
+    // the initial stack depth against the profile once instead of checking on every operation.
+    void Link() {
+        m_verified = !m_profile.dynamic && m_profile.valid;
+    }
+
+    template <bool Checked>
+    bool Run(const DataPointFeatures &features, FixedStack &stack) const {
+        i32 *const base = stack.stack.data();
+        i32 *sp = base + stack.pos;
+        auto depthBelow = [&](ptrdiff_t depth) { return Checked && sp - base < depth; };
+        // Formulas with dynamic stack effects are only bounded while running
+        auto full = [&] { return Checked && sp - base >= (ptrdiff_t)kStackSize; };
+        auto unary = [&](auto func) {
+            if (depthBelow(1)) {
+                return false;
+            }
+            sp[-1] = func(sp[-1]);
+            return true;
+        };
+        auto binary = [&](auto func) {
+            if (depthBelow(2)) {
+                return false;
+            }
+            sp[-2] = func(sp[-2], sp[-1]);
+            sp--;
+            return true;
+        };
+        // Moves the item <count> positions below the top to the top (forward) or the other way around
+        auto rotate = [&](bool forward) {
+            if (depthBelow(1)) {
+                return false;
+            }
+            const i32 count = sp[-1];
+            if (Checked && (count < 1 || count >= sp - base)) {
+                return false;
+            }
+            sp--;
+            if (forward) {
+                std::rotate(sp - count, sp - 1, sp);
+            } else {
+                std::rotate(sp - count, sp - count + 1, sp);
+            }
+            return true;
+        };
+        const i32 width = features[DataPointFeatures::kWidth];
+        const i32 height = features[DataPointFeatures::kHeight];
+
+#if defined(__clang__) || defined(__GNUC__)
+        // Indexed by Opcode
+        static void *const kTargets[] = {
+            &&OpPushConstant,
+            &&OpPushFeature,
+            &&OpAdd,
+            &&OpSubtract,
+            &&OpMultiply,
+            &&OpDivide,
+            &&OpModulo,
+            &&OpNegate,
+            &&OpLeftShift,
+            &&OpArithmeticRightShift,
+            &&OpLogicRightShift,
+            &&OpAnd,
+            &&OpOr,
+            &&OpXor,
+            &&OpNot,
+            &&OpDup,
+            &&OpOver,
+            &&OpSwap,
+            &&OpDrop,
+            &&OpRot,
+            &&OpRevRot,
+            &&OpIfElse,
+            &&OpInsertAAFracBits,
+            &&OpInvertAA,
+            &&OpInvertAAFrac,
+            &&OpMulWidth,
+            &&OpMulHeight,
+            &&OpDivWidth,
+            &&OpDivHeight,
+            &&OpAdd1,
+            &&OpSub1,
+            &&OpMul2,
+            &&OpDiv2,
+            &&OpMulHeightDivWidthAA,
+            &&OpAnd1,
+            &&OpFail,
+            &&OpReturn,
+        };
+        static_assert(std::size(kTargets) == (size_t)Opcode::Return + 1);
+#endif
+
+        // With threaded dispatch, only the first instruction goes through the switch
+        for (const Instruction *ip = m_code.data();; ip++) {
+            switch (ip->opcode) {
+            FORMULA_OPCODE(PushConstant):
+                if (full()) {
+                    return false;
+                }
+                *sp++ = ip->operand;
+                FORMULA_NEXT(true);
+            FORMULA_OPCODE(PushFeature):
+                if (full()) {
+                    return false;
+                }
+                *sp++ = features.values[ip->operand];
+                FORMULA_NEXT(true);
+
+            FORMULA_OPCODE(Add): FORMULA_NEXT(binary([](i32 x, i32 y) { return x + y; }));
+            FORMULA_OPCODE(Subtract): FORMULA_NEXT(binary([](i32 x, i32 y) { return x - y; }));
+            FORMULA_OPCODE(Multiply): FORMULA_NEXT(binary([](i32 x, i32 y) { return x * y; }));
+            FORMULA_OPCODE(Divide):
+                FORMULA_NEXT(
+                    binary([](i32 x, i32 y) { return y == 0 || (x == 0x80000000 && y == -1) ? INT32_MAX : x / y; }));
+            FORMULA_OPCODE(Modulo):
+                FORMULA_NEXT(binary([](i32 x, i32 y) { return y == 0 || (x == 0x80000000 && y == -1) ? 0 : x % y; }));
+            FORMULA_OPCODE(Negate): FORMULA_NEXT(unary([](i32 x) { return -x; }));
+            FORMULA_OPCODE(LeftShift): FORMULA_NEXT(binary([](i32 x, i32 y) { return x << y; }));
+            FORMULA_OPCODE(ArithmeticRightShift): FORMULA_NEXT(binary([](i32 x, i32 y) { return (x >> y); }));
+            FORMULA_OPCODE(LogicRightShift):
+                FORMULA_NEXT(binary([](i32 x, i32 y) -> i32 { return ((u32)x >> (u32)y); }));
+            FORMULA_OPCODE(And): FORMULA_NEXT(binary([](i32 x, i32 y) { return x & y; }));
+            FORMULA_OPCODE(Or): FORMULA_NEXT(binary([](i32 x, i32 y) { return x | y; }));
+            FORMULA_OPCODE(Xor): FORMULA_NEXT(binary([](i32 x, i32 y) { return x ^ y; }));
+            FORMULA_OPCODE(Not): FORMULA_NEXT(unary([](i32 x) { return ~x; }));
+
+            FORMULA_OPCODE(Dup):
+                if (depthBelow(1) || full()) {
+                    return false;
+                }
+                sp[0] = sp[-1];
+                sp++;
+                FORMULA_NEXT(true);
+            FORMULA_OPCODE(Over):
+                if (depthBelow(2) || full()) {
+                    return false;
+                }
+                sp[0] = sp[-2];
+                sp++;
+                FORMULA_NEXT(true);
+            FORMULA_OPCODE(Swap):
+                if (depthBelow(2)) {
+                    return false;
+                }
+                std::swap(sp[-1], sp[-2]);
+                FORMULA_NEXT(true);
+            FORMULA_OPCODE(Drop):
+                if (depthBelow(1)) {
+                    return false;
+                }
+                sp--;
+                FORMULA_NEXT(true);
+            FORMULA_OPCODE(Rot): FORMULA_NEXT(rotate(true));
+            FORMULA_OPCODE(RevRot): FORMULA_NEXT(rotate(false));
+            FORMULA_OPCODE(IfElse):
+                if (depthBelow(3)) {
+                    return false;
+                }
+                sp[-3] = sp[-1] ? sp[-2] : sp[-3];
+                sp -= 2;
+                FORMULA_NEXT(true);
+
+            FORMULA_OPCODE(InsertAAFracBits): FORMULA_NEXT(unary([](i32 x) -> i32 { return x * Slope::kAAFracRange; }));
+            FORMULA_OPCODE(InvertAA):
+                FORMULA_NEXT(binary([](i32 x, i32 y) -> i32 { return x ? (y ^ (Slope::kAARange - 1)) : y; }));
+            FORMULA_OPCODE(InvertAAFrac):
+                FORMULA_NEXT(binary([](i32 x, i32 y) -> i32 { return x ? (y ^ (Slope::kAAFracRange - 1)) : y; }));
+            FORMULA_OPCODE(MulWidth): FORMULA_NEXT(unary([&](i32 x) { return x * width; }));
+            FORMULA_OPCODE(MulHeight): FORMULA_NEXT(unary([&](i32 x) { return x * height; }));
+            FORMULA_OPCODE(DivWidth): FORMULA_NEXT(unary([&](i32 x) { return x / width; }));
+            FORMULA_OPCODE(DivHeight): FORMULA_NEXT(unary([&](i32 x) { return x / height; }));
+            FORMULA_OPCODE(Add1): FORMULA_NEXT(unary([](i32 x) { return x + 1; }));
+            FORMULA_OPCODE(Sub1): FORMULA_NEXT(unary([](i32 x) { return x - 1; }));
+            FORMULA_OPCODE(Mul2): FORMULA_NEXT(unary([](i32 x) { return x << 1; }));
+            FORMULA_OPCODE(Div2): FORMULA_NEXT(unary([](i32 x) { return (x >> 1); }));
+            FORMULA_OPCODE(MulHeightDivWidthAA):
+                FORMULA_NEXT(unary([&](i32 x) -> i32 { return x * height * Slope::kAAFracRange / width; }));
+            FORMULA_OPCODE(And1): FORMULA_NEXT(unary([](i32 x) { return x & 1; }));
+            FORMULA_OPCODE(Fail): return false;
+            FORMULA_OPCODE(Return):
+                stack.pos = sp - base;
+                return true;
+            }
+        }
+    }
+
+    static Instruction Lower(const Operation &op) {
+        if (op.type == Operation::Type::Constant) {
+            return {Opcode::PushConstant, op.constVal};
+        }
+        if (DataPointFeatures::Feature feature; DataPointFeatures::PushedBy(op.op, feature)) {
+            return {Opcode::PushFeature, (i32)feature};
+        }
+
+        switch (op.op) {
+        case Operator::Add: return {Opcode::Add};
+        case Operator::Subtract: return {Opcode::Subtract};
+        case Operator::Multiply: return {Opcode::Multiply};
+        case Operator::Divide: return {Opcode::Divide};
+        case Operator::Modulo: return {Opcode::Modulo};
+        case Operator::Negate: return {Opcode::Negate};
+        case Operator::LeftShift: return {Opcode::LeftShift};
+        case Operator::ArithmeticRightShift: return {Opcode::ArithmeticRightShift};
+        case Operator::LogicRightShift: return {Opcode::LogicRightShift};
+        case Operator::And: return {Opcode::And};
+        case Operator::Or: return {Opcode::Or};
+        case Operator::Xor: return {Opcode::Xor};
+        case Operator::Not: return {Opcode::Not};
+
+        case Operator::Dup: return {Opcode::Dup};
+        case Operator::Over: return {Opcode::Over};
+        case Operator::Swap: return {Opcode::Swap};
+        case Operator::Drop: return {Opcode::Drop};
+        case Operator::Rot: return {Opcode::Rot};
+        case Operator::RevRot: return {Opcode::RevRot};
+        case Operator::IfElse: return {Opcode::IfElse};
+
+        case Operator::InsertAAFracBits: return {Opcode::InsertAAFracBits};
+        case Operator::InvertAA: return {Opcode::InvertAA};
+        case Operator::InvertAAFrac: return {Opcode::InvertAAFrac};
+        case Operator::MulWidth: return {Opcode::MulWidth};
+        case Operator::MulHeight: return {Opcode::MulHeight};
+        case Operator::DivWidth: return {Opcode::DivWidth};
+        case Operator::DivHeight: return {Opcode::DivHeight};
+        case Operator::Add1: return {Opcode::Add1};
+        case Operator::Sub1: return {Opcode::Sub1};
+        case Operator::Mul2: return {Opcode::Mul2};
+        case Operator::Div2: return {Opcode::Div2};
+        case Operator::MulHeightDivWidthAA: return {Opcode::MulHeightDivWidthAA};
+        case Operator::And1: return {Opcode::And1};
+        default: return {Opcode::Fail};
+        }
+    }
+};
+
 struct Evaluator {
     Context ctx;
     std::vector<Operation> ops;
+    CompiledFormula formula; // compiled from ops by Compile
 
     void DebugPrint(std::ostream &os) {
         os << "Variables:\n";
@@ -474,12 +1138,30 @@ struct Evaluator {
         }
     }
 
-    void BeginEval(const DataPoint &dataPoint, bool positive, bool left) {
+    static void SetupSlope(Slope &slope, const DataPoint &dataPoint, bool positive, bool left) {
         if (positive) {
-            ctx.slope.Setup(0, 0, dataPoint.width, dataPoint.height, left);
+            slope.Setup(0, 0, dataPoint.width, dataPoint.height, left);
         } else {
-            ctx.slope.Setup(dataPoint.width, 0, 0, dataPoint.height, left);
+            slope.Setup(dataPoint.width, 0, 0, dataPoint.height, left);
         }
+    }
+
+    // Precomputes the features of a data point for Eval(const DataPointFeatures &, i32 &)
+    static DataPointFeatures Features(const DataPoint &dataPoint, bool positive, bool left) {
+        Slope slope;
+        SetupSlope(slope, dataPoint, positive, left);
+        Variables vars;
+        vars.Apply(dataPoint, left);
+        return DataPointFeatures::Compute(slope, vars);
+    }
+
+    // Compiles ops for Eval and EvalXMajor; must be called whenever ops change
+    void Compile() {
+        formula.Compile(ops);
+    }
+
+    void BeginEval(const DataPoint &dataPoint, bool positive, bool left) {
+        SetupSlope(ctx.slope, dataPoint, positive, left);
         ctx.stack.clear();
         ctx.vars.Apply(dataPoint, left);
     }
@@ -514,69 +1196,56 @@ struct Evaluator {
         if (ctx.stack.empty()) {
             return false;
         }
-        const i32 divResult = (Slope::kOne / ctx.vars.height);
-        const i32 dx = ctx.vars.y * divResult * ctx.vars.width;
-        const i32 fracStart = Slope::kBias + dx;
-        const i32 startX = fracStart >> Slope::kFracBits;
-        const i32 endX = ((fracStart & Slope::kMask) + dx - Slope::kOne) >> Slope::kFracBits;
-        const i32 deltaX = endX - startX + 1;
-        const i32 baseCoverage = ctx.stack.back();
-        const i32 fullCoverage = ((deltaX * ctx.vars.height * Slope::kAARange) << Slope::kAAFracBits) / ctx.vars.width;
-        const i32 coverageStep = fullCoverage / deltaX;
-        const i32 coverageBias = coverageStep / 2;
-        const i32 offset = ctx.vars.x - startX;
-        const i32 fracCoverage = baseCoverage + offset * coverageStep;
-        const i32 finalCoverage = (fracCoverage + coverageBias) % Slope::kAAFracRange;
-        result = finalCoverage >> Slope::kAAFracBits;
+        result = XMajorCoverage(ctx.vars.x, ctx.vars.y, ctx.vars.width, ctx.vars.height, ctx.stack.back());
         return true;
     }
 
+    // Evaluates the formula on a single data point, leaving its slope and variables in ctx.
+    // Loops over many data points should precompute their features with Features and use the overloads below.
     bool Eval(const DataPoint &dataPoint, bool positive, bool left, i32 &result) {
-        if (!EvalCommon(dataPoint, positive, left)) {
+        BeginEval(dataPoint, positive, left);
+        return Eval(DataPointFeatures::Compute(ctx.slope, ctx.vars), result);
+    }
+
+    // Evaluates the formula on a data point whose features were precomputed with Features.
+    // ctx.slope and ctx.vars are left untouched.
+    bool Eval(const DataPointFeatures &features, i32 &result) {
+        ctx.stack.clear();
+        if (!formula.Execute(features, ctx.stack) || ctx.stack.empty()) {
             return false;
         }
-
         result = ctx.stack.back();
         return true;
     }
 
     bool EvalXMajor(const DataPoint &dataPoint, bool positive, bool left, i32 &result) {
-        if (!EvalCommon(dataPoint, positive, left)) {
+        BeginEval(dataPoint, positive, left);
+        return EvalXMajor(DataPointFeatures::Compute(ctx.slope, ctx.vars), result);
+    }
+
+    bool EvalXMajor(const DataPointFeatures &features, i32 &result) {
+        if (!Eval(features, result)) {
             return false;
         }
+        result = XMajorCoverage(features[DataPointFeatures::kX], features[DataPointFeatures::kY],
+                                features[DataPointFeatures::kWidth], features[DataPointFeatures::kHeight], result);
+        return true;
+    }
 
-        const i32 divResult = (Slope::kOne / ctx.vars.height);
-        const i32 dx = ctx.vars.y * divResult * ctx.vars.width;
+private:
+    static i32 XMajorCoverage(i32 x, i32 y, i32 width, i32 height, i32 baseCoverage) {
+        const i32 divResult = (Slope::kOne / height);
+        const i32 dx = y * divResult * width;
         const i32 fracStart = Slope::kBias + dx;
         const i32 startX = fracStart >> Slope::kFracBits;
         const i32 endX = ((fracStart & Slope::kMask) + dx - Slope::kOne) >> Slope::kFracBits;
         const i32 deltaX = endX - startX + 1;
-        const i32 baseCoverage = ctx.stack.back();
-        const i32 fullCoverage = ((deltaX * ctx.vars.height * Slope::kAARange) << Slope::kAAFracBits) / ctx.vars.width;
+        const i32 fullCoverage = ((deltaX * height * Slope::kAARange) << Slope::kAAFracBits) / width;
         const i32 coverageStep = fullCoverage / deltaX;
         const i32 coverageBias = coverageStep / 2;
-        const i32 offset = ctx.vars.x - startX;
+        const i32 offset = x - startX;
         const i32 fracCoverage = baseCoverage + offset * coverageStep;
         const i32 finalCoverage = (fracCoverage + coverageBias) % Slope::kAAFracRange;
-        result = finalCoverage >> Slope::kAAFracBits;
-        return true;
-    }
-
-private:
-    bool EvalCommon(const DataPoint &dataPoint, bool positive, bool left) {
-        BeginEval(dataPoint, positive, left);
-        for (auto &op : ops) {
-            if (!op.Execute(ctx)) {
-                return false;
-            }
-        }
-        /*if (ctx.stack.size() != 1) {
-            return false;
-        }*/
-        // NOTE: relaxed rule -- allows garbage on the stack; top of the stack contains the result
-        if (ctx.stack.empty()) {
-            return false;
-        }
-        return true;
+        return finalCoverage >> Slope::kAAFracBits;
     }
 };
@@ -1,6 +1,7 @@
 #include "func_generator.h"
 
 #include "dataset.h"
+#include "formula_bounds.h"
 
 #include <array>
 #include <chrono>
@@ -9,6 +10,14 @@
 void generateFunc(const std::vector<Operation> &templateOps, const std::vector<DataPoint> &dataPoints) {
     Evaluator eval;
 
+    // Results are post-processed by EvalXMajor, so only formulas that fail every data point can be ruled out early
+    std::vector<DataPointFeatures> features;
+    for (auto &dataPoint : dataPoints) {
+        features.push_back(Evaluator::Features(dataPoint, true, true));
+    }
+    const FeatureRanges ranges = FeatureRanges::Of(features);
+    AbstractStack bounds{ranges};
+
     std::vector<size_t> templateIndices;
 
     auto nextTemplate = [&] {
@@ -56,10 +65,16 @@ void generateFunc(const std::vector<Operation> &templateOps, const std::vector<D
         nextTemplate();
         // randomTemplate();
 
+        bounds.Clear();
+        if (bounds.Apply(eval.ops) == AbstractStack::State::Fails) {
+            continue;
+        }
+
+        eval.Compile();
         bool valid = true;
-        for (auto &dataPoint : dataPoints) {
-            if (i32 result; eval.EvalXMajor(dataPoint, true, true, result)) {
-                if (result != dataPoint.expectedOutput) {
+        for (size_t i = 0; i < dataPoints.size(); i++) {
+            if (i32 result; eval.EvalXMajor(features[i], result)) {
+                if (result != dataPoints[i].expectedOutput) {
                     valid = false;
                     break;
                 }
@@ -84,9 +99,11 @@ void generateFunc(const std::vector<Operation> &templateOps, const std::vector<D
             std::cout << "  " << op.Str() << "\n";
         }
         eval.ops = resultOps;
+        eval.Compile();
         std::cout << "Actual results:\n";
-        for (auto &dataPoint : dataPoints) {
-            if (i32 result; eval.EvalXMajor(dataPoint, true, true, result)) {
+        for (size_t i = 0; i < dataPoints.size(); i++) {
+            const DataPoint &dataPoint = dataPoints[i];
+            if (i32 result; eval.EvalXMajor(features[i], result)) {
                 std::cout << dataPoint.width << "x" << dataPoint.height << " @ " << dataPoint.x << "x" << dataPoint.y
                           << "  " << result << (result == dataPoint.expectedOutput ? " == " : " != ")
                           << dataPoint.expectedOutput << "\n";
@@ -106,30 +123,40 @@ struct DFSFuncGenerator {
 
     FixedStack stack;
     std::array<FixedStack, kMaxOperations> stackBackups;
+    std::vector<CompiledFormula> compiledTemplateOps; // one single-operation formula per template operation
     std::array<Operation, kMaxOperations> formula;
     size_t formulaLength;
 
     struct PrecomputedDataPoint {
-        Slope slope;
-        Variables vars;
+        DataPointFeatures features;
         i32 expectedOutput;
 
         PrecomputedDataPoint(const DataPoint &dp, bool left, bool positive)
             : expectedOutput(dp.expectedOutput) {
 
+            Slope slope;
             if (positive) {
                 slope.Setup(0, 0, dp.width, dp.height, left);
             } else {
                 slope.Setup(dp.width, 0, 0, dp.height, left);
             }
+            Variables vars;
             vars.Apply(dp, left);
+            features = DataPointFeatures::Compute(slope, vars);
         }
     };
     std::vector<PrecomputedDataPoint> precomputedDataPoints;
 
+    // Abstract stacks over the whole data set; bounds[level] holds the result of the first level operations
+    FormulaPruner pruner;
+    std::vector<AbstractStack> bounds;
+
     DFSFuncGenerator(const std::vector<Operation> &templateOps, std::filesystem::path datasetRoot)
         : templateOps(templateOps)
         , dataSet(loadXMajorDataSet(datasetRoot)) {
+        for (auto &op : templateOps) {
+            compiledTemplateOps.emplace_back(std::span(&op, 1));
+        }
         for (auto &dataPoint : dataSet.lpx) {
             precomputedDataPoints.emplace_back(dataPoint, true, true);
         }
@@ -142,11 +169,21 @@ struct DFSFuncGenerator {
         for (auto &dataPoint : dataSet.rnx) {
             precomputedDataPoints.emplace_back(dataPoint, false, false);
         }
+
+        std::vector<DataPointFeatures> features;
+        std::vector<FormulaPruner::Target> targets;
+        for (auto &dp : precomputedDataPoints) {
+            features.push_back(dp.features);
+            targets.push_back({dp.expectedOutput, dp.expectedOutput, 1});
+        }
+        pruner.SetDataPoints(features, targets);
+        bounds.assign(kMaxOperations + 1, AbstractStack{pruner.Ranges()});
     }
 
     bool search() {
         formulaLength = 0;
         stack.clear();
+        bounds[0].Clear();
         return search(0);
     }
 
@@ -159,7 +196,9 @@ struct DFSFuncGenerator {
             return false;
         }
         stackBackups[level] = stack; // TODO: optimize stack handling
-        for (auto &op : templateOps) {
+        for (size_t opIndex = 0; opIndex < templateOps.size(); opIndex++) {
+            auto &op = templateOps[opIndex];
+            auto &compiledOp = compiledTemplateOps[opIndex];
 #ifdef _DEBUG
             formula[level] = op;
             printf("testing formula:");
@@ -169,10 +208,28 @@ struct DFSFuncGenerator {
             }
             printf("\n");
 #endif
-            bool allPass = true;
-            for (auto &dp : precomputedDataPoints) {
+            // Formulas that fail every data point can't be fixed by appending operations
+            auto &nextBounds = bounds[level + 1];
+            nextBounds = bounds[level];
+            const AbstractStack::State state = nextBounds.Apply(op);
+            if (state == AbstractStack::State::Fails) {
+                continue;
+            }
+            // Skip checking formulas that provably miss some data point, but keep the stack of the first one to
+            // continue the search from
+            const bool mayPass = state != AbstractStack::State::Valid ||
+                                 (nextBounds.Size() == 1 && pruner.MinErrors(nextBounds.Top()) == 0);
+
+            bool allPass = mayPass;
+            if (!mayPass && !precomputedDataPoints.empty()) {
+                stack = stackBackups[level];
+                compiledOp.Execute(precomputedDataPoints[0].features, stack);
+            }
+            for (size_t i = 0; mayPass && i < precomputedDataPoints.size(); i++) {
+                auto &dp = precomputedDataPoints[i];
                 stack = stackBackups[level]; // TODO: optimize stack handling
-                if (!op.Execute(dp.slope, stack, dp.vars) || stack.size() != 1 || stack[0] != dp.expectedOutput) {
+                if (!compiledOp.Execute(dp.features, stack) || stack.size() != 1 ||
+                    stack[0] != dp.expectedOutput) {
                     allPass = false;
                     break;
                 }
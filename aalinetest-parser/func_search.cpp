@@ -1,43 +1,527 @@
 #include "func_search.h"
 
+#include "formula_opt.h"
+
 #include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <Windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace {
+
+// Restricts the calling thread to a single logical processor, wrapping around if there are fewer processors than
+// workers. Best effort; failures leave the thread free to run anywhere.
+void pinCurrentThread(size_t index) {
+#if defined(_WIN32)
+    // Machines with more than 64 logical processors split them into processor groups
+    const WORD numGroups = GetActiveProcessorGroupCount();
+    const DWORD numProcessors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    if (numProcessors == 0) {
+        return;
+    }
+    DWORD processor = (DWORD)(index % numProcessors);
+    for (WORD group = 0; group < numGroups; group++) {
+        const DWORD groupSize = GetActiveProcessorCount(group);
+        if (processor < groupSize) {
+            GROUP_AFFINITY affinity{};
+            affinity.Group = group;
+            affinity.Mask = (KAFFINITY)1 << processor;
+            SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+            return;
+        }
+        processor -= groupSize;
+    }
+#elif defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    // Pick the index-th processor the process is allowed to run on
+    size_t target = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            return;
+        }
+    }
+#else
+    (void)index;
+#endif
+}
+
+// Lists the islands each island receives migrants from. Random topologies pick their sources on every migration.
+std::vector<std::vector<size_t>> buildMigrationSources(GAFuncSearch::MigrationTopology topology, size_t numIslands) {
+    using Topology = GAFuncSearch::MigrationTopology;
+
+    std::vector<std::vector<size_t>> sources(numIslands);
+    auto addSource = [&](size_t island, size_t source) {
+        auto &list = sources[island];
+        if (source != island && std::find(list.begin(), list.end(), source) == list.end()) {
+            list.push_back(source);
+        }
+    };
+
+    switch (topology) {
+    case Topology::AllToAll:
+        for (size_t i = 0; i < numIslands; i++) {
+            for (size_t j = 0; j < numIslands; j++) {
+                addSource(i, j);
+            }
+        }
+        break;
+    case Topology::Ring:
+        for (size_t i = 0; i < numIslands; i++) {
+            addSource(i, (i + numIslands - 1) % numIslands);
+        }
+        break;
+    case Topology::Torus: {
+        // Use the squarest grid that fits the islands exactly; prime counts degenerate into a ring in both directions
+        size_t rows = 1;
+        for (size_t r = 1; r * r <= numIslands; r++) {
+            if (numIslands % r == 0) {
+                rows = r;
+            }
+        }
+        const size_t cols = numIslands / rows;
+        for (size_t i = 0; i < numIslands; i++) {
+            const size_t row = i / cols;
+            const size_t col = i % cols;
+            addSource(i, ((row + rows - 1) % rows) * cols + col);
+            addSource(i, ((row + 1) % rows) * cols + col);
+            addSource(i, row * cols + (col + cols - 1) % cols);
+            addSource(i, row * cols + (col + 1) % cols);
+        }
+        break;
+    }
+    case Topology::Random: break;
+    case Topology::Hub:
+        for (size_t i = 1; i < numIslands; i++) {
+            addSource(0, i);
+            addSource(i, 0);
+        }
+        break;
+    }
+    return sources;
+}
+
+// Bits of mask word w that belong to the first count genes
+u64 prefixMask(size_t count, size_t w) {
+    if (count >= (w + 1) * 64) {
+        return ~0ull;
+    }
+    if (count <= w * 64) {
+        return 0;
+    }
+    return (1ull << (count - w * 64)) - 1;
+}
+
+// Moves every bit of a gene mask dist genes towards gene 0, dropping those that fall off the front
+void shiftMaskDown(std::span<u64> mask, size_t dist) {
+    const size_t wordShift = dist / 64;
+    const size_t bitShift = dist % 64;
+    for (size_t w = 0; w < mask.size(); w++) {
+        const size_t src = w + wordShift;
+        const u64 lo = src < mask.size() ? mask[src] : 0;
+        const u64 hi = src + 1 < mask.size() ? mask[src + 1] : 0;
+        mask[w] = bitShift != 0 ? (lo >> bitShift) | (hi << (64 - bitShift)) : lo;
+    }
+}
+
+// Moves every bit of a mask of numGenes genes dist genes away from gene 0, dropping those that fall off the back
+void shiftMaskUp(std::span<u64> mask, size_t dist, size_t numGenes) {
+    const size_t wordShift = dist / 64;
+    const size_t bitShift = dist % 64;
+    for (size_t w = mask.size(); w-- > 0;) {
+        if (w < wordShift) {
+            mask[w] = 0;
+            continue;
+        }
+        const size_t src = w - wordShift;
+        const u64 lo = src > 0 ? mask[src - 1] : 0;
+        mask[w] = bitShift != 0 ? (mask[src] << bitShift) | (lo >> (64 - bitShift)) : mask[src];
+    }
+    if (!mask.empty()) {
+        mask.back() &= prefixMask(numGenes, mask.size() - 1);
+    }
+}
+
+// Template indices of the enabled genes of a chromosome, which alone decide its formula
+void enabledGenes(const GAFuncSearch::Chromosome &chrom, std::vector<u8> &genes) {
+    genes.clear();
+    for (size_t w = 0; w < chrom.enabled.size(); w++) {
+        for (u64 bits = chrom.enabled[w]; bits != 0; bits &= bits - 1) {
+            genes.push_back(chrom.genes[w * 64 + std::countr_zero(bits)]);
+        }
+    }
+}
+
+// Template indices present in a gene sequence, folded into 64 bits. An edit flips at most two bits, so sequences whose
+// signatures differ in more than 2 * n bits are more than n edits apart.
+u64 geneSignature(std::span<const u8> genes) {
+    u64 signature = 0;
+    for (u8 gene : genes) {
+        signature |= 1ull << (gene % 64);
+    }
+    return signature;
+}
+
+// Levenshtein distance between two gene sequences, or limit + 1 if it's larger than limit. Only the cells within limit
+// of the diagonal can stay within the limit, so the cost is O(length * limit). row is scratch space.
+size_t editDistance(std::span<const u8> a, std::span<const u8> b, size_t limit, std::vector<u32> &row) {
+    if (a.size() < b.size()) {
+        std::swap(a, b);
+    }
+    limit = std::min(limit, a.size());
+    if (a.size() - b.size() > limit) {
+        return limit + 1;
+    }
+
+    // Near-clones mostly differ in the middle
+    while (!b.empty() && a.front() == b.front()) {
+        a = a.subspan(1);
+        b = b.subspan(1);
+    }
+    while (!b.empty() && a.back() == b.back()) {
+        a = a.first(a.size() - 1);
+        b = b.first(b.size() - 1);
+    }
+    if (b.empty()) {
+        return a.size();
+    }
+
+    // Cells outside the band are never written and keep the initial value of inf
+    const u32 inf = (u32)limit + 1;
+    row.resize(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) {
+        row[j] = (u32)std::min<size_t>(j, inf);
+    }
+    for (size_t i = 1; i <= a.size(); i++) {
+        const size_t lo = i > limit ? i - limit : 1;
+        const size_t hi = std::min(b.size(), i + limit);
+        u32 diag = row[lo - 1];
+        row[lo - 1] = lo == 1 ? (u32)std::min<size_t>(i, inf) : inf;
+        u32 rowMin = row[lo - 1];
+        for (size_t j = lo; j <= hi; j++) {
+            const u32 up = row[j];
+            row[j] = std::min({up + 1, row[j - 1] + 1, diag + (a[i - 1] != b[j - 1]), inf});
+            diag = up;
+            rowMin = std::min(rowMin, row[j]);
+        }
+        if (rowMin >= inf) {
+            return inf;
+        }
+    }
+    return row[b.size()];
+}
+
+// Checkpoint file format
+constexpr char kCheckpointMagic[4] = {'A', 'A', 'G', 'A'};
+constexpr u32 kCheckpointVersion = 7;
+
+// Sanity limits for loading checkpoints
+constexpr u32 kMaxCheckpointWorkers = 1 << 12;
+constexpr u32 kMaxCheckpointPopSize = 1 << 20;
+constexpr u32 kMaxCheckpointNumOps = 1 << 12;
+constexpr u32 kMaxCheckpointString = 1 << 16;
+
+// Template operations are stored as a tag followed by the operator index or the constant value
+enum class OperationTag : u8 { Operator, Constant };
+
+template <typename T>
+void write(std::ostream &out, const T &value) {
+    out.write((const char *)&value, sizeof(value));
+}
+
+template <typename T>
+bool read(std::istream &in, T &value) {
+    in.read((char *)&value, sizeof(value));
+    return (bool)in;
+}
+
+void writeString(std::ostream &out, const std::string &str) {
+    write(out, (u32)str.size());
+    out.write(str.data(), str.size());
+}
+
+bool readString(std::istream &in, std::string &str) {
+    u32 size;
+    if (!read(in, size) || size > kMaxCheckpointString) {
+        return false;
+    }
+    str.resize(size);
+    in.read(str.data(), size);
+    return (bool)in;
+}
+
+void writeOperations(std::ostream &out, const std::vector<Operation> &ops) {
+    write(out, (u32)ops.size());
+    for (auto &op : ops) {
+        if (op.type == Operation::Type::Operator) {
+            write(out, OperationTag::Operator);
+            write(out, (u8)op.op);
+        } else {
+            write(out, OperationTag::Constant);
+            write(out, op.constVal);
+        }
+    }
+}
+
+bool readOperations(std::istream &in, std::vector<Operation> &ops) {
+    u32 size;
+    if (!read(in, size) || size > GAFuncSearch::kMaxTemplateOps) {
+        return false;
+    }
+    ops.resize(size);
+    for (auto &op : ops) {
+        OperationTag tag;
+        if (!read(in, tag)) {
+            return false;
+        }
+        switch (tag) {
+        case OperationTag::Operator: {
+            u8 index;
+            if (!read(in, index) || index >= std::size(kOperators)) {
+                return false;
+            }
+            op = Operation{.type = Operation::Type::Operator, .op = kOperators[index]};
+            break;
+        }
+        case OperationTag::Constant: {
+            i32 value;
+            if (!read(in, value)) {
+                return false;
+            }
+            op = Operation{.type = Operation::Type::Constant, .constVal = value};
+            break;
+        }
+        default: return false;
+        }
+    }
+    return true;
+}
+
+// Genes are stored packed, as in memory
+void writeChromosome(std::ostream &out, const GAFuncSearch::Chromosome &chrom) {
+    write(out, chrom.fitness);
+    write(out, chrom.numErrors);
+    write(out, (u32)chrom.stackSize);
+    write(out, chrom.generation);
+    write(out, (u8)chrom.worseThanCutoff);
+    out.write((const char *)chrom.genes.data(), chrom.genes.size());
+    out.write((const char *)chrom.enabled.data(), chrom.enabled.size() * sizeof(u64));
+}
+
+bool readChromosome(std::istream &in, GAFuncSearch::Chromosome &chrom, size_t numOps, size_t numTemplateOps) {
+    u32 stackSize;
+    u8 worseThanCutoff;
+    if (!read(in, chrom.fitness) || !read(in, chrom.numErrors) || !read(in, stackSize) ||
+        !read(in, chrom.generation) || !read(in, worseThanCutoff)) {
+        return false;
+    }
+    chrom.stackSize = stackSize;
+    chrom.worseThanCutoff = worseThanCutoff != 0;
+
+    chrom.Resize(numOps);
+    in.read((char *)chrom.genes.data(), chrom.genes.size());
+    in.read((char *)chrom.enabled.data(), chrom.enabled.size() * sizeof(u64));
+    if (!in || (chrom.enabled.back() & ~prefixMask(numOps, chrom.enabled.size() - 1)) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < numOps; i++) {
+        if (chrom.IsEnabled(i) && chrom.genes[i] >= numTemplateOps) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
 
 GAFuncSearch::GAFuncSearch(std::filesystem::path root)
-    : m_rng(m_rd()) {
-    //: m_dataSet{loadXMajorDataSet(root)}
+    : GAFuncSearch(root, Config{}) {}
 
+GAFuncSearch::GAFuncSearch(std::filesystem::path root, const Config &config)
+    : m_config(Validate(config))
+    , m_rng(m_rd()) {
     // Best fitness: 11
     // Function: push_x_width - - push_31 push_5 push_4 dup push_aa_step mul sub push_x_end div_2 dup - - - - - push_x
     // shl sar sub - add shr push_x_start push_9 - mul_width - - - - - - sub mul_height_div_width_aa - push_aa_step - -
     // - div_2 - - add - add
 
-    for (size_t i = 0; i < m_workers.size(); i++) {
-        // m_workerStates[i].randomGenerationWeight = 1.0f + i * 0.5f;
-        // m_workerStates[i].crossoverPopWeight = 5.0f + i * 1.0f;
+    const size_t numWorkers = m_config.numWorkers;
+    for (size_t i = 0; i < numWorkers; i++) {
+        m_migrationSlots.push_back(std::make_unique<MigrationSlot>(m_config.numMigrants, m_config.numOps));
+    }
+    ClearMigrationSlots();
+    m_migrationSources = buildMigrationSources(m_config.topology, numWorkers);
+    for (size_t i = 0; i < numWorkers; i++) {
+        m_workerStates.push_back(std::make_unique<WorkerState>(m_config.popSize, m_config.numOps));
+    }
+
+    for (size_t i = 0; i < numWorkers; i++) {
+        auto &state = *m_workerStates[i];
+
+        // Spread the mutation rates evenly across the islands, from the least to the most disruptive
+        const float t = numWorkers > 1 ? (float)i / (numWorkers - 1) : 0.0f;
+
+        // state.randomGenerationWeight = 1.0f + t * 2.5f;
+        // state.crossoverPopWeight = 5.0f + t * 5.0f;
+
+        state.randomMutationChance = 0.10f + t * 0.75f;
+        state.spliceMutationChance = 0.05f + t * 0.50f;
+        // state.reverseMutationChance = 0.05f + t * 0.05f;
+        state.reverseMutationChance = 0.0f;
+
+        // state.geneEnablePct = 0.4f + t * 0.5f;
+
+        // state.ComputeParameters();
+    }
+}
+
+GAFuncSearch::GAFuncSearch(std::filesystem::path root, const Checkpoint &checkpoint)
+    : GAFuncSearch(root, checkpoint.config) {
+    m_generation = checkpoint.generation;
+    m_resetCount = checkpoint.resetCount;
+    m_bestChromHistory = checkpoint.bestChromHistory;
+    m_templateOps = checkpoint.templateOps;
+    for (size_t i = 0; i < std::min(checkpoint.islands.size(), m_workerStates.size()); i++) {
+        RestoreIsland(i, checkpoint.islands[i]);
+    }
+}
 
-        m_workerStates[i].randomMutationChance = 0.10f + i * 0.15f;
-        m_workerStates[i].spliceMutationChance = 0.05f + i * 0.10f;
-        // m_workerStates[i].reverseMutationChance = 0.05f + i * 0.01f;
-        m_workerStates[i].reverseMutationChance = 0.0f;
+GAFuncSearch::Config GAFuncSearch::Validate(Config config) {
+    // Stay within the checkpoint limits so that every search can be saved and loaded back. Islands need room for at
+    // least one elite and one offspring.
+    config.numWorkers = std::clamp<size_t>(config.numWorkers, 1, kMaxCheckpointWorkers);
+    config.popSize = std::clamp<size_t>(config.popSize, 2, kMaxCheckpointPopSize);
+    config.numOps = std::clamp<size_t>(config.numOps, 1, kMaxCheckpointNumOps);
+    config.migrationInterval = std::max<size_t>(config.migrationInterval, 1);
+    config.numMigrants = std::clamp<size_t>(config.numMigrants, 1, config.popSize);
+    config.randomNeighbors = std::clamp<size_t>(config.randomNeighbors, 1, std::max<size_t>(config.numWorkers, 2) - 1);
+    config.tournamentSize = std::max<size_t>(config.tournamentSize, 1);
+    config.nicheRadius = std::min(config.nicheRadius, config.numOps);
+    config.nicheCapacity = std::max<size_t>(config.nicheCapacity, 1);
+    return config;
+}
 
-        // m_workerStates[i].geneEnablePct = 0.4f + i * 0.1f;
+GAFuncSearch::~GAFuncSearch() {
+    Stop();
+}
 
-        // m_workerStates[i].ComputeParameters();
+void GAFuncSearch::SetTemplateOps(const std::vector<Operation> &templateOps) {
+    std::vector<Operation> newOps{templateOps.begin(),
+                                  templateOps.begin() + std::min(templateOps.size(), kMaxTemplateOps)};
+    if (m_templateOps.empty() || newOps == m_templateOps) {
+        m_templateOps = std::move(newOps);
+        return;
+    }
 
-        m_workers[i] = std::jthread{[&, id = i] {
+    // Translate the genes of the existing chromosomes to the new table
+    std::array<int, kMaxTemplateOps> mapping;
+    mapping.fill(-1);
+    for (size_t i = 0; i < m_templateOps.size(); i++) {
+        if (auto it = std::find(newOps.begin(), newOps.end(), m_templateOps[i]); it != newOps.end()) {
+            mapping[i] = (int)(it - newOps.begin());
+        }
+    }
+    auto remap = [&](Chromosome &chrom) {
+        for (size_t i = 0; i < chrom.genes.size(); i++) {
+            const int index = mapping[chrom.genes[i]];
+            if (index < 0) {
+                chrom.genes[i] = 0;
+                chrom.SetEnabled(i, false);
+            } else {
+                chrom.genes[i] = (u8)index;
+            }
+        }
+    };
+    for (auto &state : m_workerStates) {
+        for (auto &chrom : state->population) {
+            remap(chrom);
+        }
+    }
+    std::vector<Chromosome> migrants(m_config.numMigrants);
+    for (auto &slot : m_migrationSlots) {
+        slot->Read(migrants);
+        for (auto &chrom : migrants) {
+            remap(chrom);
+        }
+        slot->Publish(migrants);
+    }
+    {
+        std::scoped_lock lk{m_bestChromHistoryMutex};
+        for (auto &chrom : m_bestChromHistory) {
+            remap(chrom);
+        }
+    }
+    m_templateOps = std::move(newOps);
+}
+
+std::vector<GAFuncSearch::Gene> GAFuncSearch::Genes(const Chromosome &chrom) const {
+    std::vector<Gene> genes(chrom.genes.size());
+    for (size_t i = 0; i < chrom.genes.size(); i++) {
+        if (chrom.IsEnabled(i) && chrom.genes[i] < m_templateOps.size()) {
+            genes[i] = {m_templateOps[chrom.genes[i]], true};
+        }
+    }
+    return genes;
+}
+
+void GAFuncSearch::Start() {
+    {
+        std::scoped_lock lk{m_snapshotMutex};
+        m_activeWorkers = m_workerStates.size();
+    }
+    m_testSet.Start();
+    for (size_t i = 0; i < m_workerStates.size(); i++) {
+        m_workers.emplace_back([&, id = i] {
+            if (m_config.pinWorkers) {
+                pinCurrentThread(id);
+            }
             while (m_running) {
                 NextGeneration(id);
             }
-        }};
+
+            // Let a pending checkpoint copy this island directly
+            std::scoped_lock lk{m_snapshotMutex};
+            --m_activeWorkers;
+            m_snapshotCond.notify_all();
+        });
     }
 }
 
-GAFuncSearch::~GAFuncSearch() {
+void GAFuncSearch::Stop() {
     m_running = false;
+    for (auto &worker : m_workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    m_testSet.Stop();
+    if (m_checkpointer.joinable()) {
+        m_checkpointer.request_stop();
+        m_checkpointer.join();
+    }
 }
 
 void GAFuncSearch::NextGeneration(size_t workerId) {
-    auto &state = m_workerStates[workerId];
+    auto &state = *m_workerStates[workerId];
+    auto &order = state.order;
 
     // Selection
     if (state.reset) {
@@ -45,25 +529,62 @@ void GAFuncSearch::NextGeneration(size_t workerId) {
         for (auto &chrom : state.population) {
             state.NewChromosome(chrom, m_templateOps);
         }
+        std::fill(state.caseErrorsValid.begin(), state.caseErrorsValid.end(), 0);
         state.reset = false;
     }
 
-    // Crossover, mutation and fitness evaluation
-    for (size_t idx = 0; idx < state.population.size(); idx++) {
+    const FitnessEvaluator evaluator = m_evaluator;
+    FitnessCache *cache = m_useFitnessCache ? &m_fitnessCache : nullptr;
+    state.jit.SetMode(m_jitMode);
+
+    // Switch to the latest version of the active test set. The fitness of the elites is then outdated.
+    bool testSetChanged = false;
+    if (state.testSet == nullptr || state.testSet->id != m_testSet.CurrentId()) {
+        state.testSet = m_testSet.Current();
+        state.pruner.SetDataPoints(state.testSet->batch.rows, state.testSet->targets);
+        state.evalOrder.clear();
+        testSetChanged = true;
+    }
+    const ActiveTestSet::Version &testSet = *state.testSet;
+
+    const bool lexicase = m_config.selection == SelectionMethod::Lexicase;
+    if (lexicase && testSetChanged) {
+        state.numCases = testSet.dataPoints.size();
+        state.caseWords = (state.numCases + 63) / 64;
+        state.caseErrors.assign(state.population.size() * state.caseWords, 0);
+        state.caseErrorsValid.assign(state.population.size(), 0);
+    }
+
+    // Chromosomes that can't beat the worst elite of the previous generation are discarded as soon as possible
+    uint64_t cutoff = std::numeric_limits<uint64_t>::max();
+    if (m_useEarlyExit && state.numElites > 0 && !testSetChanged) {
+        cutoff = state.population[order[state.numElites - 1]].fitness;
+    }
+
+    // Migrants take the first slots of the offspring
+    const size_t immigrantsEnd = Immigrate(workerId);
+
+    // Crossover, mutation and fitness evaluation. Parents are picked among the elites and the new random chromosomes,
+    // which come first in the order and are evaluated by the time the offspring are bred.
+    auto selectParent = [&] { return state.SelectParent(m_config.selection, m_config.tournamentSize); };
+    for (size_t rank = 0; rank < order.size(); rank++) {
+        const size_t idx = order[rank];
         auto &chrom = state.population[idx];
-        if (idx >= state.randomGenStart && idx < state.crossoverStart) {
+        if (rank >= state.numElites && rank < state.crossoverStart) {
             state.NewChromosome(chrom, m_templateOps);
             chrom.generation = m_generation;
-        } else if (idx >= state.crossoverStart) {
-            if (idx < state.crossoverStart + kWorkers) {
-                size_t workerIdx = idx - state.crossoverStart;
-                auto &sharedState = m_sharedStates[workerIdx];
-                state.population[idx] = sharedState.population[!sharedState.popBufferFlip];
-            } else {
-                if (state.pctDist(state.randomEngine) < 0.5f) {
-                    state.OnePointCrossover(chrom, 0, state.crossoverStart - 1);
+        } else if (rank >= state.crossoverStart) {
+            if (lexicase && rank == state.crossoverStart) {
+                state.PrepareLexicase();
+            }
+            if (rank >= immigrantsEnd) {
+                const bool onePoint = state.randomEngine.NextFloat() < 0.5f;
+                const auto &firstParent = state.population[selectParent()];
+                const auto &secondParent = state.population[selectParent()];
+                if (onePoint) {
+                    state.OnePointCrossover(chrom, firstParent, secondParent);
                 } else {
-                    state.RandomCrossover(chrom, 0, state.crossoverStart - 1);
+                    state.RandomCrossover(chrom, firstParent, secondParent);
                 }
                 state.RandomizeGenes(chrom, m_templateOps);
                 state.SpliceGenes(chrom);
@@ -76,21 +597,42 @@ void GAFuncSearch::NextGeneration(size_t workerId) {
             chrom.generation = m_generation;
         }
 
-        state.EvaluateFitness(chrom, m_fixedDataPoints);
+        // Lexicase selection needs to know which data points the parents fail
+        std::span<u64> caseErrors;
+        if (lexicase) {
+            if (rank >= state.numElites) {
+                state.caseErrorsValid[idx] = 0;
+            }
+            if (rank < state.crossoverStart && !state.caseErrorsValid[idx]) {
+                caseErrors = std::span{state.caseErrors}.subspan(idx * state.caseWords, state.caseWords);
+                state.caseErrorsValid[idx] = 1;
+            }
+        }
+
+        state.EvaluateFitness(chrom, m_templateOps, testSet, evaluator, cache, cutoff, caseErrors);
         if (chrom.fitness == 0) {
-            m_running = false;
+            m_testSet.Submit(state.ops, testSet.id);
         }
     }
+    if (m_testSet.IsSolved()) {
+        m_running = false;
+    }
 
-    // Share best chromosomes
-    // std::shuffle(state.population.begin(), state.population.end(), m_rng);
-    std::sort(state.population.begin(), state.population.end());
-    auto &shared = m_sharedStates[workerId];
-    shared.population[shared.popBufferFlip] = state.population[0];
-    shared.popBufferFlip = !shared.popBufferFlip;
+    // Pick the elites of the next generation and share the best chromosomes
+    RankIsland(workerId);
+    m_migrationSlots[workerId]->Publish(state.population, order);
+    if (state.generation % kDiversityInterval == 0) {
+        state.MeasureDiversity();
+    }
+    ++state.generation;
 
+    if (m_snapshotRequested) {
+        ContributeSnapshot(workerId);
+    }
+
+    m_testSet.CountGeneration();
     ++m_generation;
-    if (m_generation > state.population[0].generation + m_staleGenCount) {
+    if (m_generation > state.population[order[0]].generation + m_staleGenCount) {
         Reset();
     }
 }
@@ -101,19 +643,198 @@ void GAFuncSearch::WorkerState::ComputeParameters() {
     randomGenerationPct = randomGenerationWeight * rcpTotalWeights;
     // crossoverPopPct = crossoverPopWeight * rcpTotalWeights;
 
-    randomGenStart = population.size() * eliteSelectionPct + 0.5f;
-    crossoverStart = population.size() * (eliteSelectionPct + randomGenerationPct) + 0.5f;
+    // Tiny populations still keep the best chromosome and have a parent to breed from
+    const size_t popSize = population.size();
+    randomGenStart = std::clamp<size_t>(popSize * eliteSelectionPct + 0.5f, 1, popSize);
+    crossoverStart = std::clamp<size_t>(popSize * (eliteSelectionPct + randomGenerationPct) + 0.5f, randomGenStart,
+                                        popSize);
+    numElites = randomGenStart;
+}
+
+void GAFuncSearch::RankIsland(size_t workerId) {
+    auto &state = *m_workerStates[workerId];
+    if (m_config.niching == NichingMethod::Clearing) {
+        state.RankNiches(m_config.nicheRadius, m_config.nicheCapacity);
+    } else {
+        state.RankPopulation(m_config.numMigrants);
+    }
+}
+
+void GAFuncSearch::WorkerState::RankPopulation(size_t numSorted) {
+    auto better = [&](uint32_t lhs, uint32_t rhs) { return population[lhs] < population[rhs]; };
+    numElites = randomGenStart;
+    numSorted = std::clamp<size_t>(numSorted, 1, order.size());
+    if (numSorted >= randomGenStart) {
+        std::partial_sort(order.begin(), order.begin() + numSorted, order.end(), better);
+    } else {
+        // The worst elite stays at order[randomGenStart - 1], where NextGeneration reads the early exit cutoff
+        std::nth_element(order.begin(), order.begin() + (randomGenStart - 1), order.end(), better);
+        std::partial_sort(order.begin(), order.begin() + numSorted, order.begin() + (randomGenStart - 1), better);
+    }
+}
+
+void GAFuncSearch::WorkerState::RankNiches(size_t radius, size_t capacity) {
+    std::sort(order.begin(), order.end(),
+              [&](uint32_t lhs, uint32_t rhs) { return population[lhs] < population[rhs]; });
+
+    // Each chromosome joins the first niche whose best chromosome is within radius edits, or starts a new niche. The
+    // elites and the cleared chromosomes are compacted into the ranks visited so far, in that order.
+    nicheGenes.clear();
+    nicheStarts.assign(1, 0);
+    nicheSignatures.clear();
+    nicheSizes.clear();
+    cleared.clear();
+    numElites = 0;
+    for (size_t rank = 0; rank < order.size() && numElites < randomGenStart; rank++) {
+        const uint32_t idx = order[rank];
+        enabledGenes(population[idx], phenotype);
+        const u64 signature = geneSignature(phenotype);
+        bool keep = true;
+        size_t niche = 0;
+        for (; niche < nicheSizes.size(); niche++) {
+            if ((size_t)std::popcount(signature ^ nicheSignatures[niche]) > radius * 2) {
+                continue;
+            }
+            const auto best = std::span{nicheGenes}.subspan(nicheStarts[niche],
+                                                             nicheStarts[niche + 1] - nicheStarts[niche]);
+            if (editDistance(phenotype, best, radius, editRow) <= radius) {
+                keep = nicheSizes[niche] < capacity;
+                nicheSizes[niche] += keep;
+                break;
+            }
+        }
+        if (niche == nicheSizes.size()) {
+            nicheGenes.insert(nicheGenes.end(), phenotype.begin(), phenotype.end());
+            nicheStarts.push_back((uint32_t)nicheGenes.size());
+            nicheSignatures.push_back(signature);
+            nicheSizes.push_back(1);
+        }
+        if (keep) {
+            order[numElites++] = idx;
+        } else {
+            cleared.push_back(idx);
+        }
+    }
+    std::copy(cleared.begin(), cleared.end(), order.begin() + numElites);
+    numCleared.fetch_add(cleared.size(), std::memory_order_relaxed);
+}
+
+void GAFuncSearch::WorkerState::MeasureDiversity() {
+    if (numElites == 0) {
+        return;
+    }
+    enabledGenes(population[order[0]], nicheGenes);
+    phenotypeHashes.clear();
+    uint64_t distanceSum = 0;
+    for (size_t rank = 0; rank < numElites; rank++) {
+        enabledGenes(population[order[rank]], phenotype);
+        distanceSum += editDistance(phenotype, nicheGenes, phenotype.size() + nicheGenes.size(), editRow);
+        phenotypeHashes.push_back(std::hash<std::string_view>{}({(const char *)phenotype.data(), phenotype.size()}));
+    }
+    std::sort(phenotypeHashes.begin(), phenotypeHashes.end());
+    const size_t distinct = std::unique(phenotypeHashes.begin(), phenotypeHashes.end()) - phenotypeHashes.begin();
+
+    measuredElites.store((u32)numElites, std::memory_order_relaxed);
+    distinctElites.store((u32)distinct, std::memory_order_relaxed);
+    eliteDistanceSum.store(distanceSum, std::memory_order_relaxed);
+}
+
+void GAFuncSearch::WorkerState::PrepareLexicase() {
+    auto row = [&](uint32_t idx) { return std::span{caseErrors}.subspan(idx * caseWords, caseWords); };
+
+    // Parents that fail the same data points are indistinguishable to lexicase selection
+    lexicasePool.assign(order.begin(), order.begin() + crossoverStart);
+    std::sort(lexicasePool.begin(), lexicasePool.end(), [&](uint32_t lhs, uint32_t rhs) {
+        return std::ranges::lexicographical_compare(row(lhs), row(rhs));
+    });
+    lexicaseGroups.clear();
+    for (size_t i = 0; i < lexicasePool.size(); i++) {
+        if (i == 0 || !std::ranges::equal(row(lexicasePool[i - 1]), row(lexicasePool[i]))) {
+            lexicaseGroups.push_back(i);
+        }
+    }
+    lexicaseGroups.push_back(lexicasePool.size());
+
+    // Only the data points some groups pass and others fail can narrow down the candidates
+    lexicaseMask.assign(caseWords * 2, 0);
+    auto anyFail = std::span{lexicaseMask}.first(caseWords);
+    auto allFail = std::span{lexicaseMask}.last(caseWords);
+    std::fill(allFail.begin(), allFail.end(), ~0ull);
+    for (size_t g = 0; g + 1 < lexicaseGroups.size(); g++) {
+        auto errors = row(lexicasePool[lexicaseGroups[g]]);
+        for (size_t w = 0; w < caseWords; w++) {
+            anyFail[w] |= errors[w];
+            allFail[w] &= errors[w];
+        }
+    }
+    lexicaseCases.clear();
+    for (size_t c = 0; c < numCases; c++) {
+        const u64 bit = 1ull << (c % 64);
+        if ((anyFail[c / 64] & ~allFail[c / 64] & bit) != 0) {
+            lexicaseCases.push_back(c);
+        }
+    }
+}
+
+size_t GAFuncSearch::WorkerState::SelectParent(SelectionMethod method, size_t tournamentSize) {
+    const u32 poolSize = (u32)crossoverStart;
+    switch (method) {
+    case SelectionMethod::Truncation: return order[randomEngine.Below(poolSize)];
+    case SelectionMethod::Tournament: {
+        size_t best = order[randomEngine.Below(poolSize)];
+        for (size_t i = 1; i < tournamentSize; i++) {
+            const size_t challenger = order[randomEngine.Below(poolSize)];
+            if (population[challenger] < population[best]) {
+                best = challenger;
+            }
+        }
+        return best;
+    }
+    case SelectionMethod::Lexicase: {
+        // Keep the groups that pass each data point, unless none do, until a single one remains. The data points are
+        // shuffled incrementally, so every pick sees a fresh random order.
+        auto &candidates = lexicaseCandidates;
+        auto &survivors = lexicaseSurvivors;
+        auto &cases = lexicaseCases;
+        candidates.resize(lexicaseGroups.size() - 1);
+        std::iota(candidates.begin(), candidates.end(), 0);
+        for (size_t i = 0; i < cases.size() && candidates.size() > 1; i++) {
+            std::swap(cases[i], cases[randomEngine.Range(i, cases.size() - 1)]);
+            const size_t word = cases[i] / 64;
+            const u64 bit = 1ull << (cases[i] % 64);
+            survivors.clear();
+            for (uint32_t group : candidates) {
+                if ((caseErrors[lexicasePool[lexicaseGroups[group]] * caseWords + word] & bit) == 0) {
+                    survivors.push_back(group);
+                }
+            }
+            if (!survivors.empty()) {
+                candidates.swap(survivors);
+            }
+        }
+        const uint32_t group = candidates[randomEngine.Below((u32)candidates.size())];
+        return lexicasePool[randomEngine.Range(lexicaseGroups[group], lexicaseGroups[group + 1] - 1)];
+    }
+    }
+    return order[0];
 }
 
 void GAFuncSearch::WorkerState::NewChromosome(Chromosome &chrom, const std::vector<Operation> &templateOps) {
     // TODO: implement other forms of gene generation
     // - random splicing of small chunks of "sensible" code
     // - incremental sequence (same as brute-force)
-    // if (pctDist(randomEngine) < 0.999f) {
+    // if (randomEngine.NextFloat() < 0.999f) {
     if (true) {
         // Generate a completely new chromosome 99.9% of the time
-        for (auto &gene : chrom.genes) {
-            NewGene(gene, templateOps);
+        // Template indices from a batch of random words, two per word, and enable bits 64 at a time
+        const u32 numTemplateOps = (u32)templateOps.size();
+        randomBits.resize((chrom.genes.size() + 1) / 2);
+        randomEngine.Fill(randomBits);
+        for (size_t i = 0; i < chrom.genes.size(); i++) {
+            chrom.genes[i] = (u8)FastRng::Scale((u32)(randomBits[i / 2] >> (i % 2 * 32)), numTemplateOps);
+        }
+        for (size_t w = 0; w < chrom.enabled.size(); w++) {
+            chrom.enabled[w] = randomEngine.BernoulliMask(geneEnablePct) & prefixMask(chrom.genes.size(), w);
         }
     } else {
         /*static constexpr std::array<Operation, 28> kFixedOperations{
@@ -186,71 +907,68 @@ void GAFuncSearch::WorkerState::NewChromosome(Chromosome &chrom, const std::vect
         size_t templatePos = 0;
         for (size_t i = 0; i < chrom.genes.size(); i++) {
             double chanceForSpace = (double)spaces / chrom.genes.size();
-            if (templatePos == kFixedOperations.size() || pctDist(randomEngine) < chanceForSpace) {
-                chrom.genes[i].enabled = false;
+            if (templatePos == kFixedOperations.size() || randomEngine.NextFloat() < chanceForSpace) {
+                chrom.SetEnabled(i, false);
                 spaces--;
             } else {
-                chrom.genes[i].enabled = true;
-                chrom.genes[i].op = kFixedOperations[templatePos++];
+                // Operations missing from the template can't be encoded
+                auto it = std::find(templateOps.begin(), templateOps.end(), kFixedOperations[templatePos++]);
+                chrom.SetEnabled(i, it != templateOps.end());
+                chrom.genes[i] = it != templateOps.end() ? (u8)(it - templateOps.begin()) : 0;
             }
         }
     }
 }
 
-void GAFuncSearch::WorkerState::OnePointCrossover(Chromosome &chrom, size_t first, size_t last) {
-    std::uniform_int<size_t>::param_type popParam{first, last};
-    std::uniform_int<size_t>::param_type geneParam{0, chrom.genes.size() - 1};
-
-    size_t firstParentIndex = intDist(randomEngine, popParam);
-    size_t secondParentIndex = intDist(randomEngine, popParam);
-    size_t crossoverPos = intDist(randomEngine, geneParam);
-    auto &firstParent = population[firstParentIndex];
-    auto &secondParent = population[secondParentIndex];
+void GAFuncSearch::WorkerState::OnePointCrossover(Chromosome &chrom, const Chromosome &firstParent,
+                                                  const Chromosome &secondParent) {
+    size_t crossoverPos = randomEngine.Below((u32)chrom.genes.size());
     std::copy_n(firstParent.genes.begin(), crossoverPos, chrom.genes.begin());
     std::copy(secondParent.genes.begin() + crossoverPos, secondParent.genes.end(), chrom.genes.begin() + crossoverPos);
+    for (size_t w = 0; w < chrom.enabled.size(); w++) {
+        const u64 fromFirst = prefixMask(crossoverPos, w);
+        chrom.enabled[w] = (firstParent.enabled[w] & fromFirst) | (secondParent.enabled[w] & ~fromFirst);
+    }
 }
 
-void GAFuncSearch::WorkerState::RandomCrossover(Chromosome &chrom, size_t first, size_t last) {
-    std::uniform_int<size_t>::param_type popParam{first, last};
-    std::uniform_int<size_t>::param_type geneParam{0, chrom.genes.size() - 1};
-
-    size_t firstParentIndex = intDist(randomEngine, popParam);
-    size_t secondParentIndex = intDist(randomEngine, popParam);
-    auto &firstParent = population[firstParentIndex];
-    auto &secondParent = population[secondParentIndex];
-    for (size_t i = 0; i < chrom.genes.size(); i++) {
-        if (pctDist(randomEngine) < 0.5f) {
-            chrom.genes[i] = firstParent.genes[i];
-        } else {
-            chrom.genes[i] = secondParent.genes[i];
+void GAFuncSearch::WorkerState::RandomCrossover(Chromosome &chrom, const Chromosome &firstParent,
+                                                const Chromosome &secondParent) {
+    // Genes are picked from either parent with equal chance, 64 at a time from the bits of a random word
+    for (size_t w = 0; w < chrom.enabled.size(); w++) {
+        const u64 fromFirst = randomEngine();
+        chrom.enabled[w] = (firstParent.enabled[w] & fromFirst) | (secondParent.enabled[w] & ~fromFirst);
+        const size_t end = std::min(chrom.genes.size(), (w + 1) * 64);
+        for (size_t i = w * 64; i < end; i++) {
+            chrom.genes[i] = (fromFirst >> (i % 64)) & 1 ? firstParent.genes[i] : secondParent.genes[i];
         }
     }
 }
 
-void GAFuncSearch::WorkerState::NewGene(Gene &gene, const std::vector<Operation> &templateOps) {
-    gene.enabled = pctDist(randomEngine) < geneEnablePct;
-    if (gene.enabled) {
-        std::uniform_int<size_t>::param_type param{0, templateOps.size() - 1};
-        size_t index = intDist(randomEngine, param);
-        gene.op = templateOps[index];
+void GAFuncSearch::WorkerState::NewGene(Chromosome &chrom, size_t index, const std::vector<Operation> &templateOps) {
+    const bool enabled = randomEngine.NextFloat() < geneEnablePct;
+    chrom.SetEnabled(index, enabled);
+    if (enabled) {
+        chrom.genes[index] = (u8)randomEngine.Below((u32)templateOps.size());
     }
 }
 
 void GAFuncSearch::WorkerState::RandomizeGenes(Chromosome &chrom, const std::vector<Operation> &templateOps) {
-    for (auto &gene : chrom.genes) {
-        if (pctDist(randomEngine) < randomMutationChance) {
-            NewGene(gene, templateOps);
+    // Pick the genes to mutate 64 at a time
+    for (size_t w = 0; w < chrom.enabled.size(); w++) {
+        u64 mutated = randomEngine.BernoulliMask(randomMutationChance) & prefixMask(chrom.genes.size(), w);
+        for (; mutated != 0; mutated &= mutated - 1) {
+            NewGene(chrom, w * 64 + std::countr_zero(mutated), templateOps);
         }
     }
 }
 
 void GAFuncSearch::WorkerState::SpliceGenes(Chromosome &chrom) {
     // Swaps genes between two ranges
-    if (pctDist(randomEngine) < spliceMutationChance) {
-        std::uniform_int<size_t>::param_type param{0, chrom.genes.size() - 1};
-        size_t start = intDist(randomEngine, param);
-        size_t end = intDist(randomEngine, param);
-        size_t pos = intDist(randomEngine, param);
+    if (randomEngine.NextFloat() < spliceMutationChance) {
+        const u32 numGenes = (u32)chrom.genes.size();
+        size_t start = randomEngine.Below(numGenes);
+        size_t end = randomEngine.Below(numGenes);
+        size_t pos = randomEngine.Below(numGenes);
 
         if (start > end) {
             std::swap(start, end);
@@ -260,11 +978,11 @@ void GAFuncSearch::WorkerState::SpliceGenes(Chromosome &chrom) {
 
         if (pos < start) {
             for (size_t i = 0; i < count; i++) {
-                std::swap(chrom.genes[pos + i], chrom.genes[start + i]);
+                chrom.SwapGenes(pos + i, start + i);
             }
         } else if (pos > start) {
             for (size_t i = 0; i < count; i++) {
-                std::swap(chrom.genes[pos + count - 1 - i], chrom.genes[start + count - 1 - i]);
+                chrom.SwapGenes(pos + count - 1 - i, start + count - 1 - i);
             }
         }
     }
@@ -272,23 +990,25 @@ void GAFuncSearch::WorkerState::SpliceGenes(Chromosome &chrom) {
 
 void GAFuncSearch::WorkerState::ReverseGenes(Chromosome &chrom) {
     // Reverses a range of genes
-    if (pctDist(randomEngine) < reverseMutationChance) {
-        std::uniform_int<size_t>::param_type param{0, chrom.genes.size() - 1};
-        size_t start = intDist(randomEngine, param);
-        size_t end = intDist(randomEngine, param);
+    if (randomEngine.NextFloat() < reverseMutationChance) {
+        const u32 numGenes = (u32)chrom.genes.size();
+        size_t start = randomEngine.Below(numGenes);
+        size_t end = randomEngine.Below(numGenes);
 
         if (start > end) {
             std::swap(start, end);
         }
-        std::reverse(chrom.genes.begin() + start, chrom.genes.begin() + end + 1);
+        for (; start < end; start++, end--) {
+            chrom.SwapGenes(start, end);
+        }
     }
 }
 
 void GAFuncSearch::WorkerState::DisableGenes(Chromosome &chrom) {
     // Randomly disables genes
-    for (auto &gene : chrom.genes) {
-        if (gene.enabled && pctDist(randomEngine) < disableMutationChance) {
-            gene.enabled = false;
+    for (auto &word : chrom.enabled) {
+        if (word != 0) {
+            word &= ~randomEngine.BernoulliMask(disableMutationChance);
         }
     }
 }
@@ -296,111 +1016,672 @@ void GAFuncSearch::WorkerState::DisableGenes(Chromosome &chrom) {
 void GAFuncSearch::WorkerState::ShiftChromosome(Chromosome &chrom) {
     // Shift all genes in the chromosome left or right.
     // Genes at the edges are discarded/disabled.
-    if (pctDist(randomEngine) < shiftChromosomeMutationChance) {
-        std::uniform_int<size_t>::param_type param{0, chrom.genes.size() - 1};
-        size_t dist = intDist(randomEngine, param);
-        bool left = pctDist(randomEngine) < 0.5f;
+    if (randomEngine.NextFloat() < shiftChromosomeMutationChance) {
+        size_t dist = randomEngine.Below((u32)chrom.genes.size());
+        bool left = randomEngine.NextFloat() < 0.5f;
         if (left) {
             std::shift_left(chrom.genes.begin(), chrom.genes.end(), dist);
+            shiftMaskDown(chrom.enabled, dist);
         } else { // right
             std::shift_right(chrom.genes.begin(), chrom.genes.end(), dist);
+            shiftMaskUp(chrom.enabled, dist, chrom.genes.size());
         }
     }
 }
 
 void GAFuncSearch::WorkerState::RotateChromosome(Chromosome &chrom) {
     // Rotates all genes in the chromosome
-    if (pctDist(randomEngine) < shiftChromosomeMutationChance) {
-        std::uniform_int<size_t>::param_type param{0, chrom.genes.size() - 1};
-        size_t dist = intDist(randomEngine, param);
+    if (randomEngine.NextFloat() < shiftChromosomeMutationChance) {
+        size_t dist = randomEngine.Below((u32)chrom.genes.size());
         std::rotate(chrom.genes.begin(), chrom.genes.begin() + dist, chrom.genes.end());
+        if (dist != 0) {
+            maskScratch = chrom.enabled;
+            shiftMaskDown(chrom.enabled, dist);
+            shiftMaskUp(maskScratch, chrom.genes.size() - dist, chrom.genes.size());
+            for (size_t w = 0; w < chrom.enabled.size(); w++) {
+                chrom.enabled[w] |= maskScratch[w];
+            }
+        }
     }
 }
 
 void GAFuncSearch::WorkerState::ShiftGenes(Chromosome &chrom) {
-    // Randomly slides individual genes left or right while preserving the function order
-    for (size_t i = 0; i < chrom.genes.size(); i++) {
-        if (chrom.genes[i].enabled && pctDist(randomEngine) < shiftGenesMutationChance) {
+    // Randomly slides individual genes left or right while preserving the function order.
+    // The genes to slide are picked 64 at a time among those enabled when their word is reached.
+    for (size_t w = 0; w < chrom.enabled.size(); w++) {
+        u64 picked = chrom.enabled[w] & randomEngine.BernoulliMask(shiftGenesMutationChance);
+        for (; picked != 0; picked &= picked - 1) {
+            const size_t i = w * 64 + std::countr_zero(picked);
             size_t left = i;
             size_t right = i;
             while (left > 0) {
-                if (!chrom.genes[left - 1].enabled) {
+                if (!chrom.IsEnabled(left - 1)) {
                     --left;
                 } else {
                     break;
                 }
             }
             while (right > chrom.genes.size()) {
-                if (!chrom.genes[right + 1].enabled) {
+                if (!chrom.IsEnabled(right + 1)) {
                     ++right;
                 } else {
                     break;
                 }
             }
-            std::uniform_int<size_t>::param_type param{left, right};
-            size_t pos = intDist(randomEngine, param);
-            std::swap(chrom.genes[i], chrom.genes[pos]);
+            size_t pos = randomEngine.Range(left, right);
+            chrom.SwapGenes(i, pos);
         }
     }
 }
 
-uint64_t GAFuncSearch::WorkerState::EvaluateFitness(Chromosome &chrom,
-                                                    const std::vector<ExtDataPoint> &fixedDataPoints) {
+uint64_t GAFuncSearch::WorkerState::EvaluateFitness(Chromosome &chrom, const std::vector<Operation> &templateOps,
+                                                    const ActiveTestSet::Version &testSet, FitnessEvaluator evaluator,
+                                                    FitnessCache *cache, uint64_t cutoff, std::span<u64> caseErrors) {
+    const auto &dataPoints = testSet.dataPoints;
     chrom.fitness = 0;
     chrom.numErrors = 0;
+    chrom.worseThanCutoff = false;
 
-    // Evaluate against the fixed data set
-    for (auto &dataPoint : fixedDataPoints) {
-        ctx.slope = dataPoint.slope;
-        ctx.stack.clear();
-        ctx.vars.Apply(dataPoint.dp, dataPoint.left);
+    if (evalOrder.size() != dataPoints.size() || ++evalsSinceReorder >= kReorderInterval) {
+        ReorderDataPoints(dataPoints.size());
+    }
 
-        bool valid = true;
-        for (auto &gene : chrom.genes) {
-            if (!gene.enabled) {
-                continue;
+    // Decode the enabled genes and strip the junk from them
+    ops.clear();
+    for (size_t w = 0; w < chrom.enabled.size(); w++) {
+        for (u64 bits = chrom.enabled[w]; bits != 0; bits &= bits - 1) {
+            ops.push_back(templateOps[chrom.genes[w * 64 + std::countr_zero(bits)]]);
+        }
+    }
+    OptimizeFormula(ops);
+
+    // Reuse the result of a previous evaluation of the same formula
+    FormulaKey key{};
+    if (cache != nullptr) {
+        key = FormulaKey::Of(ops, testSet.id);
+        FitnessCache::Result cached;
+        if (caseErrors.empty() && cache->Lookup(key, cached)) {
+            chrom.fitness = cached.fitness;
+            chrom.numErrors = cached.numErrors;
+            chrom.stackSize = cached.stackSize;
+            return chrom.fitness;
+        }
+    }
+    // Data points are marked as they fail; chromosomes that aren't evaluated in full fail them all
+    std::fill(caseErrors.begin(), caseErrors.end(), 0);
+    auto failAllCases = [&] { std::fill(caseErrors.begin(), caseErrors.end(), ~0ull); };
+    auto markCase = [&](size_t index) {
+        if (!caseErrors.empty()) {
+            caseErrors[index / 64] |= 1ull << (index % 64);
+        }
+    };
+
+    // Only complete evaluations are cached
+    auto cacheResult = [&] {
+        if (cache != nullptr) {
+            cache->Insert(key, {chrom.fitness, chrom.numErrors, chrom.stackSize});
+        }
+        return chrom.fitness;
+    };
+    auto invalidResult = [&] {
+        failAllCases();
+        chrom.fitness = std::numeric_limits<uint64_t>::max();
+        chrom.numErrors = std::numeric_limits<uint64_t>::max();
+        chrom.stackSize = 0;
+        return cacheResult();
+    };
+    auto isError = [&](size_t index, i32 result) {
+        auto &dataPoint = dataPoints[index];
+        return result < dataPoint.dp.expectedOutput || result > dataPoint.upperBound;
+    };
+
+    formula.Compile(ops);
+    if (!formula.Profile().CanSucceed(0)) {
+        // Underflows or leaves an empty stack on every data point
+        return invalidResult();
+    }
+
+    // Bound the errors from the abstract result over the whole test set
+    if (useBoundsPruning) {
+        bounds.Clear();
+        const AbstractStack::State state = bounds.Apply(ops);
+        if (state == AbstractStack::State::Fails) {
+            return invalidResult();
+        }
+        if (state == AbstractStack::State::Valid && bounds.Size() > 0) {
+            const uint64_t minErrors = pruner.MinErrors(bounds.Top());
+            if (minErrors == pruner.TotalWeight()) {
+                // Fails every data point; the evaluation would find nothing more
+                failAllCases();
+                chrom.numErrors = minErrors;
+                chrom.fitness = minErrors;
+                chrom.stackSize = bounds.Size();
+                return cacheResult();
             }
-            if (!gene.op.Execute(ctx)) {
-                valid = false;
-                break;
+            if (minErrors > cutoff) {
+                failAllCases();
+                chrom.numErrors = minErrors;
+                chrom.fitness = minErrors;
+                chrom.worseThanCutoff = true;
+                return chrom.fitness;
             }
         }
+    }
+
+    // Evaluate the most discriminating data points one at a time, bailing out once the cutoff is exceeded. With a
+    // batch evaluator, this screens out most losing chromosomes before paying for the batch compilation.
+    size_t numScreened = dataPoints.size();
+    if (evaluator != FitnessEvaluator::Compiled) {
+        numScreened = cutoff != std::numeric_limits<uint64_t>::max() ? std::min(kScreeningSize, numScreened) : 0;
+    }
+    for (size_t i = 0; i < numScreened; i++) {
+        const size_t index = evalOrder[i];
+        ctx.stack.clear();
+        const bool valid = formula.Execute(dataPoints[index].features, ctx.stack);
         if (!valid || ctx.stack.empty()) {
-            chrom.fitness = std::numeric_limits<uint64_t>::max();
-            chrom.numErrors = std::numeric_limits<uint64_t>::max();
-            chrom.stackSize = 0;
-            return chrom.fitness;
+            return invalidResult();
         }
-        i32 result = ctx.stack.back();
-        /*result &= 1023;
-        if (!dataPoint.left) {
-            result ^= 1023;
-        }*/
+        chrom.stackSize = ctx.stack.size();
 
-        if (result < dataPoint.dp.expectedOutput) {
-            // chrom.fitness += ((i64)dataPoint.dp.expectedOutput - result) * dataPoint.errorWeight;
-            chrom.numErrors += dataPoint.errorWeight;
-        } else if (result > dataPoint.upperBound) {
-            // chrom.fitness += ((i64)result - dataPoint.upperBound) * dataPoint.errorWeight;
-            chrom.numErrors += dataPoint.errorWeight;
+        if (isError(index, ctx.stack.back())) {
+            chrom.numErrors += dataPoints[index].errorWeight;
+            ++failCounts[index];
+            markCase(index);
+            if (chrom.numErrors > cutoff) {
+                failAllCases();
+                chrom.fitness = chrom.numErrors;
+                chrom.worseThanCutoff = true;
+                return chrom.fitness;
+            }
+        }
+    }
+
+    if (evaluator != FitnessEvaluator::Compiled) {
+        // Evaluate the whole test set in one go
+        results.resize(testSet.batch.Size());
+        bool valid;
+        if (evaluator == FitnessEvaluator::JIT) {
+            jit.Compile(ops);
+            valid = jit.Evaluate(testSet.batch, results, chrom.stackSize);
+        } else if (evaluator == FitnessEvaluator::IR && ir.Build(ops)) {
+            valid = ir.Evaluate(testSet.batch, results, chrom.stackSize);
+        } else {
+            columns.Compile(ops);
+            valid = columns.Evaluate(testSet.batch, results, chrom.stackSize);
+        }
+        if (!valid) {
+            return invalidResult();
+        }
+        for (size_t i = numScreened; i < dataPoints.size(); i++) {
+            const size_t index = evalOrder[i];
+            if (isError(index, results[index])) {
+                chrom.numErrors += dataPoints[index].errorWeight;
+                ++failCounts[index];
+                markCase(index);
+            }
         }
-        /*if (result < dataPoint.dp.expectedOutput || result > dataPoint.upperBound) {
-            ++chrom.fitness;
-        }*/
     }
+
     // chrom.fitness *= chrom.numErrors;
     chrom.fitness = chrom.numErrors;
-    chrom.stackSize = ctx.stack.size();
-
-    // TODO: evaluate against intelligently selected items from the data set
-    // - intelligently select entries for the test set
-    //   - start with a hand-crafted set that includes the most important corner cases, quirks and glitches
-    //     - these should remain fixed in the test set
-    //     - 186x185 most importantly
-    //   - once the fitness function reaches zero, validate function against entire data set
-    //     - add all (or maybe a subset) of failed slopes to check further
-    //     - include a generation cutoff on test entries after which they are removed from the test set
-    //       - this is set to the current generation + some number of generations
-    //       - the intention is to remove entries that haven't failed in a while for performance
-    return chrom.fitness;
+
+    return cacheResult();
+}
+
+void GAFuncSearch::WorkerState::ReorderDataPoints(size_t numDataPoints) {
+    evalsSinceReorder = 0;
+    if (evalOrder.size() != numDataPoints) {
+        evalOrder.resize(numDataPoints);
+        std::iota(evalOrder.begin(), evalOrder.end(), 0);
+        failCounts.assign(numDataPoints, 0);
+        return;
+    }
+    std::stable_sort(evalOrder.begin(), evalOrder.end(),
+                     [&](uint32_t lhs, uint32_t rhs) { return failCounts[lhs] > failCounts[rhs]; });
+    // Halve the counts so that the order follows the current population rather than the whole history
+    for (auto &count : failCounts) {
+        count /= 2;
+    }
+}
+
+// --- Migration ------------------------------------------------------------------------------------------------------
+
+// Chromosomes are copied as they're packed in memory, after a header whose stack size word holds the flags in its
+// upper half
+constexpr u64 kWorseThanCutoff = 1ull << 32;
+
+GAFuncSearch::MigrationSlot::MigrationSlot(size_t numMigrants, size_t numOps)
+    : m_numMigrants(numMigrants)
+    , m_numOps(numOps)
+    , m_buffer(numMigrants * ChromosomeWords(numOps))
+    , m_publishWords(numMigrants * ChromosomeWords(numOps)) {}
+
+void GAFuncSearch::MigrationSlot::Publish(std::span<const Chromosome> chroms) {
+    const Chromosome empty;
+    for (size_t m = 0; m < m_numMigrants; m++) {
+        Pack(m < chroms.size() ? chroms[m] : empty, &m_publishWords[m * ChromosomeWords()]);
+    }
+    m_buffer.Write(m_publishWords);
+}
+
+void GAFuncSearch::MigrationSlot::Publish(std::span<const Chromosome> population, std::span<const uint32_t> order) {
+    const Chromosome empty;
+    for (size_t m = 0; m < m_numMigrants; m++) {
+        Pack(m < order.size() ? population[order[m]] : empty, &m_publishWords[m * ChromosomeWords()]);
+    }
+    m_buffer.Write(m_publishWords);
+}
+
+bool GAFuncSearch::MigrationSlot::TryRead(std::span<Chromosome> chroms, std::vector<u64> &words) const {
+    const size_t count = std::min(chroms.size(), m_numMigrants);
+    words.resize(count * ChromosomeWords());
+    if (!m_buffer.TryRead(words)) {
+        return false;
+    }
+    for (size_t m = 0; m < count; m++) {
+        Unpack(std::span{words}.subspan(m * ChromosomeWords(), ChromosomeWords()), chroms[m]);
+    }
+    return true;
+}
+
+void GAFuncSearch::MigrationSlot::Read(std::span<Chromosome> chroms) const {
+    std::vector<u64> words;
+    while (!TryRead(chroms, words)) {
+        std::this_thread::yield();
+    }
+}
+
+void GAFuncSearch::MigrationSlot::Pack(const Chromosome &chrom, u64 *words) const {
+    words[0] = chrom.fitness;
+    words[1] = chrom.numErrors;
+    words[2] = chrom.generation;
+    words[3] = (u32)chrom.stackSize | (chrom.worseThanCutoff ? kWorseThanCutoff : 0);
+    u64 *geneWords = words + kHeaderWords;
+    u64 *maskWords = geneWords + (m_numOps + 7) / 8;
+    std::fill(geneWords, maskWords + Chromosome::MaskWords(m_numOps), 0);
+    if (chrom.genes.size() == m_numOps) {
+        std::memcpy(geneWords, chrom.genes.data(), m_numOps);
+        std::copy(chrom.enabled.begin(), chrom.enabled.end(), maskWords);
+    }
+}
+
+void GAFuncSearch::MigrationSlot::Unpack(std::span<const u64> words, Chromosome &chrom) const {
+    chrom.fitness = words[0];
+    chrom.numErrors = words[1];
+    chrom.generation = words[2];
+    chrom.stackSize = (u32)words[3];
+    chrom.worseThanCutoff = (words[3] & kWorseThanCutoff) != 0;
+    chrom.Resize(m_numOps);
+    const u64 *geneWords = &words[kHeaderWords];
+    const u64 *maskWords = geneWords + (m_numOps + 7) / 8;
+    std::memcpy(chrom.genes.data(), geneWords, m_numOps);
+    std::copy_n(maskWords, chrom.enabled.size(), chrom.enabled.begin());
+}
+
+void GAFuncSearch::ClearMigrationSlots() {
+    for (auto &slot : m_migrationSlots) {
+        slot->Publish({});
+    }
+}
+
+size_t GAFuncSearch::Immigrate(size_t workerId) {
+    auto &state = *m_workerStates[workerId];
+    size_t rank = state.crossoverStart;
+    if (state.generation % m_config.migrationInterval != 0) {
+        return rank;
+    }
+
+    std::span<const size_t> sources = m_migrationSources[workerId];
+    if (m_config.topology == MigrationTopology::Random) {
+        // Partial Fisher-Yates shuffle of the other islands
+        auto &picked = state.migrationSources;
+        picked.clear();
+        for (size_t i = 0; i < m_migrationSlots.size(); i++) {
+            if (i != workerId) {
+                picked.push_back(i);
+            }
+        }
+        const size_t count = std::min(m_config.randomNeighbors, picked.size());
+        for (size_t i = 0; i < count; i++) {
+            std::swap(picked[i], picked[state.randomEngine.Range(i, picked.size() - 1)]);
+        }
+        picked.resize(count);
+        sources = picked;
+    }
+
+    for (size_t source : sources) {
+        const size_t count = std::min(m_migrationSlots[source]->NumMigrants(), state.order.size() - rank);
+        if (count == 0) {
+            break;
+        }
+        // Migrants that are being published right now are simply skipped this time
+        state.immigrants.resize(count);
+        if (m_migrationSlots[source]->TryRead(state.immigrants, state.migrationWords)) {
+            for (auto &chrom : state.immigrants) {
+                std::swap(state.population[state.order[rank++]], chrom);
+            }
+        }
+    }
+
+    // Migrants from other searches are taken in once per batch
+    const uint64_t batch = m_externalBatch.load(std::memory_order_acquire);
+    const size_t count = std::min(m_externalSlot.NumMigrants(), state.order.size() - rank);
+    if (batch != state.externalBatch && count > 0) {
+        state.immigrants.resize(count);
+        if (m_externalSlot.TryRead(state.immigrants, state.migrationWords)) {
+            for (auto &chrom : state.immigrants) {
+                // Batches with fewer chromosomes are padded with empty ones
+                if (chrom.fitness != std::numeric_limits<uint64_t>::max()) {
+                    std::swap(state.population[state.order[rank++]], chrom);
+                }
+            }
+            state.externalBatch = batch;
+        }
+    }
+    return rank;
+}
+
+std::vector<GAFuncSearch::Chromosome> GAFuncSearch::BestChromosomes(size_t count) const {
+    std::vector<Chromosome> best;
+    std::vector<Chromosome> migrants;
+    for (auto &slot : m_migrationSlots) {
+        migrants.resize(slot->NumMigrants());
+        slot->Read(migrants);
+        for (auto &chrom : migrants) {
+            if (chrom.fitness != std::numeric_limits<uint64_t>::max()) {
+                best.push_back(std::move(chrom));
+            }
+        }
+    }
+    count = std::min(count, best.size());
+    std::partial_sort(best.begin(), best.begin() + count, best.end());
+    best.resize(count);
+    return best;
+}
+
+void GAFuncSearch::ImportMigrants(std::span<const Chromosome> migrants) {
+    std::vector<Chromosome> sorted;
+    for (auto &chrom : migrants) {
+        if (chrom.genes.size() == m_config.numOps && chrom.enabled.size() == Chromosome::MaskWords(m_config.numOps)) {
+            sorted.push_back(chrom);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    m_externalSlot.Publish(sorted);
+    m_externalBatch.fetch_add(1, std::memory_order_release);
+}
+
+GAFuncSearch::DiversityStats GAFuncSearch::Diversity() const {
+    DiversityStats stats{};
+    for (auto &state : m_workerStates) {
+        stats.numElites += state->measuredElites.load(std::memory_order_relaxed);
+        stats.numDistinctElites += state->distinctElites.load(std::memory_order_relaxed);
+        stats.eliteDistanceSum += state->eliteDistanceSum.load(std::memory_order_relaxed);
+        stats.cleared += state->numCleared.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+// --- Checkpoints ----------------------------------------------------------------------------------------------------
+
+void GAFuncSearch::TakeCheckpoint(Checkpoint &checkpoint) {
+    std::scoped_lock checkpointLock{m_checkpointMutex};
+    checkpoint.config = m_config;
+    checkpoint.config.pinWorkers = false;
+    checkpoint.templateOps = m_templateOps;
+    checkpoint.islands.assign(m_workerStates.size(), {});
+
+    {
+        // Have every running worker copy its island at the end of its current generation
+        std::unique_lock lk{m_snapshotMutex};
+        for (auto &state : m_workerStates) {
+            state->snapshotTaken = false;
+        }
+        m_snapshot = &checkpoint;
+        m_snapshotPending = m_workerStates.size();
+        m_snapshotRequested = true;
+        m_snapshotCond.wait(lk, [&] { return m_snapshotPending == 0 || m_activeWorkers == 0; });
+        m_snapshotRequested = false;
+        m_snapshot = nullptr;
+
+        // Islands left behind by workers that have exited, or were never started, are no longer changing
+        for (size_t i = 0; i < m_workerStates.size(); i++) {
+            if (!m_workerStates[i]->snapshotTaken) {
+                SnapshotIsland(i, checkpoint.islands[i]);
+            }
+        }
+    }
+
+    checkpoint.generation = m_generation;
+    checkpoint.resetCount = m_resetCount;
+    std::scoped_lock lk{m_bestChromHistoryMutex};
+    checkpoint.bestChromHistory = m_bestChromHistory;
+}
+
+void GAFuncSearch::StartCheckpointing(std::filesystem::path path, std::chrono::seconds interval) {
+    if (m_checkpointer.joinable()) {
+        m_checkpointer.request_stop();
+        m_checkpointer.join();
+    }
+    m_checkpointer = std::jthread{[this, path = std::move(path), interval](std::stop_token stopToken) {
+        std::mutex mutex;
+        std::condition_variable_any cond;
+        std::unique_lock lk{mutex};
+        while (!cond.wait_for(lk, stopToken, interval, [] { return false; }) && !stopToken.stop_requested()) {
+            SaveCheckpoint(path);
+        }
+        SaveCheckpoint(path);
+    }};
+}
+
+void GAFuncSearch::ContributeSnapshot(size_t workerId) {
+    std::scoped_lock lk{m_snapshotMutex};
+    auto &state = *m_workerStates[workerId];
+    if (m_snapshot == nullptr || state.snapshotTaken) {
+        return;
+    }
+    SnapshotIsland(workerId, m_snapshot->islands[workerId]);
+    state.snapshotTaken = true;
+    if (--m_snapshotPending == 0) {
+        m_snapshotCond.notify_all();
+    }
+}
+
+void GAFuncSearch::SnapshotIsland(size_t workerId, Checkpoint::Island &island) {
+    auto &state = *m_workerStates[workerId];
+    island.reset = state.reset;
+
+    std::ostringstream engine;
+    engine << state.randomEngine;
+    island.randomEngine = engine.str();
+
+    island.parameters.clear();
+    for (float *param : state.Parameters()) {
+        island.parameters.push_back(*param);
+    }
+
+    island.generation = state.generation;
+    island.population = state.population;
+    island.migrants.resize(m_config.numMigrants);
+    m_migrationSlots[workerId]->Read(island.migrants);
+}
+
+void GAFuncSearch::RestoreIsland(size_t workerId, const Checkpoint::Island &island) {
+    auto &state = *m_workerStates[workerId];
+    state.reset = island.reset;
+
+    std::istringstream engine{island.randomEngine};
+    engine >> state.randomEngine;
+
+    auto params = state.Parameters();
+    for (size_t i = 0; i < std::min(params.size(), island.parameters.size()); i++) {
+        *params[i] = island.parameters[i];
+    }
+    state.ComputeParameters();
+
+    state.generation = island.generation;
+    state.population = island.population;
+    RankIsland(workerId);
+    m_migrationSlots[workerId]->Publish(island.migrants);
+}
+
+bool GAFuncSearch::Checkpoint::Save(const std::filesystem::path &path) const {
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+    {
+        std::ofstream out{tempPath, std::ios::binary | std::ios::trunc};
+        if (!out) {
+            return false;
+        }
+
+        out.write(kCheckpointMagic, sizeof(kCheckpointMagic));
+        write(out, kCheckpointVersion);
+        write(out, (u32)config.numWorkers);
+        write(out, (u32)config.popSize);
+        write(out, (u32)config.numOps);
+        write(out, (u8)config.topology);
+        write(out, (u32)config.migrationInterval);
+        write(out, (u32)config.numMigrants);
+        write(out, (u32)config.randomNeighbors);
+        write(out, (u8)config.selection);
+        write(out, (u32)config.tournamentSize);
+        write(out, (u8)config.niching);
+        write(out, (u32)config.nicheRadius);
+        write(out, (u32)config.nicheCapacity);
+        write(out, generation);
+        write(out, resetCount);
+        if (templateOps.size() > kMaxTemplateOps) {
+            return false;
+        }
+        writeOperations(out, templateOps);
+
+        auto writeChromosomes = [&](std::span<const Chromosome> chroms) {
+            for (auto &chrom : chroms) {
+                if (chrom.genes.size() != config.numOps ||
+                    chrom.enabled.size() != Chromosome::MaskWords(config.numOps)) {
+                    return false;
+                }
+                writeChromosome(out, chrom);
+            }
+            return true;
+        };
+
+        if (islands.size() != config.numWorkers) {
+            return false;
+        }
+        for (auto &island : islands) {
+            if (island.population.size() != config.popSize) {
+                return false;
+            }
+            write(out, (u8)island.reset);
+            writeString(out, island.randomEngine);
+            write(out, (u32)island.parameters.size());
+            out.write((const char *)island.parameters.data(), island.parameters.size() * sizeof(float));
+            write(out, island.generation);
+            write(out, (u32)island.migrants.size());
+            if (!writeChromosomes(island.population) || !writeChromosomes(island.migrants)) {
+                return false;
+            }
+        }
+
+        write(out, (u32)bestChromHistory.size());
+        if (!writeChromosomes(bestChromHistory)) {
+            return false;
+        }
+        if (!out.flush()) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    return !error;
+}
+
+bool GAFuncSearch::Checkpoint::Load(const std::filesystem::path &path) {
+    std::ifstream in{path, std::ios::binary};
+    if (!in) {
+        return false;
+    }
+
+    char magic[sizeof(kCheckpointMagic)];
+    u32 version, numWorkers, popSize, numOps, migrationInterval, numMigrants, randomNeighbors, tournamentSize;
+    u32 nicheRadius, nicheCapacity;
+    u8 topology, selection, niching;
+    in.read(magic, sizeof(magic));
+    if (!in || memcmp(magic, kCheckpointMagic, sizeof(kCheckpointMagic)) != 0 || !read(in, version) ||
+        version != kCheckpointVersion) {
+        return false;
+    }
+    if (!read(in, numWorkers) || !read(in, popSize) || !read(in, numOps) || !read(in, topology) ||
+        !read(in, migrationInterval) || !read(in, numMigrants) || !read(in, randomNeighbors) || !read(in, selection) ||
+        !read(in, tournamentSize) || !read(in, niching) || !read(in, nicheRadius) || !read(in, nicheCapacity)) {
+        return false;
+    }
+    if (numWorkers == 0 || numWorkers > kMaxCheckpointWorkers || popSize == 0 || popSize > kMaxCheckpointPopSize ||
+        numOps == 0 || numOps > kMaxCheckpointNumOps || topology > (u8)MigrationTopology::Hub ||
+        selection > (u8)SelectionMethod::Lexicase || niching > (u8)NichingMethod::Clearing) {
+        return false;
+    }
+
+    Checkpoint checkpoint;
+    checkpoint.config.numWorkers = numWorkers;
+    checkpoint.config.popSize = popSize;
+    checkpoint.config.numOps = numOps;
+    checkpoint.config.topology = (MigrationTopology)topology;
+    checkpoint.config.migrationInterval = migrationInterval;
+    checkpoint.config.numMigrants = numMigrants;
+    checkpoint.config.randomNeighbors = randomNeighbors;
+    checkpoint.config.selection = (SelectionMethod)selection;
+    checkpoint.config.tournamentSize = tournamentSize;
+    checkpoint.config.niching = (NichingMethod)niching;
+    checkpoint.config.nicheRadius = nicheRadius;
+    checkpoint.config.nicheCapacity = nicheCapacity;
+    if (!read(in, checkpoint.generation) || !read(in, checkpoint.resetCount) ||
+        !readOperations(in, checkpoint.templateOps)) {
+        return false;
+    }
+
+    checkpoint.islands.resize(numWorkers);
+    for (auto &island : checkpoint.islands) {
+        u8 reset;
+        u32 numParameters, numMigrants;
+        if (!read(in, reset) || !readString(in, island.randomEngine) || !read(in, numParameters) ||
+            numParameters > kMaxCheckpointString) {
+            return false;
+        }
+        island.reset = reset != 0;
+        island.parameters.resize(numParameters);
+        in.read((char *)island.parameters.data(), numParameters * sizeof(float));
+        if (!read(in, island.generation) || !read(in, numMigrants) || numMigrants > popSize) {
+            return false;
+        }
+
+        island.population.resize(popSize);
+        for (auto &chrom : island.population) {
+            if (!readChromosome(in, chrom, numOps, checkpoint.templateOps.size())) {
+                return false;
+            }
+        }
+        island.migrants.resize(numMigrants);
+        for (auto &chrom : island.migrants) {
+            if (!readChromosome(in, chrom, numOps, checkpoint.templateOps.size())) {
+                return false;
+            }
+        }
+    }
+
+    u32 numHistory;
+    if (!read(in, numHistory) || numHistory > kMaxCheckpointPopSize) {
+        return false;
+    }
+    checkpoint.bestChromHistory.resize(numHistory);
+    for (auto &chrom : checkpoint.bestChromHistory) {
+        if (!readChromosome(in, chrom, numOps, checkpoint.templateOps.size())) {
+            return false;
+        }
+    }
+
+    *this = std::move(checkpoint);
+    return true;
 }
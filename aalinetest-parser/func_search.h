@@ -1,44 +1,132 @@
 #pragma once
 
+#include "active_test_set.h"
 #include "dataset.h"
+#include "fast_rng.h"
+#include "fitness_cache.h"
+#include "formula_batch.h"
+#include "formula_bounds.h"
+#include "formula_columns.h"
+#include "formula_ir.h"
+#include "formula_jit.h"
 #include "func.h"
+#include "seqlock.h"
 
 #include <atomic>
 #include <barrier>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <numeric>
 #include <random>
 #include <semaphore>
+#include <string>
 #include <thread>
 #include <vector>
 
-struct ExtDataPoint {
-    DataPoint dp;
-    i32 upperBound;
-    bool left;
-    bool positive;
-    i32 errorWeight = 1;
-    Slope slope;
-};
-
 // A specialized genetic algorithm for searching functions
 class GAFuncSearch {
 public:
-    static constexpr size_t kNumOps = 64;
-    static constexpr size_t kPopSize = 320;
-    static constexpr size_t kWorkers = 6;
+    static constexpr size_t kFitnessCacheSize = 1 << 19;
+
+    // Islands each island receives migrants from
+    enum class MigrationTopology : u8 {
+        AllToAll, // every other island
+        Ring,     // the previous island
+        Torus,    // the four neighbors on a wrapping 2D grid, as close to square as the worker count allows
+        Random,   // randomNeighbors islands picked anew on every migration
+        Hub,      // island 0 receives from every island, and every other island receives from island 0
+    };
+
+    // How parents are picked for crossover among the elites and the new random chromosomes of an island
+    enum class SelectionMethod : u8 {
+        Truncation, // uniformly
+        Tournament, // the best of tournamentSize chromosomes picked uniformly
+        Lexicase,   // the survivors of filtering on the test data points one at a time, in random order
+    };
+
+    // How an island keeps its elites from converging on a single formula. Formulas are compared by the edit distance
+    // between the sequences of their enabled genes; a niche holds the formulas within nicheRadius edits of its best.
+    enum class NichingMethod : u8 {
+        None,     // the best chromosomes, however alike
+        Clearing, // the best chromosomes, up to nicheCapacity per niche; new random chromosomes take the other slots
+    };
 
+    // Size of the search and island model, fixed for the lifetime of the object
+    struct Config {
+        size_t numWorkers = DefaultNumWorkers(); // One island per worker thread
+        size_t popSize = 320;                    // Chromosomes per island
+        size_t numOps = 64;                      // Genes per chromosome
+        bool pinWorkers = false;                 // Keeps each worker thread on its own logical processor
+
+        MigrationTopology topology = MigrationTopology::AllToAll;
+        size_t migrationInterval = 1; // Island generations between migrations
+        size_t numMigrants = 1;       // Best chromosomes sent to each receiving island per migration
+        size_t randomNeighbors = 2;   // Islands to receive from with MigrationTopology::Random
+
+        SelectionMethod selection = SelectionMethod::Truncation;
+        size_t tournamentSize = 4; // Chromosomes per tournament with SelectionMethod::Tournament
+
+        NichingMethod niching = NichingMethod::None;
+        size_t nicheRadius = 2;   // Most edits between formulas of the same niche
+        size_t nicheCapacity = 1; // Elites per niche
+
+        ActiveTestSet::Config testSet;
+
+        // One worker per logical processor
+        static size_t DefaultNumWorkers() {
+            return std::max(1u, std::thread::hardware_concurrency());
+        }
+    };
+
+    enum class FitnessEvaluator {
+        Compiled, // CompiledFormula, one data point at a time
+        Columns,  // ColumnInterpreter over the whole active test set
+        JIT,      // FormulaJIT over the whole active test set
+        IR,       // FormulaIR over the whole active test set, falling back to Columns if the IR can't represent it
+    };
+
+    // Diversity of the elites of every island, measured every kDiversityInterval island generations
+    struct DiversityStats {
+        size_t numElites;
+        size_t numDistinctElites;  // Elites whose formula no better elite of their island shares
+        uint64_t eliteDistanceSum; // Edit distances between each elite and the best chromosome of its island
+        uint64_t cleared;          // Chromosomes kept out of the elites by niching since the search started
+
+        double DistinctRate() const {
+            return numElites > 0 ? (double)numDistinctElites / numElites : 0.0;
+        }
+
+        double MeanEliteDistance() const {
+            return numElites > 0 ? (double)eliteDistanceSum / numElites : 0.0;
+        }
+    };
+
+    static constexpr size_t kDiversityInterval = 64;
+
+    // Template operations a chromosome can refer to, so that a gene fits in a byte
+    static constexpr size_t kMaxTemplateOps = 256;
+
+    // Decoded gene, for display
     struct Gene {
         Operation op;
         bool enabled = false;
     };
 
+    // Genes are packed as indices into the template operations along with a mask of the enabled genes, so that the
+    // default 64-gene chromosome takes 72 bytes of gene data and a whole island stays in cache. Mutation and crossover
+    // work on the packed genes directly; they're only decoded for evaluation and display.
     struct Chromosome {
-        std::array<Gene, kNumOps> genes;
+        std::vector<u8> genes;    // Index of the template operation of each gene; meaningless while disabled
+        std::vector<u64> enabled; // One bit per gene; bits past the last gene are always clear
         uint64_t fitness = std::numeric_limits<uint64_t>::max();
         uint64_t numErrors = 0;
         size_t stackSize = 0;
-        uint64_t generation;
+        uint64_t generation = 0;
+        bool worseThanCutoff = false; // Evaluation stopped early; fitness and numErrors are lower bounds
 
         bool operator<(const Chromosome &rhs) const {
             if (fitness < rhs.fitness) {
@@ -55,44 +143,180 @@ public:
             }
             return stackSize < rhs.stackSize;
         }
+
+        static size_t MaskWords(size_t numGenes) {
+            return (numGenes + 63) / 64;
+        }
+
+        void Resize(size_t numGenes) {
+            genes.resize(numGenes);
+            enabled.resize(MaskWords(numGenes));
+        }
+
+        bool IsEnabled(size_t index) const {
+            return (enabled[index / 64] >> (index % 64)) & 1;
+        }
+
+        void SetEnabled(size_t index, bool enable) {
+            const u64 bit = 1ull << (index % 64);
+            if (enable) {
+                enabled[index / 64] |= bit;
+            } else {
+                enabled[index / 64] &= ~bit;
+            }
+        }
+
+        void SwapGenes(size_t lhs, size_t rhs) {
+            std::swap(genes[lhs], genes[rhs]);
+            const bool lhsEnabled = IsEnabled(lhs);
+            SetEnabled(lhs, IsEnabled(rhs));
+            SetEnabled(rhs, lhsEnabled);
+        }
+    };
+
+    // Snapshot of the whole search state, taken at generation boundaries.
+    //
+    // Test data points and evaluation settings are not part of the checkpoint; a resumed search must be given the same
+    // ones before it is started. The active test set starts over from the fixed data points.
+    struct Checkpoint {
+        struct Island {
+            bool reset = true;
+            std::string randomEngine;      // Textual state of the worker's random engine
+            std::vector<float> parameters; // Selection, mutation and gene parameters
+            uint64_t generation = 0;       // Generations run by the island
+            std::vector<Chromosome> population;
+            std::vector<Chromosome> migrants; // Best chromosomes published to the other islands
+        };
+
+        Config config;                      // pinWorkers is not saved
+        std::vector<Operation> templateOps; // Decodes the genes of every chromosome
+        uint64_t generation = 0;
+        uint64_t resetCount = 0;
+        std::vector<Island> islands;
+        std::vector<Chromosome> bestChromHistory;
+
+        // Writes the checkpoint to a temporary file and moves it over path, so that an interrupted save never
+        // destroys the previous checkpoint
+        bool Save(const std::filesystem::path &path) const;
+        bool Load(const std::filesystem::path &path);
     };
 
     GAFuncSearch(std::filesystem::path root);
+    GAFuncSearch(std::filesystem::path root, const Config &config);
+    // Resumes a search from a checkpoint, using its config
+    GAFuncSearch(std::filesystem::path root, const Checkpoint &checkpoint);
     ~GAFuncSearch();
 
+    // Launches the workers. Set the template operations and fixed data points first.
+    void Start();
+
     void SetResetCallback(std::function<void()> callback) {
         m_onResetCallback = callback;
     }
 
-    void SetTemplateOps(const std::vector<Operation> &templateOps) {
-        m_templateOps = templateOps;
+    // Sets the operations genes are picked from; only the first kMaxTemplateOps are used. Chromosomes created with a
+    // different table, such as those of a resumed search, are translated to the new one, and their genes whose
+    // operation is missing from it are disabled. Call before Start.
+    void SetTemplateOps(const std::vector<Operation> &templateOps);
+
+    const std::vector<Operation> &TemplateOps() const {
+        return m_templateOps;
     }
 
+    // Decodes the genes of a chromosome
+    std::vector<Gene> Genes(const Chromosome &chrom) const;
+
+    // Sets the data points every chromosome is evaluated on
     void SetFixedDataPoints(const std::vector<ExtDataPoint> &fixedDataPoints) {
-        m_fixedDataPoints = fixedDataPoints;
-        for (auto &dp : m_fixedDataPoints) {
-            if (dp.positive) {
-                dp.slope.Setup(0, 0, dp.dp.width, dp.dp.height, dp.left);
-            } else {
-                dp.slope.Setup(255, 0, 255 - dp.dp.width, dp.dp.height, dp.left);
-            }
+        m_testSet.SetFixedDataPoints(fixedDataPoints);
+        m_fitnessCache.Clear();
+    }
+
+    // Sets the data points formulas that pass the active test set are validated against. The data points they fail
+    // join the active test set, and the search only stops once a formula passes all of them.
+    void SetValidationDataPoints(const std::vector<ExtDataPoint> &validationDataPoints) {
+        m_testSet.SetValidationDataPoints(validationDataPoints);
+    }
+
+    void SetValidationDataSet(const DataSet &dataSet) {
+        m_testSet.SetValidationDataSet(dataSet);
+    }
+
+    // Selects the formula evaluator used by fitness evaluation.
+    // jitMode applies to FitnessEvaluator::JIT; SelfCheck verifies every native result against the interpreter.
+    void SetFitnessEvaluator(FitnessEvaluator evaluator, FormulaJIT::Mode jitMode = FormulaJIT::Mode::Native) {
+        m_jitMode = jitMode;
+        m_evaluator = evaluator;
+    }
+
+    // Enables or disables the cache of fitness results shared by all workers
+    void SetUseFitnessCache(bool enable) {
+        m_useFitnessCache = enable;
+    }
+
+    // Enables or disables early exit from fitness evaluation. When enabled, each worker stops evaluating a chromosome
+    // as soon as it has more errors than the worst elite of its population.
+    void SetUseEarlyExit(bool enable) {
+        m_useEarlyExit = enable;
+    }
+
+    // Enables or disables bounds pruning. When enabled, formulas are first run on abstract values covering the whole
+    // active test set, and those proven to fail every data point or to exceed the cutoff are never evaluated.
+    void SetUseBoundsPruning(bool enable) {
+        for (auto &state : m_workerStates) {
+            state->useBoundsPruning = enable;
         }
     }
 
+    const Config &GetConfig() const {
+        return m_config;
+    }
+
+    FitnessCache::Stats FitnessCacheStats() const {
+        return m_fitnessCache.GetStats();
+    }
+
+    ActiveTestSet::Stats TestSetStats() const {
+        return m_testSet.GetStats();
+    }
+
+    // Safe to call from any thread
+    DiversityStats Diversity() const;
+
+    // Determines if a formula passed the fixed and validation data points, and retrieves it
+    bool IsSolved() const {
+        return m_testSet.IsSolved();
+    }
+
+    std::vector<Operation> Solution() const {
+        return m_testSet.Solution();
+    }
+
     uint64_t CurrGeneration() const {
         return m_generation;
     }
 
-    const Chromosome &BestChromosome() const {
-        const Chromosome *best = nullptr;
-        for (auto &state : m_sharedStates) {
-            if (best == nullptr || state.population[!state.popBufferFlip].fitness < best->fitness) {
-                best = &state.population[!state.popBufferFlip];
+    // Best of the chromosomes last published by the islands. Safe to call from any thread.
+    Chromosome BestChromosome() const {
+        Chromosome best;
+        Chromosome chrom;
+        for (size_t i = 0; i < m_migrationSlots.size(); i++) {
+            m_migrationSlots[i]->Read({&chrom, 1});
+            if (i == 0 || chrom.fitness < best.fitness) {
+                best = chrom;
             }
         }
-        return *best;
+        return best;
     }
 
+    // Best count chromosomes among those last published by the islands. Safe to call from any thread.
+    std::vector<Chromosome> BestChromosomes(size_t count) const;
+
+    // Hands chromosomes from another search over to every island, which take them in at their next migration along
+    // with their regular migrants. Up to numMigrants chromosomes are kept, best first. Only one thread may call this at
+    // a time; it never waits for the workers.
+    void ImportMigrants(std::span<const Chromosome> migrants);
+
     std::vector<Chromosome> BestChromosomesHistory() const {
         std::scoped_lock lk{m_bestChromHistoryMutex};
         return m_bestChromHistory;
@@ -102,35 +326,102 @@ public:
         return m_resetCount;
     }
 
-    void Stop() {
-        m_running = false;
-        for (auto &worker : m_workers) {
-            worker.join();
-        }
+    void Stop();
+
+    // Takes a snapshot of every island at its next generation boundary. Each worker only pauses to copy its own
+    // state. Can be called from any thread, while the search is running or after it stopped.
+    void TakeCheckpoint(Checkpoint &checkpoint);
+
+    bool SaveCheckpoint(const std::filesystem::path &path) {
+        Checkpoint checkpoint;
+        TakeCheckpoint(checkpoint);
+        return checkpoint.Save(path);
     }
 
-    // TODO: serialize and deserialize state
+    // Saves a checkpoint periodically from a background thread, and once more when the search is stopped
+    void StartCheckpointing(std::filesystem::path path, std::chrono::seconds interval);
 
     // TODO: make GA parameters configurable
 
 private:
-    DataSet m_dataSet;
+    const Config m_config; // Validated
+
     std::vector<Operation> m_templateOps;
-    std::vector<ExtDataPoint> m_fixedDataPoints;
+    ActiveTestSet m_testSet{m_config.testSet};
 
-    std::array<std::jthread, kWorkers> m_workers;
-    bool m_running = true;
+    FitnessEvaluator m_evaluator = FitnessEvaluator::Compiled;
+    FormulaJIT::Mode m_jitMode = FormulaJIT::Mode::Native;
+
+    FitnessCache m_fitnessCache{kFitnessCacheSize};
+    bool m_useFitnessCache = true;
+    bool m_useEarlyExit = true;
+
+    std::vector<std::jthread> m_workers;
+    std::atomic_bool m_running = true;
 
     std::random_device m_rd;
     std::mt19937 m_rng;
 
     void NextGeneration(size_t workerId);
 
-    struct SharedState {
-        std::array<Chromosome, 2> population;
-        bool popBufferFlip = false;
+    static Config Validate(Config config);
+
+    // Channel through which an island publishes its best chromosomes to the other islands.
+    // Written only by the island's worker (or while every worker waits at the reset barrier); read by anyone.
+    class MigrationSlot {
+    public:
+        MigrationSlot(size_t numMigrants, size_t numOps);
+
+        size_t NumMigrants() const {
+            return m_numMigrants;
+        }
+
+        // Publishes the first NumMigrants() chromosomes; missing ones are published empty
+        void Publish(std::span<const Chromosome> chroms);
+
+        // Publishes the chromosomes at the first NumMigrants() indices of order
+        void Publish(std::span<const Chromosome> population, std::span<const uint32_t> order);
+
+        // Reads the latest chromosomes into chroms, unless they're being published right now. Never waits.
+        // Reads up to NumMigrants() chromosomes; words is scratch space owned by the calling thread.
+        bool TryRead(std::span<Chromosome> chroms, std::vector<u64> &words) const;
+
+        // Reads the latest chromosomes, waiting out a concurrent publish
+        void Read(std::span<Chromosome> chroms) const;
+
+    private:
+        static constexpr size_t kHeaderWords = 4; // fitness, numErrors, generation, stackSize and flags
+
+        size_t m_numMigrants;
+        size_t m_numOps;
+        SeqLockBuffer m_buffer;
+        std::vector<u64> m_publishWords; // Scratch space for the writer
+
+        // Header, then the gene bytes, then the enabled mask
+        static size_t ChromosomeWords(size_t numOps) {
+            return kHeaderWords + (numOps + 7) / 8 + Chromosome::MaskWords(numOps);
+        }
+        size_t ChromosomeWords() const {
+            return ChromosomeWords(m_numOps);
+        }
+        void Pack(const Chromosome &chrom, u64 *words) const;
+        void Unpack(std::span<const u64> words, Chromosome &chrom) const;
     };
-    std::array<SharedState, kWorkers> m_sharedStates;
+    std::vector<std::unique_ptr<MigrationSlot>> m_migrationSlots;
+
+    // Islands each island receives migrants from; unused with MigrationTopology::Random
+    std::vector<std::vector<size_t>> m_migrationSources;
+
+    // Migrants from other searches, and the number of batches imported so far
+    MigrationSlot m_externalSlot{m_config.numMigrants, m_config.numOps};
+    std::atomic_uint64_t m_externalBatch{0};
+
+    // Picks the elites of the island with the configured niching method and sorts its best numMigrants chromosomes
+    void RankIsland(size_t workerId);
+
+    // Copies migrants from the source islands into the offspring slots, starting at rank crossoverStart of the order.
+    // Returns the rank past the last migrant.
+    size_t Immigrate(size_t workerId);
     std::atomic_uint64_t m_generation{0};
     std::function<void()> m_onResetCallback = [] {};
 
@@ -144,11 +435,27 @@ private:
 
     uint64_t m_staleGenCount = 5000000;
     uint64_t m_resetCount{0};
-    std::barrier<ResetBarrierCompletionFunction> m_resetBarrier{kWorkers, ResetBarrierCompletionFunction{*this}};
+    std::barrier<ResetBarrierCompletionFunction> m_resetBarrier{(std::ptrdiff_t)m_config.numWorkers,
+                                                                ResetBarrierCompletionFunction{*this}};
 
     std::vector<Chromosome> m_bestChromHistory;
     mutable std::mutex m_bestChromHistoryMutex;
 
+    // Checkpoint in progress; workers copy their island into it at the end of a generation
+    std::mutex m_checkpointMutex; // Serializes TakeCheckpoint calls
+    std::mutex m_snapshotMutex;
+    std::condition_variable m_snapshotCond;
+    std::atomic_bool m_snapshotRequested = false;
+    Checkpoint *m_snapshot = nullptr;
+    size_t m_snapshotPending = 0; // Islands yet to be copied
+    size_t m_activeWorkers = 0;   // Worker threads that haven't exited yet
+
+    std::jthread m_checkpointer;
+
+    void ContributeSnapshot(size_t workerId);
+    void SnapshotIsland(size_t workerId, Checkpoint::Island &island);
+    void RestoreIsland(size_t workerId, const Checkpoint::Island &island);
+
     void Reset() {
         m_resetBarrier.arrive_and_wait();
     }
@@ -159,29 +466,86 @@ private:
         m_generation = 0;
         ++m_resetCount;
         for (auto &state : m_workerStates) {
-            state.reset = true;
+            state->reset = true;
         }
-        m_sharedStates.fill({});
+        ClearMigrationSlots();
         m_onResetCallback();
     }
 
+    // Publishes empty chromosomes on every island
+    void ClearMigrationSlots();
+
     struct WorkerState {
-        WorkerState()
-            : randomEngine{randomDev()}
-            , popDist{0, population.size()} {}
+        WorkerState(size_t popSize, size_t numOps)
+            : randomEngine{((u64)randomDev() << 32) | randomDev()} {
+            population.resize(popSize);
+            for (auto &chrom : population) {
+                chrom.Resize(numOps);
+            }
+            popDist = std::uniform_int_distribution<size_t>{0, population.size()};
+            order.resize(popSize);
+            std::iota(order.begin(), order.end(), 0);
+            ComputeParameters();
+        }
 
         bool reset = true;
-
-        std::array<Chromosome, kPopSize> population;
+        bool snapshotTaken = false; // Island already copied into the checkpoint in progress
+
+        std::vector<Chromosome> population;
+
+        // Population indices by role: the elites, best first, then the slots for new random chromosomes, then the
+        // slots for offspring. Chromosomes stay in place; selection only moves indices.
+        std::vector<uint32_t> order;
+
+        // Test data points failed by each chromosome of the population, one bit per data point, for lexicase selection.
+        // Rows are valid while the chromosome stays in its slot and the test set doesn't change.
+        std::vector<u64> caseErrors;
+        std::vector<u8> caseErrorsValid;
+        size_t numCases = 0;
+        size_t caseWords = 0;
+
+        // Parents for lexicase selection, grouped by the data points they fail, and the data points on which the
+        // groups disagree, visited in random order
+        std::vector<uint32_t> lexicasePool;
+        std::vector<uint32_t> lexicaseGroups; // Start of each group in lexicasePool, followed by the end
+        std::vector<uint32_t> lexicaseCases;
+        std::vector<u64> lexicaseMask;            // Scratch space for finding the data points
+        std::vector<uint32_t> lexicaseCandidates; // Scratch space for picking groups
+        std::vector<uint32_t> lexicaseSurvivors;
 
         Context ctx;
+        std::vector<Operation> ops;
+        CompiledFormula formula;
+        FormulaJIT jit;
+        ColumnInterpreter columns;
+        FormulaIR ir;
+        std::vector<i32> results;
+        std::vector<u64> migrationWords;     // Scratch space for reading migrants
+        std::vector<Chromosome> immigrants;   // Scratch space for reading migrants
+        std::vector<size_t> migrationSources; // Scratch space for picking random source islands
+        std::vector<u64> maskScratch;         // Scratch space for rotating gene masks
+        uint64_t generation = 0;              // Generations run by this island, for migration intervals
+        uint64_t externalBatch = 0;           // Last batch of migrants from other searches taken in
+
+        // Version of the active test set the island evaluates chromosomes on
+        std::shared_ptr<const ActiveTestSet::Version> testSet;
+
+        // Abstract interpretation of formulas over the active test set
+        FormulaPruner pruner;
+        AbstractStack bounds{pruner.Ranges()};
+        bool useBoundsPruning = true;
+
+        // Order in which test data points are evaluated, most discriminating first, and the number of chromosomes that
+        // failed each data point since the last reordering
+        std::vector<uint32_t> evalOrder;
+        std::vector<uint64_t> failCounts;
+        size_t evalsSinceReorder = 0;
 
         // Random number generator
         std::random_device randomDev;
-        std::default_random_engine randomEngine;
-        std::uniform_int_distribution<size_t> intDist;
-        std::uniform_real_distribution<float> pctDist;
+        FastRng randomEngine;
         std::uniform_int_distribution<size_t> popDist;
+        std::vector<u64> randomBits; // Batch of random words for generating chromosomes
 
         // Selection parameters
         float eliteSelectionWeight = 1.0f;
@@ -206,16 +570,57 @@ private:
         float randomGenerationPct = randomGenerationWeight * rcpTotalWeights;
         // float crossoverPopPct = crossoverPopWeight * rcpTotalWeights;
 
-        size_t randomGenStart = population.size() * eliteSelectionPct + 0.5f;
-        size_t crossoverStart = population.size() * (eliteSelectionPct + randomGenerationPct) + 0.5f;
+        size_t randomGenStart = 0;
+        size_t crossoverStart = 0;
+        size_t numElites = 0; // Elites kept by the last ranking; up to randomGenStart
+
+        // Scratch space for niching and diversity measurements
+        std::vector<u8> phenotype;           // Enabled genes of the chromosome at hand
+        std::vector<u8> nicheGenes;          // Enabled genes of the best chromosome of each niche
+        std::vector<uint32_t> nicheStarts;   // Start of each niche in nicheGenes, followed by the end
+        std::vector<u64> nicheSignatures;    // Gene signature of the best chromosome of each niche
+        std::vector<uint32_t> nicheSizes;    // Elites in each niche
+        std::vector<uint32_t> cleared;       // Chromosomes kept out of the elites
+        std::vector<u32> editRow;            // Row of the edit distance matrix
+        std::vector<size_t> phenotypeHashes; // Hashes of the enabled genes of the elites
+
+        // Diversity of the elites as of the last measurement, read from any thread
+        std::atomic_uint32_t measuredElites{0};
+        std::atomic_uint32_t distinctElites{0};
+        std::atomic_uint64_t eliteDistanceSum{0};
+        std::atomic_uint64_t numCleared{0};
 
         void ComputeParameters();
 
+        // Tunable parameters, in checkpoint order
+        std::array<float *, 11> Parameters() {
+            return {&eliteSelectionWeight, &randomGenerationWeight, &crossoverPopWeight, &randomMutationChance,
+                    &spliceMutationChance, &reverseMutationChance, &disableMutationChance,
+                    &shiftChromosomeMutationChance, &rotateChromosomeMutationChance, &shiftGenesMutationChance,
+                    &geneEnablePct};
+        }
+
+        // Moves the elites to the front of order, with the best numSorted of them in order
+        void RankPopulation(size_t numSorted);
+
+        // Moves the elites to the front of order, best first, clearing chromosomes from full niches (see
+        // NichingMethod::Clearing). Cleared chromosomes follow the elites.
+        void RankNiches(size_t radius, size_t capacity);
+
+        // Measures the diversity of the elites; call after ranking
+        void MeasureDiversity();
+
+        // Groups the parents for lexicase selection; call once the parents are evaluated
+        void PrepareLexicase();
+
+        // Picks a parent among the first crossoverStart chromosomes of order and returns its population index
+        size_t SelectParent(SelectionMethod method, size_t tournamentSize);
+
         void NewChromosome(Chromosome &chrom, const std::vector<Operation> &templateOps);
-        void OnePointCrossover(Chromosome &chrom, size_t first, size_t last);
-        void RandomCrossover(Chromosome &chrom, size_t first, size_t last);
+        void OnePointCrossover(Chromosome &chrom, const Chromosome &firstParent, const Chromosome &secondParent);
+        void RandomCrossover(Chromosome &chrom, const Chromosome &firstParent, const Chromosome &secondParent);
 
-        void NewGene(Gene &gene, const std::vector<Operation> &templateOps);
+        void NewGene(Chromosome &chrom, size_t index, const std::vector<Operation> &templateOps);
 
         void RandomizeGenes(Chromosome &chrom, const std::vector<Operation> &templateOps);
         void SpliceGenes(Chromosome &chrom);
@@ -225,7 +630,23 @@ private:
         void RotateChromosome(Chromosome &chrom);
         void ShiftGenes(Chromosome &chrom);
 
-        uint64_t EvaluateFitness(Chromosome &chrom, const std::vector<ExtDataPoint> &fixedDataPoints);
+        // Number of data points evaluated one at a time before running a batch evaluator with a cutoff
+        static constexpr size_t kScreeningSize = 16;
+        // Number of evaluations between reorderings of the data points
+        static constexpr size_t kReorderInterval = 4096;
+
+        // Looks up and stores results in the cache, if given.
+        // Stops as soon as the number of errors exceeds cutoff, marking the chromosome as worse than the cutoff.
+        // If caseErrors is given, sets a bit for every data point the formula fails, skipping the cache lookup.
+        // Chromosomes that can't run or exceed the cutoff fail every data point.
+        uint64_t EvaluateFitness(Chromosome &chrom, const std::vector<Operation> &templateOps,
+                                 const ActiveTestSet::Version &testSet, FitnessEvaluator evaluator, FitnessCache *cache,
+                                 uint64_t cutoff = std::numeric_limits<uint64_t>::max(),
+                                 std::span<u64> caseErrors = {});
+
+        // Moves the data points that failed most often to the front of evalOrder and decays the failure counts
+        void ReorderDataPoints(size_t numDataPoints);
     };
-    std::array<WorkerState, kWorkers> m_workerStates;
+    // Heap-allocated so that each worker's state stays in place and away from the others' cache lines
+    std::vector<std::unique_ptr<WorkerState>> m_workerStates;
 };
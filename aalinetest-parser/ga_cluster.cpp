@@ -0,0 +1,670 @@
+#include "ga_cluster.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <random>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr char kProtocolMagic[4] = {'A', 'A', 'G', 'N'};
+constexpr u32 kProtocolVersion = 1;
+
+// How often threads blocked on a connection check whether they should stop
+constexpr auto kPollInterval = 200ms;
+
+enum class MessageType : u8 {
+    Hello,           // Node: magic, protocol version, chromosome size and template operations
+    Welcome,         // Coordinator: node ID
+    Status,          // Node: generation, reset count, best chromosome, and the solution if found
+    Migrants,        // Node, forwarded by the coordinator: best chromosomes
+    History,         // Node: best chromosomes at the resets since the last report
+    FixedDataPoints, // Either: replacement fixed data points, forwarded to every other node
+    Stop,            // Coordinator: a node found a formula that passes validation
+};
+
+// Fields are written in native byte order
+class MessageWriter {
+public:
+    explicit MessageWriter(MessageType type)
+        : m_data{(u8)type} {}
+
+    template <typename T>
+    void Put(const T &value) {
+        PutBytes(&value, sizeof(value));
+    }
+
+    void PutBytes(const void *data, size_t size) {
+        const u8 *bytes = (const u8 *)data;
+        m_data.insert(m_data.end(), bytes, bytes + size);
+    }
+
+    const std::vector<u8> &Data() const {
+        return m_data;
+    }
+
+private:
+    std::vector<u8> m_data;
+};
+
+class MessageReader {
+public:
+    explicit MessageReader(std::span<const u8> data)
+        : m_data(data) {}
+
+    template <typename T>
+    bool Get(T &value) {
+        return GetBytes(&value, sizeof(value));
+    }
+
+    bool GetBytes(void *data, size_t size) {
+        if (size > m_data.size() - m_pos) {
+            return false;
+        }
+        memcpy(data, m_data.data() + m_pos, size);
+        m_pos += size;
+        return true;
+    }
+
+    // Checks a count of items against the bytes left, so that garbage never causes huge allocations
+    bool GetCount(u32 &count, size_t minItemSize) {
+        return Get(count) && (size_t)count * minItemSize <= m_data.size() - m_pos;
+    }
+
+private:
+    std::span<const u8> m_data;
+    size_t m_pos = 0;
+};
+
+void putOperations(MessageWriter &writer, std::span<const Operation> ops) {
+    writer.Put((u32)ops.size());
+    for (auto &op : ops) {
+        writer.Put((u8)op.type);
+        if (op.type == Operation::Type::Operator) {
+            writer.Put((u8)op.op);
+        } else {
+            writer.Put(op.constVal);
+        }
+    }
+}
+
+bool getOperations(MessageReader &reader, std::vector<Operation> &ops) {
+    u32 count;
+    if (!reader.GetCount(count, 2)) {
+        return false;
+    }
+    ops.resize(count);
+    for (auto &op : ops) {
+        u8 type;
+        if (!reader.Get(type)) {
+            return false;
+        }
+        if (type == (u8)Operation::Type::Operator) {
+            u8 index;
+            if (!reader.Get(index) || index >= std::size(kOperators)) {
+                return false;
+            }
+            op = Operation{.type = Operation::Type::Operator, .op = kOperators[index]};
+        } else if (type == (u8)Operation::Type::Constant) {
+            i32 value;
+            if (!reader.Get(value)) {
+                return false;
+            }
+            op = Operation{.type = Operation::Type::Constant, .constVal = value};
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void putChromosome(MessageWriter &writer, const GAFuncSearch::Chromosome &chrom) {
+    writer.Put(chrom.fitness);
+    writer.Put(chrom.numErrors);
+    writer.Put((u32)chrom.stackSize);
+    writer.Put(chrom.generation);
+    writer.Put((u8)chrom.worseThanCutoff);
+    writer.Put((u32)chrom.genes.size());
+    writer.PutBytes(chrom.genes.data(), chrom.genes.size());
+    writer.PutBytes(chrom.enabled.data(), chrom.enabled.size() * sizeof(u64));
+}
+
+// Accepts only chromosomes of numOps genes that refer to existing template operations
+bool getChromosome(MessageReader &reader, GAFuncSearch::Chromosome &chrom, size_t numOps, size_t numTemplateOps) {
+    u32 stackSize, numGenes;
+    u8 worseThanCutoff;
+    if (!reader.Get(chrom.fitness) || !reader.Get(chrom.numErrors) || !reader.Get(stackSize) ||
+        !reader.Get(chrom.generation) || !reader.Get(worseThanCutoff) || !reader.Get(numGenes) || numGenes != numOps) {
+        return false;
+    }
+    chrom.stackSize = stackSize;
+    chrom.worseThanCutoff = worseThanCutoff != 0;
+    chrom.Resize(numOps);
+    if (!reader.GetBytes(chrom.genes.data(), chrom.genes.size()) ||
+        !reader.GetBytes(chrom.enabled.data(), chrom.enabled.size() * sizeof(u64))) {
+        return false;
+    }
+    if (numOps % 64 != 0 && (chrom.enabled.back() >> (numOps % 64)) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < numOps; i++) {
+        if (chrom.IsEnabled(i) && chrom.genes[i] >= numTemplateOps) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void putChromosomes(MessageWriter &writer, std::span<const GAFuncSearch::Chromosome> chroms) {
+    writer.Put((u32)chroms.size());
+    for (auto &chrom : chroms) {
+        putChromosome(writer, chrom);
+    }
+}
+
+bool getChromosomes(MessageReader &reader, std::vector<GAFuncSearch::Chromosome> &chroms, size_t numOps,
+                    size_t numTemplateOps) {
+    u32 count;
+    if (!reader.GetCount(count, numOps)) {
+        return false;
+    }
+    chroms.resize(count);
+    for (auto &chrom : chroms) {
+        if (!getChromosome(reader, chrom, numOps, numTemplateOps)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Slopes and features are computed by the receiving search
+void putDataPoints(MessageWriter &writer, std::span<const ExtDataPoint> dataPoints) {
+    writer.Put((u32)dataPoints.size());
+    for (auto &dp : dataPoints) {
+        writer.Put(dp.dp.x);
+        writer.Put(dp.dp.y);
+        writer.Put(dp.dp.width);
+        writer.Put(dp.dp.height);
+        writer.Put(dp.dp.expectedOutput);
+        writer.Put(dp.upperBound);
+        writer.Put((u8)dp.left);
+        writer.Put((u8)dp.positive);
+        writer.Put(dp.errorWeight);
+    }
+}
+
+bool getDataPoints(MessageReader &reader, std::vector<ExtDataPoint> &dataPoints) {
+    u32 count;
+    if (!reader.GetCount(count, 30)) {
+        return false;
+    }
+    dataPoints.resize(count);
+    for (auto &dp : dataPoints) {
+        u8 left, positive;
+        if (!reader.Get(dp.dp.x) || !reader.Get(dp.dp.y) || !reader.Get(dp.dp.width) || !reader.Get(dp.dp.height) ||
+            !reader.Get(dp.dp.expectedOutput) || !reader.Get(dp.upperBound) || !reader.Get(left) ||
+            !reader.Get(positive) || !reader.Get(dp.errorWeight)) {
+            return false;
+        }
+        dp.left = left != 0;
+        dp.positive = positive != 0;
+    }
+    return true;
+}
+
+} // namespace
+
+// --- Coordinator ----------------------------------------------------------------------------------------------------
+
+GACoordinator::GACoordinator()
+    : GACoordinator(Config{}) {}
+
+GACoordinator::GACoordinator(const Config &config)
+    : m_config(config)
+    , m_rng(std::random_device{}()) {}
+
+GACoordinator::~GACoordinator() {
+    Stop();
+}
+
+bool GACoordinator::Listen(std::string_view address) {
+    auto listener = Listener::Open(address);
+    if (listener == nullptr) {
+        return false;
+    }
+    std::scoped_lock lk{m_mutex};
+    m_acceptors.emplace_back([this, listener = std::move(listener)](std::stop_token stopToken) mutable {
+        RunAcceptor(stopToken, std::move(listener));
+    });
+    return true;
+}
+
+void GACoordinator::Stop() {
+    // Stop accepting first so that no node joins while the others are being disconnected
+    std::vector<std::jthread> acceptors;
+    {
+        std::scoped_lock lk{m_mutex};
+        acceptors.swap(m_acceptors);
+    }
+    acceptors.clear();
+
+    std::vector<NodeThread> nodeThreads;
+    {
+        std::scoped_lock lk{m_mutex};
+        nodeThreads.swap(m_nodeThreads);
+    }
+    for (auto &entry : nodeThreads) {
+        entry.thread.request_stop();
+        entry.node->connection->Close();
+    }
+}
+
+void GACoordinator::SetFixedDataPoints(const std::vector<ExtDataPoint> &dataPoints) {
+    MessageWriter writer{MessageType::FixedDataPoints};
+    putDataPoints(writer, dataPoints);
+    {
+        std::scoped_lock lk{m_mutex};
+        m_fixedDataPointsMessage = writer.Data();
+    }
+    Broadcast(writer.Data(), nullptr);
+}
+
+std::vector<Operation> GACoordinator::TemplateOps() const {
+    std::scoped_lock lk{m_mutex};
+    return m_templateOps;
+}
+
+std::vector<GACoordinator::NodeStats> GACoordinator::Nodes() const {
+    std::scoped_lock lk{m_mutex};
+    std::vector<NodeStats> nodes;
+    for (auto &entry : m_nodeThreads) {
+        if (entry.node->welcomed && !entry.node->finished) {
+            nodes.push_back(entry.node->stats);
+        }
+    }
+    return nodes;
+}
+
+GAFuncSearch::Chromosome GACoordinator::BestChromosome() const {
+    std::scoped_lock lk{m_mutex};
+    return m_best;
+}
+
+std::vector<Operation> GACoordinator::BestFormula() const {
+    std::scoped_lock lk{m_mutex};
+    std::vector<Operation> ops;
+    for (size_t i = 0; i < m_best.genes.size(); i++) {
+        if (m_best.IsEnabled(i)) {
+            ops.push_back(m_templateOps[m_best.genes[i]]);
+        }
+    }
+    return ops;
+}
+
+std::vector<GAFuncSearch::Chromosome> GACoordinator::BestChromosomesHistory() const {
+    std::scoped_lock lk{m_mutex};
+    return m_history;
+}
+
+std::vector<Operation> GACoordinator::Solution() const {
+    std::scoped_lock lk{m_mutex};
+    return m_solution;
+}
+
+void GACoordinator::RunAcceptor(std::stop_token stopToken, std::unique_ptr<Listener> listener) {
+    while (!stopToken.stop_requested()) {
+        ReapNodes();
+        auto connection = listener->Accept(kPollInterval);
+        if (connection == nullptr) {
+            continue;
+        }
+        auto node = std::make_shared<Node>();
+        node->connection = std::move(connection);
+
+        std::scoped_lock lk{m_mutex};
+        node->id = m_nextNodeId++;
+        node->stats.id = node->id;
+        node->stats.bestFitness = std::numeric_limits<uint64_t>::max();
+        m_nodeThreads.push_back(
+            {node, std::jthread{[this, node](std::stop_token stopToken) { RunNode(stopToken, node); }}});
+    }
+}
+
+void GACoordinator::RunNode(std::stop_token stopToken, std::shared_ptr<Node> node) {
+    Connection &connection = *node->connection;
+    std::vector<u8> message;
+    std::vector<GAFuncSearch::Chromosome> chroms;
+    std::vector<Operation> ops;
+    std::vector<ExtDataPoint> dataPoints;
+    auto lastHeard = std::chrono::steady_clock::now();
+    bool valid = Handshake(*node);
+    while (valid && !stopToken.stop_requested() && connection.IsOpen()) {
+        const auto now = std::chrono::steady_clock::now();
+        if (!connection.Receive(message, kPollInterval)) {
+            valid = now - lastHeard < m_config.nodeTimeout;
+            continue;
+        }
+        lastHeard = now;
+
+        // Messages that don't parse get the node dropped
+        MessageReader reader{message};
+        MessageType type;
+        valid = reader.Get(type);
+        if (!valid) {
+            break;
+        }
+        switch (type) {
+        case MessageType::Status: {
+            GAFuncSearch::Chromosome best;
+            uint64_t generation, resetCount;
+            u8 solved;
+            valid = reader.Get(generation) && reader.Get(resetCount) &&
+                    getChromosome(reader, best, m_numOps, m_templateOps.size()) && reader.Get(solved) &&
+                    getOperations(reader, ops);
+            if (!valid) {
+                break;
+            }
+            bool newlySolved = false;
+            {
+                std::scoped_lock lk{m_mutex};
+                node->stats.generation = generation;
+                node->stats.resetCount = resetCount;
+                node->stats.bestFitness = best.fitness;
+                if (m_best.genes.empty() || best < m_best) {
+                    m_best = std::move(best);
+                }
+                if (solved && !m_solved) {
+                    m_solution = ops;
+                    m_solved.store(true, std::memory_order_release);
+                    newlySolved = true;
+                }
+            }
+            if (newlySolved) {
+                Broadcast(MessageWriter{MessageType::Stop}.Data(), nullptr);
+            }
+            break;
+        }
+        case MessageType::Migrants:
+            valid = getChromosomes(reader, chroms, m_numOps, m_templateOps.size());
+            if (valid) {
+                {
+                    std::scoped_lock lk{m_mutex};
+                    node->stats.migrantsSent += chroms.size();
+                }
+                Relay(message, *node);
+            }
+            break;
+        case MessageType::History:
+            valid = getChromosomes(reader, chroms, m_numOps, m_templateOps.size());
+            if (valid) {
+                std::scoped_lock lk{m_mutex};
+                m_history.insert(m_history.end(), chroms.begin(), chroms.end());
+            }
+            break;
+        case MessageType::FixedDataPoints:
+            valid = getDataPoints(reader, dataPoints);
+            if (valid) {
+                {
+                    std::scoped_lock lk{m_mutex};
+                    m_fixedDataPointsMessage = message;
+                }
+                Broadcast(message, node.get());
+            }
+            break;
+        default: valid = false; break;
+        }
+    }
+    connection.Close();
+    node->finished = true;
+}
+
+bool GACoordinator::Handshake(Node &node) {
+    std::vector<u8> message;
+    if (!node.connection->Receive(message, m_config.handshakeTimeout)) {
+        return false;
+    }
+    MessageReader reader{message};
+    MessageType type;
+    char magic[sizeof(kProtocolMagic)];
+    u32 version, numOps;
+    std::vector<Operation> templateOps;
+    if (!reader.Get(type) || type != MessageType::Hello || !reader.GetBytes(magic, sizeof(magic)) ||
+        memcmp(magic, kProtocolMagic, sizeof(magic)) != 0 || !reader.Get(version) || version != kProtocolVersion ||
+        !reader.Get(numOps) || !getOperations(reader, templateOps) ||
+        templateOps.size() > GAFuncSearch::kMaxTemplateOps) {
+        return false;
+    }
+
+    // Broadcasts to the node wait for the catch-up messages below, since they take the send lock of the node once it's
+    // welcomed. Only this node's lock is held while sending, so a slow node never stalls the others.
+    std::scoped_lock sendLock{node.sendMutex};
+    std::vector<u8> fixedDataPointsMessage;
+    bool solved;
+    {
+        // The first node decides what the search looks like. The template operations and chromosome size never
+        // change afterwards, so node threads read them without locking.
+        std::scoped_lock lk{m_mutex};
+        if (!m_hasSearch) {
+            m_templateOps = std::move(templateOps);
+            m_numOps = numOps;
+            m_hasSearch = true;
+        } else if (templateOps != m_templateOps || numOps != m_numOps) {
+            return false;
+        }
+        fixedDataPointsMessage = m_fixedDataPointsMessage;
+        solved = m_solved;
+        node.welcomed = true;
+    }
+
+    MessageWriter welcome{MessageType::Welcome};
+    welcome.Put(node.id);
+    if (!node.connection->Send(welcome.Data())) {
+        return false;
+    }
+    if (!fixedDataPointsMessage.empty() && !node.connection->Send(fixedDataPointsMessage)) {
+        return false;
+    }
+    if (solved && !node.connection->Send(MessageWriter{MessageType::Stop}.Data())) {
+        return false;
+    }
+    return true;
+}
+
+void GACoordinator::Send(Node &node, std::span<const u8> message) {
+    std::scoped_lock lk{node.sendMutex};
+    node.connection->Send(message);
+}
+
+void GACoordinator::Broadcast(std::span<const u8> message, const Node *except) {
+    std::vector<std::shared_ptr<Node>> targets;
+    {
+        std::scoped_lock lk{m_mutex};
+        for (auto &entry : m_nodeThreads) {
+            if (entry.node.get() != except && entry.node->welcomed && !entry.node->finished) {
+                targets.push_back(entry.node);
+            }
+        }
+    }
+    for (auto &node : targets) {
+        Send(*node, message);
+    }
+}
+
+void GACoordinator::Relay(std::span<const u8> message, const Node &from) {
+    std::vector<std::shared_ptr<Node>> targets;
+    {
+        std::scoped_lock lk{m_mutex};
+        for (auto &entry : m_nodeThreads) {
+            if (entry.node.get() != &from && entry.node->welcomed && !entry.node->finished) {
+                targets.push_back(entry.node);
+            }
+        }
+        // Partial Fisher-Yates shuffle of the other nodes
+        if (m_config.relayFanout != 0 && targets.size() > m_config.relayFanout) {
+            for (size_t i = 0; i < m_config.relayFanout; i++) {
+                std::swap(targets[i], targets[m_rng.Range(i, targets.size() - 1)]);
+            }
+            targets.resize(m_config.relayFanout);
+        }
+    }
+    for (auto &node : targets) {
+        Send(*node, message);
+    }
+}
+
+void GACoordinator::ReapNodes() {
+    std::vector<NodeThread> finished;
+    {
+        std::scoped_lock lk{m_mutex};
+        auto it = std::partition(m_nodeThreads.begin(), m_nodeThreads.end(),
+                                 [](const NodeThread &entry) { return !entry.node->finished; });
+        std::move(it, m_nodeThreads.end(), std::back_inserter(finished));
+        m_nodeThreads.erase(it, m_nodeThreads.end());
+    }
+}
+
+// --- Node -----------------------------------------------------------------------------------------------------------
+
+GANode::GANode(GAFuncSearch &ga)
+    : GANode(ga, Config{}) {}
+
+GANode::GANode(GAFuncSearch &ga, const Config &config)
+    : m_ga(ga)
+    , m_config(config) {}
+
+GANode::~GANode() {
+    Disconnect();
+}
+
+bool GANode::Connect(std::string_view address) {
+    Disconnect();
+    auto connection = Connection::Open(address);
+    if (connection == nullptr) {
+        return false;
+    }
+
+    MessageWriter hello{MessageType::Hello};
+    hello.PutBytes(kProtocolMagic, sizeof(kProtocolMagic));
+    hello.Put(kProtocolVersion);
+    hello.Put((u32)m_ga.GetConfig().numOps);
+    putOperations(hello, m_ga.TemplateOps());
+    std::vector<u8> message;
+    if (!connection->Send(hello.Data()) || !connection->Receive(message, m_config.connectTimeout)) {
+        return false;
+    }
+    MessageReader reader{message};
+    MessageType type;
+    if (!reader.Get(type) || type != MessageType::Welcome || !reader.Get(m_nodeId)) {
+        return false;
+    }
+
+    m_connection = std::move(connection);
+    m_stopRequested = false;
+    m_thread = std::jthread{[this](std::stop_token stopToken) { Run(stopToken); }};
+    return true;
+}
+
+void GANode::Disconnect() {
+    if (m_thread.joinable()) {
+        m_thread.request_stop();
+        m_thread.join();
+    }
+    if (m_connection != nullptr) {
+        m_connection->Close();
+        m_connection.reset();
+    }
+}
+
+bool GANode::PublishFixedDataPoints(const std::vector<ExtDataPoint> &dataPoints) {
+    m_ga.SetFixedDataPoints(dataPoints);
+    if (!IsConnected()) {
+        return false;
+    }
+    MessageWriter writer{MessageType::FixedDataPoints};
+    putDataPoints(writer, dataPoints);
+    return m_connection->Send(writer.Data());
+}
+
+void GANode::Run(std::stop_token stopToken) {
+    std::vector<u8> message;
+    size_t historySent = 0;
+    auto nextReport = std::chrono::steady_clock::now();
+    while (!stopToken.stop_requested() && m_connection->IsOpen()) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= nextReport) {
+            if (!Report(historySent)) {
+                break;
+            }
+            nextReport = now + m_config.exchangeInterval;
+        }
+        const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(nextReport - now);
+        if (m_connection->Receive(message, std::clamp<std::chrono::milliseconds>(timeout, 1ms, kPollInterval))) {
+            Handle(message);
+        }
+    }
+}
+
+bool GANode::Report(size_t &historySent) {
+    const bool solved = m_ga.IsSolved();
+    MessageWriter status{MessageType::Status};
+    status.Put(m_ga.CurrGeneration());
+    status.Put(m_ga.ResetCount());
+    putChromosome(status, m_ga.BestChromosome());
+    status.Put((u8)solved);
+    putOperations(status, solved ? m_ga.Solution() : std::vector<Operation>{});
+    if (!m_connection->Send(status.Data())) {
+        return false;
+    }
+
+    const auto history = m_ga.BestChromosomesHistory();
+    if (history.size() > historySent) {
+        MessageWriter writer{MessageType::History};
+        putChromosomes(writer, std::span{history}.subspan(historySent));
+        if (!m_connection->Send(writer.Data())) {
+            return false;
+        }
+        historySent = history.size();
+    }
+
+    const auto migrants = m_ga.BestChromosomes(m_config.numMigrants);
+    if (!migrants.empty()) {
+        MessageWriter writer{MessageType::Migrants};
+        putChromosomes(writer, migrants);
+        if (!m_connection->Send(writer.Data())) {
+            return false;
+        }
+        m_migrantsSent += migrants.size();
+    }
+    return true;
+}
+
+void GANode::Handle(std::span<const u8> message) {
+    MessageReader reader{message};
+    MessageType type;
+    if (!reader.Get(type)) {
+        return;
+    }
+    switch (type) {
+    case MessageType::Migrants: {
+        std::vector<GAFuncSearch::Chromosome> migrants;
+        if (getChromosomes(reader, migrants, m_ga.GetConfig().numOps, m_ga.TemplateOps().size())) {
+            m_ga.ImportMigrants(migrants);
+            m_migrantsReceived += migrants.size();
+        }
+        break;
+    }
+    case MessageType::FixedDataPoints: {
+        std::vector<ExtDataPoint> dataPoints;
+        if (getDataPoints(reader, dataPoints)) {
+            m_ga.SetFixedDataPoints(dataPoints);
+            ++m_dataPointUpdates;
+        }
+        break;
+    }
+    case MessageType::Stop: m_stopRequested.store(true, std::memory_order_release); break;
+    default: break;
+    }
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "active_test_set.h"
+#include "fast_rng.h"
+#include "func_search.h"
+#include "ga_transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Coordinates a search spread over several processes, on one host or many.
+//
+// Each process runs its own GAFuncSearch and joins the coordinator through a GANode. Nodes periodically report their
+// progress and best chromosomes. The coordinator forwards those chromosomes to other nodes as migrants, keeps the best
+// chromosomes and the reset history of the whole search, hands out the fixed data points, and tells every node to stop
+// once one of them finds a formula that passes validation. Nodes may join, leave or crash at any time without
+// disturbing the others.
+//
+// Every process must run on a little-endian machine with the same template operations and chromosome size.
+class GACoordinator {
+public:
+    struct Config {
+        size_t relayFanout = 4;                   // Nodes the migrants of a node are forwarded to; 0 for all of them
+        std::chrono::seconds nodeTimeout{30};     // Nodes that stay silent for this long are dropped
+        std::chrono::seconds handshakeTimeout{5}; // Time a new connection has to introduce itself
+    };
+
+    struct NodeStats {
+        u32 id;
+        uint64_t generation;
+        uint64_t resetCount;
+        uint64_t bestFitness;
+        uint64_t migrantsSent; // Chromosomes received from the node and forwarded to others
+    };
+
+    GACoordinator();
+    explicit GACoordinator(const Config &config);
+    ~GACoordinator();
+
+    // Accepts nodes on the address, on top of those given before. Returns false if the address can't be listened on.
+    bool Listen(std::string_view address);
+
+    // Disconnects every node and stops listening
+    void Stop();
+
+    // Sends the fixed data points to every node, now and as they join
+    void SetFixedDataPoints(const std::vector<ExtDataPoint> &dataPoints);
+
+    // Template operations of the search, set by the first node to join
+    std::vector<Operation> TemplateOps() const;
+
+    std::vector<NodeStats> Nodes() const;
+
+    // Best chromosome reported by any node so far, and its formula
+    GAFuncSearch::Chromosome BestChromosome() const;
+    std::vector<Operation> BestFormula() const;
+
+    // Best chromosome of every node at each of its resets
+    std::vector<GAFuncSearch::Chromosome> BestChromosomesHistory() const;
+
+    // Determines if a node found a formula that passes validation, and retrieves it
+    bool IsSolved() const {
+        return m_solved.load(std::memory_order_acquire);
+    }
+    std::vector<Operation> Solution() const;
+
+private:
+    struct Node {
+        u32 id;
+        std::unique_ptr<Connection> connection;
+        NodeStats stats{};
+        std::mutex sendMutex;              // Keeps broadcasts behind the catch-up messages of the handshake
+        std::atomic_bool welcomed = false; // The node passed the handshake and may receive broadcasts
+        std::atomic_bool finished = false; // The node's thread is done and can be joined
+    };
+
+    struct NodeThread {
+        std::shared_ptr<Node> node;
+        std::jthread thread;
+    };
+
+    const Config m_config;
+
+    mutable std::mutex m_mutex;
+    std::vector<std::jthread> m_acceptors;
+    std::vector<NodeThread> m_nodeThreads;
+    u32 m_nextNodeId = 0;
+    FastRng m_rng;
+
+    bool m_hasSearch = false; // Template operations and chromosome size set by the first node
+    std::vector<Operation> m_templateOps;
+    size_t m_numOps = 0;
+
+    std::vector<u8> m_fixedDataPointsMessage; // Sent to the nodes as they join; empty until set
+    GAFuncSearch::Chromosome m_best;
+    std::vector<GAFuncSearch::Chromosome> m_history;
+
+    std::atomic_bool m_solved = false;
+    std::vector<Operation> m_solution;
+
+    void RunAcceptor(std::stop_token stopToken, std::unique_ptr<Listener> listener);
+    void RunNode(std::stop_token stopToken, std::shared_ptr<Node> node);
+
+    // Validates the node's introduction and welcomes it. Returns false if the node must be dropped.
+    bool Handshake(Node &node);
+
+    // Sends a message to a welcomed node
+    static void Send(Node &node, std::span<const u8> message);
+
+    // Sends a message to every node except one
+    void Broadcast(std::span<const u8> message, const Node *except);
+
+    // Forwards migrants to up to relayFanout other nodes
+    void Relay(std::span<const u8> message, const Node &from);
+
+    // Joins the threads of the nodes that left
+    void ReapNodes();
+};
+
+// Joins a search run by a GACoordinator. Periodically sends the progress, reset history and best chromosomes of the
+// local search, and feeds the migrants and fixed data points the coordinator sends back into it.
+class GANode {
+public:
+    struct Config {
+        std::chrono::milliseconds exchangeInterval{1000}; // Time between reports
+        size_t numMigrants = 4;                            // Best chromosomes sent with each report
+        std::chrono::seconds connectTimeout{5};            // Time the coordinator has to welcome the node
+    };
+
+    struct Stats {
+        uint64_t migrantsSent;
+        uint64_t migrantsReceived;
+        uint64_t dataPointUpdates;
+    };
+
+    explicit GANode(GAFuncSearch &ga);
+    GANode(GAFuncSearch &ga, const Config &config);
+    ~GANode();
+
+    // Joins the coordinator at the address. Set the template operations of the search first. Returns false if the
+    // coordinator can't be reached or runs a search with different template operations or chromosome size.
+    bool Connect(std::string_view address);
+    void Disconnect();
+
+    bool IsConnected() const {
+        return m_connection != nullptr && m_connection->IsOpen();
+    }
+
+    u32 NodeId() const {
+        return m_nodeId;
+    }
+
+    // Replaces the fixed data points of every node, this one included
+    bool PublishFixedDataPoints(const std::vector<ExtDataPoint> &dataPoints);
+
+    // Set once the coordinator reports that some node found a formula that passes validation
+    bool IsStopRequested() const {
+        return m_stopRequested.load(std::memory_order_acquire);
+    }
+
+    Stats GetStats() const {
+        return {m_migrantsSent.load(), m_migrantsReceived.load(), m_dataPointUpdates.load()};
+    }
+
+private:
+    GAFuncSearch &m_ga;
+    const Config m_config;
+
+    std::unique_ptr<Connection> m_connection;
+    u32 m_nodeId = 0;
+    std::jthread m_thread;
+
+    std::atomic_bool m_stopRequested = false;
+    std::atomic_uint64_t m_migrantsSent{0};
+    std::atomic_uint64_t m_migrantsReceived{0};
+    std::atomic_uint64_t m_dataPointUpdates{0};
+
+    void Run(std::stop_token stopToken);
+
+    // Sends the status, new history and best chromosomes of the search
+    bool Report(size_t &historySent);
+
+    void Handle(std::span<const u8> message);
+};
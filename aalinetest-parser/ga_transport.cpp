@@ -0,0 +1,724 @@
+#include "ga_transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <WinSock2.h>
+    #include <WS2tcpip.h>
+    #include <afunix.h>
+    #include <Windows.h>
+    #pragma comment(lib, "ws2_32.lib")
+#else
+    #include <fcntl.h>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <poll.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/time.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// How long a connection to a shared memory listener waits to be accepted
+constexpr auto kSharedConnectTimeout = 5s;
+
+// Spins briefly, then sleeps, while waiting on the other end of a shared memory channel
+class Backoff {
+public:
+    void Wait() {
+        if (++m_spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(1ms);
+        }
+    }
+
+private:
+    int m_spins = 0;
+};
+
+enum class AddressKind { TCP, Unix, SharedMemory };
+
+struct Address {
+    AddressKind kind;
+    std::string host; // TCP
+    std::string port; // TCP
+    std::string path; // Unix socket path or shared memory name
+};
+
+bool parseAddress(std::string_view address, Address &out) {
+    if (address.starts_with("tcp://")) {
+        address.remove_prefix(6);
+        const size_t colon = address.rfind(':');
+        if (colon == std::string_view::npos || colon + 1 == address.size()) {
+            return false;
+        }
+        std::string_view host = address.substr(0, colon);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+        out = {.kind = AddressKind::TCP, .host = std::string{host}, .port = std::string{address.substr(colon + 1)}};
+        return !out.host.empty();
+    }
+    if (address.starts_with("unix://")) {
+        out = {.kind = AddressKind::Unix, .path = std::string{address.substr(7)}};
+        return !out.path.empty();
+    }
+    if (address.starts_with("shm://")) {
+        out = {.kind = AddressKind::SharedMemory, .path = std::string{address.substr(6)}};
+        const bool valid = std::all_of(out.path.begin(), out.path.end(), [](char ch) {
+            return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '-' ||
+                   ch == '_' || ch == '.';
+        });
+        return valid && !out.path.empty();
+    }
+    return false;
+}
+
+// --- Sockets --------------------------------------------------------------------------------------------------------
+
+#if defined(_WIN32)
+using SocketHandle = SOCKET;
+constexpr SocketHandle kInvalidSocket = INVALID_SOCKET;
+constexpr int kShutdownBoth = SD_BOTH;
+constexpr int kNoSignal = 0;
+
+bool initSockets() {
+    static const bool initialized = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return initialized;
+}
+
+void closeSocket(SocketHandle socket) {
+    closesocket(socket);
+}
+
+int pollSocket(SocketHandle socket, std::chrono::milliseconds timeout) {
+    WSAPOLLFD fd{.fd = socket, .events = POLLIN};
+    return WSAPoll(&fd, 1, (INT)timeout.count());
+}
+
+void setSendTimeout(SocketHandle socket, std::chrono::milliseconds timeout) {
+    DWORD value = (DWORD)timeout.count();
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const char *)&value, sizeof(value));
+}
+#else
+using SocketHandle = int;
+constexpr SocketHandle kInvalidSocket = -1;
+constexpr int kShutdownBoth = SHUT_RDWR;
+constexpr int kNoSignal = MSG_NOSIGNAL;
+
+bool initSockets() {
+    return true;
+}
+
+void closeSocket(SocketHandle socket) {
+    close(socket);
+}
+
+int pollSocket(SocketHandle socket, std::chrono::milliseconds timeout) {
+    pollfd fd{.fd = socket, .events = POLLIN};
+    return poll(&fd, 1, (int)timeout.count());
+}
+
+void setSendTimeout(SocketHandle socket, std::chrono::milliseconds timeout) {
+    timeval value{.tv_sec = (time_t)(timeout.count() / 1000), .tv_usec = (suseconds_t)(timeout.count() % 1000 * 1000)};
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &value, sizeof(value));
+}
+#endif
+
+void setNoDelay(SocketHandle socket) {
+    int enable = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&enable, sizeof(enable));
+}
+
+bool makeUnixAddress(const std::string &path, sockaddr_un &addr) {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// Messages are framed with their size as a 32-bit little-endian integer
+class SocketConnection final : public Connection {
+public:
+    explicit SocketConnection(SocketHandle socket)
+        : m_socket(socket) {
+        setSendTimeout(m_socket, kSendTimeout);
+    }
+
+    ~SocketConnection() override {
+        Close();
+        closeSocket(m_socket);
+    }
+
+    bool Send(std::span<const u8> message) override {
+        if (message.size() > kMaxMessageSize) {
+            return false;
+        }
+        std::scoped_lock lk{m_sendMutex};
+        const u32 size = (u32)message.size();
+        m_sendBuffer.resize(sizeof(size) + message.size());
+        memcpy(m_sendBuffer.data(), &size, sizeof(size));
+        std::copy(message.begin(), message.end(), m_sendBuffer.begin() + sizeof(size));
+        if (!SendAll(m_sendBuffer.data(), m_sendBuffer.size())) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    bool Receive(std::vector<u8> &message, std::chrono::milliseconds timeout) override {
+        std::scoped_lock lk{m_receiveMutex};
+        if (!m_open) {
+            return false;
+        }
+        const int ready = pollSocket(m_socket, timeout);
+        if (ready == 0) {
+            return false;
+        }
+        // Once a message starts arriving, wait for the rest of it
+        u32 size;
+        if (ready < 0 || !ReceiveAll(&size, sizeof(size)) || size > kMaxMessageSize) {
+            Close();
+            return false;
+        }
+        message.resize(size);
+        if (!ReceiveAll(message.data(), size)) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    bool IsOpen() const override {
+        return m_open;
+    }
+
+    void Close() override {
+        if (m_open.exchange(false)) {
+            shutdown(m_socket, kShutdownBoth);
+        }
+    }
+
+private:
+    SocketHandle m_socket;
+    std::atomic_bool m_open = true;
+    std::mutex m_sendMutex;
+    std::mutex m_receiveMutex;
+    std::vector<u8> m_sendBuffer;
+
+    // Each send call gives up after kSendTimeout without progress
+    bool SendAll(const u8 *data, size_t size) {
+        while (size > 0) {
+            const int sent = send(m_socket, (const char *)data, (int)std::min<size_t>(size, 1 << 30), kNoSignal);
+            if (sent <= 0) {
+                return false;
+            }
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool ReceiveAll(void *buffer, size_t size) {
+        u8 *data = (u8 *)buffer;
+        while (size > 0) {
+            const int received = recv(m_socket, (char *)data, (int)std::min<size_t>(size, 1 << 30), 0);
+            if (received <= 0) {
+                return false;
+            }
+            data += received;
+            size -= received;
+        }
+        return true;
+    }
+};
+
+class SocketListener final : public Listener {
+public:
+    SocketListener(SocketHandle socket, bool tcp, std::string unixPath)
+        : m_socket(socket)
+        , m_tcp(tcp)
+        , m_unixPath(std::move(unixPath)) {}
+
+    ~SocketListener() override {
+        closeSocket(m_socket);
+        if (!m_unixPath.empty()) {
+            std::error_code error;
+            std::filesystem::remove(m_unixPath, error);
+        }
+    }
+
+    std::unique_ptr<Connection> Accept(std::chrono::milliseconds timeout) override {
+        if (pollSocket(m_socket, timeout) <= 0) {
+            return nullptr;
+        }
+        SocketHandle socket = accept(m_socket, nullptr, nullptr);
+        if (socket == kInvalidSocket) {
+            return nullptr;
+        }
+        if (m_tcp) {
+            setNoDelay(socket);
+        }
+        return std::make_unique<SocketConnection>(socket);
+    }
+
+private:
+    SocketHandle m_socket;
+    bool m_tcp;
+    std::string m_unixPath; // Removed when the listener is destroyed
+};
+
+// Calls func on each address the host and port resolve to until it returns a valid socket
+template <typename Func>
+SocketHandle forEachTCPAddress(const Address &address, bool passive, Func &&func) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo *results = nullptr;
+    if (getaddrinfo(address.host.c_str(), address.port.c_str(), &hints, &results) != 0) {
+        return kInvalidSocket;
+    }
+    SocketHandle socket = kInvalidSocket;
+    for (addrinfo *info = results; info != nullptr && socket == kInvalidSocket; info = info->ai_next) {
+        socket = func(*info);
+    }
+    freeaddrinfo(results);
+    return socket;
+}
+
+std::unique_ptr<Listener> listenSocket(const Address &address) {
+    if (!initSockets()) {
+        return nullptr;
+    }
+    if (address.kind == AddressKind::TCP) {
+        SocketHandle socket = forEachTCPAddress(address, true, [](const addrinfo &info) {
+            SocketHandle socket = ::socket(info.ai_family, info.ai_socktype, info.ai_protocol);
+            if (socket == kInvalidSocket) {
+                return kInvalidSocket;
+            }
+#if !defined(_WIN32)
+            // Allows restarting the coordinator right away; on Windows this would let others steal the port
+            int enable = 1;
+            setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+#endif
+            if (bind(socket, info.ai_addr, (int)info.ai_addrlen) != 0 || listen(socket, SOMAXCONN) != 0) {
+                closeSocket(socket);
+                return kInvalidSocket;
+            }
+            return socket;
+        });
+        if (socket == kInvalidSocket) {
+            return nullptr;
+        }
+        return std::make_unique<SocketListener>(socket, true, std::string{});
+    }
+
+    sockaddr_un addr;
+    if (!makeUnixAddress(address.path, addr)) {
+        return nullptr;
+    }
+    // Remove the socket file left behind by a previous listener
+    std::error_code error;
+    std::filesystem::remove(address.path, error);
+    SocketHandle socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket == kInvalidSocket) {
+        return nullptr;
+    }
+    if (bind(socket, (const sockaddr *)&addr, sizeof(addr)) != 0 || listen(socket, SOMAXCONN) != 0) {
+        closeSocket(socket);
+        return nullptr;
+    }
+    return std::make_unique<SocketListener>(socket, false, address.path);
+}
+
+std::unique_ptr<Connection> connectSocket(const Address &address) {
+    if (!initSockets()) {
+        return nullptr;
+    }
+    if (address.kind == AddressKind::TCP) {
+        SocketHandle socket = forEachTCPAddress(address, false, [](const addrinfo &info) {
+            SocketHandle socket = ::socket(info.ai_family, info.ai_socktype, info.ai_protocol);
+            if (socket == kInvalidSocket) {
+                return kInvalidSocket;
+            }
+            if (connect(socket, info.ai_addr, (int)info.ai_addrlen) != 0) {
+                closeSocket(socket);
+                return kInvalidSocket;
+            }
+            return socket;
+        });
+        if (socket == kInvalidSocket) {
+            return nullptr;
+        }
+        setNoDelay(socket);
+        return std::make_unique<SocketConnection>(socket);
+    }
+
+    sockaddr_un addr;
+    if (!makeUnixAddress(address.path, addr)) {
+        return nullptr;
+    }
+    SocketHandle socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket == kInvalidSocket) {
+        return nullptr;
+    }
+    if (connect(socket, (const sockaddr *)&addr, sizeof(addr)) != 0) {
+        closeSocket(socket);
+        return nullptr;
+    }
+    return std::make_unique<SocketConnection>(socket);
+}
+
+// --- Shared memory --------------------------------------------------------------------------------------------------
+
+// A shared memory listener owns a region with a fixed number of channels, each a pair of single-producer,
+// single-consumer byte rings. Connecting claims a free channel and waits for the listener to accept it. A channel is
+// freed once both of its ends are gone; those of a process that crashed are never reused.
+constexpr u32 kSharedMagic = 0x4E474141; // "AAGN"
+constexpr size_t kSharedChannels = 8;
+constexpr size_t kSharedRingSize = 2 * Connection::kMaxMessageSize;
+
+enum SharedChannelState : u32 { kFree, kClaiming, kRequested, kAccepted, kClosed };
+
+struct SharedRing {
+    alignas(64) std::atomic<u64> head; // Bytes written
+    alignas(64) std::atomic<u64> tail; // Bytes read
+    alignas(64) u8 data[kSharedRingSize];
+};
+
+struct SharedChannel {
+    alignas(64) std::atomic<u32> state;
+    std::atomic<u32> refs; // Ends attached to the channel
+    SharedRing rings[2];   // Connector to listener, then listener to connector
+};
+
+// Zero-filled memory is a valid initial state for the whole region
+struct SharedRegion {
+    std::atomic<u32> magic; // Set while the listener is alive
+    SharedChannel channels[kSharedChannels];
+};
+static_assert(std::atomic<u32>::is_always_lock_free && std::atomic<u64>::is_always_lock_free);
+
+class SharedMapping {
+public:
+    // Creates the region for a listener, or opens it for a connector
+    static std::shared_ptr<SharedMapping> Open(const std::string &name, bool create) {
+        auto mapping = std::shared_ptr<SharedMapping>{new SharedMapping()};
+        const size_t size = sizeof(SharedRegion);
+#if defined(_WIN32)
+        const std::string osName = "Local\\aaga." + name;
+        if (create) {
+            mapping->m_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                                   (DWORD)((u64)size >> 32), (DWORD)size, osName.c_str());
+            if (mapping->m_handle != nullptr && GetLastError() == ERROR_ALREADY_EXISTS) {
+                return nullptr; // Another listener uses the name
+            }
+        } else {
+            mapping->m_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, osName.c_str());
+        }
+        if (mapping->m_handle == nullptr) {
+            return nullptr;
+        }
+        mapping->m_data = MapViewOfFile(mapping->m_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+        const std::string osName = "/aaga." + name;
+        int fd;
+        if (create) {
+            // Replace the region left behind by a listener that crashed
+            shm_unlink(osName.c_str());
+            fd = shm_open(osName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0) {
+                return nullptr;
+            }
+            mapping->m_unlinkName = osName;
+            if (ftruncate(fd, size) != 0) {
+                close(fd);
+                return nullptr;
+            }
+        } else {
+            fd = shm_open(osName.c_str(), O_RDWR, 0600);
+            if (fd < 0) {
+                return nullptr;
+            }
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && (size_t)info.st_size == size) {
+            mapping->m_data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapping->m_data == MAP_FAILED) {
+                mapping->m_data = nullptr;
+            }
+        }
+        close(fd);
+#endif
+        if (mapping->m_data == nullptr) {
+            return nullptr;
+        }
+        return mapping;
+    }
+
+    ~SharedMapping() {
+#if defined(_WIN32)
+        if (m_data != nullptr) {
+            UnmapViewOfFile(m_data);
+        }
+        if (m_handle != nullptr) {
+            CloseHandle(m_handle);
+        }
+#else
+        if (m_data != nullptr) {
+            munmap(m_data, sizeof(SharedRegion));
+        }
+        RemoveName();
+#endif
+    }
+
+    SharedRegion &Region() const {
+        return *(SharedRegion *)m_data;
+    }
+
+    // Makes the region unreachable for new connectors; existing mappings stay valid
+    void RemoveName() {
+#if !defined(_WIN32)
+        if (!m_unlinkName.empty()) {
+            shm_unlink(m_unlinkName.c_str());
+            m_unlinkName.clear();
+        }
+#endif
+    }
+
+private:
+    SharedMapping() = default;
+
+    void *m_data = nullptr;
+#if defined(_WIN32)
+    HANDLE m_handle = nullptr;
+#else
+    std::string m_unlinkName;
+#endif
+};
+
+void ringCopyIn(SharedRing &ring, u64 pos, const void *src, size_t size) {
+    const size_t offset = pos % kSharedRingSize;
+    const size_t first = std::min(size, kSharedRingSize - offset);
+    memcpy(ring.data + offset, src, first);
+    memcpy(ring.data, (const u8 *)src + first, size - first);
+}
+
+void ringCopyOut(const SharedRing &ring, u64 pos, void *dst, size_t size) {
+    const size_t offset = pos % kSharedRingSize;
+    const size_t first = std::min(size, kSharedRingSize - offset);
+    memcpy(dst, ring.data + offset, first);
+    memcpy((u8 *)dst + first, ring.data, size - first);
+}
+
+class SharedConnection final : public Connection {
+public:
+    // Takes over a reference to the channel
+    SharedConnection(std::shared_ptr<SharedMapping> mapping, SharedChannel &channel, bool listenerSide)
+        : m_mapping(std::move(mapping))
+        , m_channel(channel)
+        , m_out(channel.rings[listenerSide ? 1 : 0])
+        , m_in(channel.rings[listenerSide ? 0 : 1]) {}
+
+    ~SharedConnection() override {
+        Close();
+        Release(m_channel);
+    }
+
+    // Drops references to the channel, freeing it if they were the last ones
+    static void Release(SharedChannel &channel, u32 count = 1) {
+        if (channel.refs.fetch_sub(count, std::memory_order_acq_rel) == count) {
+            for (auto &ring : channel.rings) {
+                ring.head.store(0, std::memory_order_relaxed);
+                ring.tail.store(0, std::memory_order_relaxed);
+            }
+            channel.state.store(kFree, std::memory_order_release);
+        }
+    }
+
+    bool Send(std::span<const u8> message) override {
+        const u32 size = (u32)message.size();
+        if (message.size() > kMaxMessageSize) {
+            return false;
+        }
+        std::scoped_lock lk{m_sendMutex};
+        const u64 head = m_out.head.load(std::memory_order_relaxed);
+        u64 tail = m_out.tail.load(std::memory_order_acquire);
+        auto deadline = std::chrono::steady_clock::now() + kSendTimeout;
+        Backoff backoff;
+        while (kSharedRingSize - (head - tail) < sizeof(size) + size) {
+            if (!IsOpen()) {
+                return false;
+            }
+            // The deadline moves whenever the peer makes room
+            const u64 newTail = m_out.tail.load(std::memory_order_acquire);
+            const auto now = std::chrono::steady_clock::now();
+            if (newTail != tail) {
+                tail = newTail;
+                deadline = now + kSendTimeout;
+            } else if (now >= deadline) {
+                Close();
+                return false;
+            }
+            backoff.Wait();
+        }
+        ringCopyIn(m_out, head, &size, sizeof(size));
+        ringCopyIn(m_out, head + sizeof(size), message.data(), size);
+        m_out.head.store(head + sizeof(size) + size, std::memory_order_release);
+        return IsOpen();
+    }
+
+    bool Receive(std::vector<u8> &message, std::chrono::milliseconds timeout) override {
+        std::scoped_lock lk{m_receiveMutex};
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        const u64 tail = m_in.tail.load(std::memory_order_relaxed);
+        Backoff backoff;
+        // Messages sent before the channel was closed are still delivered
+        while (m_in.head.load(std::memory_order_acquire) == tail) {
+            if (!IsOpen() || std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            backoff.Wait();
+        }
+        // Messages are written whole
+        u32 size;
+        ringCopyOut(m_in, tail, &size, sizeof(size));
+        if (size > kMaxMessageSize) {
+            Close();
+            return false;
+        }
+        message.resize(size);
+        ringCopyOut(m_in, tail + sizeof(size), message.data(), size);
+        m_in.tail.store(tail + sizeof(size) + size, std::memory_order_release);
+        return true;
+    }
+
+    bool IsOpen() const override {
+        return m_channel.state.load(std::memory_order_acquire) == kAccepted;
+    }
+
+    void Close() override {
+        m_channel.state.store(kClosed, std::memory_order_release);
+    }
+
+private:
+    std::shared_ptr<SharedMapping> m_mapping; // Keeps the region mapped
+    SharedChannel &m_channel;
+    SharedRing &m_out;
+    SharedRing &m_in;
+    std::mutex m_sendMutex;
+    std::mutex m_receiveMutex;
+};
+
+class SharedListener final : public Listener {
+public:
+    explicit SharedListener(std::shared_ptr<SharedMapping> mapping)
+        : m_mapping(std::move(mapping)) {
+        m_mapping->Region().magic.store(kSharedMagic, std::memory_order_release);
+    }
+
+    ~SharedListener() override {
+        m_mapping->Region().magic.store(0, std::memory_order_release);
+        m_mapping->RemoveName();
+    }
+
+    std::unique_ptr<Connection> Accept(std::chrono::milliseconds timeout) override {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        Backoff backoff;
+        for (;;) {
+            for (auto &channel : m_mapping->Region().channels) {
+                u32 state = kRequested;
+                if (channel.state.compare_exchange_strong(state, kAccepted, std::memory_order_acq_rel)) {
+                    return std::make_unique<SharedConnection>(m_mapping, channel, true);
+                }
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return nullptr;
+            }
+            backoff.Wait();
+        }
+    }
+
+private:
+    std::shared_ptr<SharedMapping> m_mapping;
+};
+
+std::unique_ptr<Listener> listenShared(const Address &address) {
+    auto mapping = SharedMapping::Open(address.path, true);
+    if (mapping == nullptr) {
+        return nullptr;
+    }
+    return std::make_unique<SharedListener>(std::move(mapping));
+}
+
+std::unique_ptr<Connection> connectShared(const Address &address) {
+    auto mapping = SharedMapping::Open(address.path, false);
+    if (mapping == nullptr || mapping->Region().magic.load(std::memory_order_acquire) != kSharedMagic) {
+        return nullptr;
+    }
+    for (auto &channel : mapping->Region().channels) {
+        u32 state = kFree;
+        if (!channel.state.compare_exchange_strong(state, kClaiming, std::memory_order_acquire)) {
+            continue;
+        }
+        // One reference for each end, so that the listener takes over its own by accepting
+        channel.refs.store(2, std::memory_order_relaxed);
+        channel.state.store(kRequested, std::memory_order_release);
+
+        const auto deadline = std::chrono::steady_clock::now() + kSharedConnectTimeout;
+        Backoff backoff;
+        while (channel.state.load(std::memory_order_acquire) == kRequested &&
+               std::chrono::steady_clock::now() < deadline) {
+            backoff.Wait();
+        }
+        // Withdraw the request unless the listener accepted it in the meantime
+        state = kRequested;
+        if (channel.state.compare_exchange_strong(state, kClosed, std::memory_order_acq_rel)) {
+            SharedConnection::Release(channel, 2);
+            return nullptr;
+        }
+        return std::make_unique<SharedConnection>(std::move(mapping), channel, false);
+    }
+    return nullptr;
+}
+
+} // namespace
+
+std::unique_ptr<Connection> Connection::Open(std::string_view address) {
+    Address parsed;
+    if (!parseAddress(address, parsed)) {
+        return nullptr;
+    }
+    return parsed.kind == AddressKind::SharedMemory ? connectShared(parsed) : connectSocket(parsed);
+}
+
+std::unique_ptr<Listener> Listener::Open(std::string_view address) {
+    Address parsed;
+    if (!parseAddress(address, parsed)) {
+        return nullptr;
+    }
+    return parsed.kind == AddressKind::SharedMemory ? listenShared(parsed) : listenSocket(parsed);
+}
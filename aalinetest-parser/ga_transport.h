@@ -0,0 +1,55 @@
+#pragma once
+
+#include "types.h"
+
+#include <chrono>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Reliable, ordered message channels between the processes of a distributed search.
+//
+// The address picks the transport:
+//   tcp://host:port  TCP; listen on 0.0.0.0 to accept connections from other hosts
+//   unix:///path     Unix domain socket (on Windows, 10 version 1803 or later)
+//   shm://name       Shared memory ring buffers, for processes on the same host
+//
+// Messages are opaque byte strings of up to kMaxMessageSize bytes. Connections can be used from several threads at
+// once; sends and receives are each serialized.
+class Connection {
+public:
+    static constexpr size_t kMaxMessageSize = 1 << 20;
+
+    // Sends that make no progress for this long close the connection, so that a peer that stopped reading can't block
+    // the sender forever
+    static constexpr std::chrono::seconds kSendTimeout{10};
+
+    virtual ~Connection() = default;
+
+    // Connects to a listener. Returns nullptr on failure.
+    static std::unique_ptr<Connection> Open(std::string_view address);
+
+    // Sends a whole message, waiting for room if needed. Returns false if the connection is closed or the send timed
+    // out, which closes it.
+    virtual bool Send(std::span<const u8> message) = 0;
+
+    // Waits up to timeout for the next message. Returns false on timeout or if the connection is closed.
+    virtual bool Receive(std::vector<u8> &message, std::chrono::milliseconds timeout) = 0;
+
+    virtual bool IsOpen() const = 0;
+
+    // Closes the connection on both ends and wakes up any blocked calls
+    virtual void Close() = 0;
+};
+
+class Listener {
+public:
+    virtual ~Listener() = default;
+
+    // Starts listening. Returns nullptr on failure.
+    static std::unique_ptr<Listener> Open(std::string_view address);
+
+    // Waits up to timeout for a new connection. Returns nullptr on timeout.
+    virtual std::unique_ptr<Connection> Accept(std::chrono::milliseconds timeout) = 0;
+};
@@ -0,0 +1,67 @@
+#include "gap_atlas.h"
+
+#include "parallel.h"
+#include "slope.h"
+
+#include <array>
+#include <bit>
+
+void GapAtlas::Build(size_t numWorkers) {
+    if (numWorkers == 0) {
+        numWorkers = defaultWorkerCount();
+    }
+
+    // Compute uncompressed gap bitmaps for every slope; each work item handles one height of one orientation
+    static constexpr size_t kWordsPerSlope = (kMaxHeight + 63) / 64;
+    std::vector<std::array<u64, kWordsPerSlope>> slopeBits(kNumSlopes);
+    parallelFor(2 * (kMaxHeight + 1), numWorkers, [&](size_t item, size_t) {
+        const bool negative = item > kMaxHeight;
+        const i32 height = item % (kMaxHeight + 1);
+        for (i32 width = height + 1; width <= kMaxWidth; width++) {
+            Slope slope;
+            if (negative) {
+                slope.Setup(width, 0, 0, height, true);
+            } else {
+                slope.Setup(0, 0, width, height, true);
+            }
+
+            auto &bits = slopeBits[SlopeIndex(width, height, negative)];
+            for (i32 y = 0; y + 1 < height; y++) {
+                const bool gap = negative ? (slope.XStart(y + 1) + 1 < slope.XEnd(y))
+                                          : (slope.XEnd(y) + 1 < slope.XStart(y + 1));
+                if (gap) {
+                    bits[y / 64] |= 1ull << (y % 64);
+                }
+            }
+        }
+    });
+
+    // Pack the bitmaps of slopes with gaps into a single bit array
+    m_bits.clear();
+    m_bitOffsets.assign(kNumSlopes, 0);
+    m_gapCounts.assign(kNumSlopes, 0);
+    m_totalGaps = 0;
+    size_t bitPos = 0;
+    for (size_t index = 0; index < kNumSlopes; index++) {
+        auto &bits = slopeBits[index];
+        u32 count = 0;
+        for (u64 word : bits) {
+            count += std::popcount(word);
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        const i32 height = (index / (kMaxWidth + 1)) % (kMaxHeight + 1);
+        m_gapCounts[index] = count;
+        m_bitOffsets[index] = bitPos;
+        m_totalGaps += count;
+        m_bits.resize((bitPos + height + 63) / 64);
+        for (i32 y = 0; y < height; y++, bitPos++) {
+            if ((bits[y / 64] >> (y % 64)) & 1) {
+                m_bits[bitPos / 64] |= 1ull << (bitPos % 64);
+            }
+        }
+    }
+    m_bits.shrink_to_fit();
+}
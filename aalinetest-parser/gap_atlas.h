@@ -0,0 +1,102 @@
+#pragma once
+
+#include "types.h"
+
+#include <vector>
+
+/// <summary>
+/// Precomputed atlas of the one-pixel gaps produced by X-major slopes.
+/// </summary>
+/// <remarks>
+/// Discarding the 9 least significant bits of the span start when computing the span end (see <see cref="Slope"/>)
+/// causes some X-major slopes to skip a pixel between consecutive scanlines. A gap exists between scanlines Y and Y+1
+/// when:
+///
+///    positive slopes: XEnd(Y) + 1 < XStart(Y+1)
+///    negative slopes: XStart(Y+1) + 1 < XEnd(Y)
+///
+/// The atlas stores one bit per scanline pair for every slope from 0x0 to 256x192 in both orientations. Slopes without
+/// gaps take no space in the bitmap. All queries are O(1).
+/// </remarks>
+class GapAtlas {
+public:
+    static constexpr i32 kMaxWidth = 256;
+    static constexpr i32 kMaxHeight = 192;
+
+    /// <summary>
+    /// Computes the gaps of every slope, spreading the work across the specified number of threads.
+    /// </summary>
+    /// <param name="numWorkers">Number of worker threads; 0 uses all hardware threads</param>
+    void Build(size_t numWorkers = 0);
+
+    /// <summary>
+    /// Determines if the slope has at least one gap.
+    /// </summary>
+    bool HasGaps(i32 width, i32 height, bool negative) const {
+        const size_t index = SlopeIndex(width, height, negative);
+        return m_gapCounts[index] != 0;
+    }
+
+    /// <summary>
+    /// Determines if there is a gap between scanlines Y and Y+1 of the slope.
+    /// </summary>
+    bool HasGap(i32 width, i32 height, bool negative, i32 y) const {
+        const size_t index = SlopeIndex(width, height, negative);
+        if (m_gapCounts[index] == 0 || y < 0 || y >= height) {
+            return false;
+        }
+        const size_t bit = m_bitOffsets[index] + y;
+        return (m_bits[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    /// <summary>
+    /// Returns the number of gaps in the slope.
+    /// </summary>
+    u32 GapCount(i32 width, i32 height, bool negative) const {
+        return m_gapCounts[SlopeIndex(width, height, negative)];
+    }
+
+    /// <summary>
+    /// Invokes func(y) for every scanline Y of the slope that is followed by a gap.
+    /// </summary>
+    template <typename Func>
+    void ForEachGap(i32 width, i32 height, bool negative, Func &&func) const {
+        const size_t index = SlopeIndex(width, height, negative);
+        if (m_gapCounts[index] == 0) {
+            return;
+        }
+        const size_t offset = m_bitOffsets[index];
+        for (i32 y = 0; y < height; y++) {
+            const size_t bit = offset + y;
+            if ((m_bits[bit / 64] >> (bit % 64)) & 1) {
+                func(y);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Returns the total number of gaps across all slopes.
+    /// </summary>
+    u64 TotalGaps() const {
+        return m_totalGaps;
+    }
+
+    /// <summary>
+    /// Returns the size of the atlas in bytes.
+    /// </summary>
+    size_t MemorySize() const {
+        return m_bits.size() * sizeof(u64) + m_bitOffsets.size() * sizeof(u32) + m_gapCounts.size() * sizeof(u8);
+    }
+
+private:
+    static constexpr size_t kNumSlopes = (kMaxWidth + 1) * (kMaxHeight + 1) * 2;
+
+    static size_t SlopeIndex(i32 width, i32 height, bool negative) {
+        return ((size_t)negative * (kMaxHeight + 1) + height) * (kMaxWidth + 1) + width;
+    }
+
+    std::vector<u64> m_bits;        // Gap bitmaps of all slopes with gaps, one bit per scanline
+    std::vector<u32> m_bitOffsets;  // Offset of each slope's bitmap in m_bits, in bits
+    std::vector<u8> m_gapCounts;    // Number of gaps in each slope
+    u64 m_totalGaps = 0;
+};
@@ -1,9 +1,11 @@
 #include "interactive_eval.h"
 
 #include "dataset.h"
+#include "formula_ir.h"
 #include "func.h"
 
 #include <algorithm>
+#include <array>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -115,13 +117,23 @@ bool GroupFromName(std::string name, Group &group) {
 class InteractiveEvaluator {
 public:
     InteractiveEvaluator(DataSet &&dataset)
-        : m_dataset(dataset) {}
+        : m_dataset(dataset) {
+        for (Group group : kGroups) {
+            auto &features = m_features[(size_t)group];
+            for (auto &dataPoint : GetDataSet(group)) {
+                features.push_back(Evaluator::Features(dataPoint, GroupPositive(group), GroupLeft(group)));
+            }
+        }
+    }
 
     template <typename Func>
     bool Eval(Group group, Func &&func) {
-        for (auto &dataPoint : GetDataSet(group)) {
-            if (i32 result; m_eval.Eval(dataPoint, GroupPositive(group), GroupLeft(group), result)) {
-                func(dataPoint, result);
+        auto &dataSet = GetDataSet(group);
+        auto &features = m_features[(size_t)group];
+        m_eval.Compile();
+        for (size_t i = 0; i < dataSet.size(); i++) {
+            if (i32 result; m_eval.Eval(features[i], result)) {
+                func(dataSet[i], result);
             } else {
                 return false;
             }
@@ -131,9 +143,13 @@ public:
 
     template <typename Func>
     bool Eval(Group group, i32 width, i32 height, Func &&func) {
-        for (auto &dataPoint : GetDataSet(group)) {
+        auto &dataSet = GetDataSet(group);
+        auto &features = m_features[(size_t)group];
+        m_eval.Compile();
+        for (size_t i = 0; i < dataSet.size(); i++) {
+            auto &dataPoint = dataSet[i];
             if (dataPoint.width == width && dataPoint.height == height) {
-                if (i32 result; m_eval.Eval(dataPoint, GroupPositive(group), GroupLeft(group), result)) {
+                if (i32 result; m_eval.Eval(features[i], result)) {
                     func(dataPoint, result);
                 } else {
                     return false;
@@ -229,6 +245,7 @@ public:
 
 private:
     DataSet m_dataset;
+    std::array<std::vector<DataPointFeatures>, std::size(kGroups)> m_features; // Indexed by Group, then data point
     Evaluator m_eval;
 
     bool m_stepEvalActive = false;
@@ -625,6 +642,16 @@ void func(InteractiveContext &ctx, const std::vector<std::string> &) {
     util::displayFormula(ctx.eval.Operations(), "   ");
 }
 
+void ir(InteractiveContext &ctx, const std::vector<std::string> &) {
+    FormulaIR ir;
+    if (!ir.Build(ctx.eval.Operations())) {
+        std::cout << "The formula fails on every data point or uses rot/revrot with a non-constant count.\n";
+        return;
+    }
+    ir.Print(std::cout);
+    std::cout << ctx.eval.Operations().size() << " operations -> " << ir.NumOperations() << " IR operations\n";
+}
+
 auto opTemplates = [] {
     std::map<std::string, Operation> templates;
     for (auto op : kOperators) {
@@ -847,6 +874,9 @@ void initCommands() {
         "    width and height: size of the slope to dump");
 
     add({"f", "fm", "formula"}, command::func, "Displays the current formula's operations.");
+    add({"ir"}, command::ir,
+        "Displays the current formula translated to SSA form, with stack operations and common subexpressions "
+        "eliminated.");
     add({"addop"}, command::addOp,
         "Adds one or more operations to the formula.\n"
         "  Arguments: op [op ...] [pos = -1]\n"
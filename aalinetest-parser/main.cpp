@@ -1,9 +1,14 @@
 #include "biasdataset.h"
+#include "coverage_lut.h"
 #include "dataset.h"
 #include "file.h"
+#include "formula_opt.h"
 #include "func_generator.h"
 #include "func_search.h"
+#include "ga_cluster.h"
+#include "gap_atlas.h"
 #include "interactive_eval.h"
+#include "rasterizer.h"
 #include "tester.h"
 
 #define WIN32_LEAN_AND_MEAN
@@ -15,10 +20,232 @@
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 
-int main() {
+// Usage: validate [options] <capture.bin>...
+//   --sweeps=[x][y][d]  sweeps to run: X-major, Y-major and/or diagonals (default: all)
+//   --threads=N         number of worker threads (default: all hardware threads)
+//   --per-size          report mismatches per width and height
+int mainValidate(int argc, char *argv[]) {
+    ValidationOptions options{};
+    bool perSize = false;
+    std::vector<std::unique_ptr<Data>> captures;
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.starts_with("--sweeps=")) {
+            std::string sweeps = arg.substr(9);
+            options.xMajor = sweeps.find('x') != std::string::npos;
+            options.yMajor = sweeps.find('y') != std::string::npos;
+            options.diagonals = sweeps.find('d') != std::string::npos;
+        } else if (arg.starts_with("--threads=")) {
+            options.numWorkers = std::stoul(arg.substr(10));
+        } else if (arg == "--per-size") {
+            perSize = true;
+        } else if (auto data = readFile(arg)) {
+            captures.push_back(std::move(data));
+        } else {
+            return EXIT_FAILURE;
+        }
+    }
+    if (captures.empty()) {
+        std::cout << "No captures specified\n";
+        return EXIT_FAILURE;
+    }
+
+    std::vector<const Data *> capturePtrs;
+    for (auto &data : captures) {
+        capturePtrs.push_back(data.get());
+    }
+
+    auto t1 = std::chrono::steady_clock::now();
+    auto report = std::make_unique<ValidationReport>(validate(capturePtrs, options));
+    auto t2 = std::chrono::steady_clock::now();
+    std::cout << "Validated in " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1) << "\n";
+    report->Print(std::cout, perSize);
+    return report->total.numMatches == report->total.testedPixels ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// --------------------------------------------------------------------------------
+
+// Usage: lut build|check <table.bin> [--threads=N]
+//   build  computes the coverage table and writes it to the file
+//   check  loads the table from the file and compares it against the current Slope formulas
+int mainLUT(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: lut build|check <table.bin> [--threads=N]\n";
+        return EXIT_FAILURE;
+    }
+    const std::string command = argv[0];
+    const std::filesystem::path path = argv[1];
+    size_t numWorkers = 0;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.starts_with("--threads=")) {
+            numWorkers = std::stoul(arg.substr(10));
+        }
+    }
+
+    auto lut = std::make_unique<CoverageLUT>();
+    if (command == "build") {
+        auto t1 = std::chrono::steady_clock::now();
+        lut->Build(numWorkers);
+        auto t2 = std::chrono::steady_clock::now();
+        std::cout << "Built coverage table in " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1)
+                  << ": " << lut->MemorySize() << " bytes\n";
+        if (!lut->Save(path)) {
+            std::cout << "Could not write " << path.string() << "\n";
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    if (command == "check") {
+        if (!lut->Load(path)) {
+            std::cout << path.string() << " is not a valid coverage table\n";
+            return EXIT_FAILURE;
+        }
+        const u64 mismatches = lut->Verify(numWorkers);
+        std::cout << mismatches << " mismatched pixels\n";
+        return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    std::cout << "Unknown command: " << command << "\n";
+    return EXIT_FAILURE;
+}
+
+// --------------------------------------------------------------------------------
+
+// Usage: coordinator <address>...
+//   runs a search spread over the processes that join on any of the addresses, which may be
+//   tcp://host:port, unix:///path or shm://name, until one of them finds a valid formula
+int mainCoordinator(int argc, char *argv[]) {
+    if (argc < 1) {
+        std::cout << "Usage: coordinator <address>...\n";
+        return EXIT_FAILURE;
+    }
+    GACoordinator coordinator;
+    for (int i = 0; i < argc; i++) {
+        if (!coordinator.Listen(argv[i])) {
+            std::cout << "Could not listen on " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    while (!coordinator.IsSolved()) {
+        std::this_thread::sleep_for(std::chrono::seconds{1});
+        const auto best = coordinator.BestChromosome();
+        std::cout << "Best: fitness=" << best.fitness << ", errors=" << best.numErrors << "\n";
+        for (auto &node : coordinator.Nodes()) {
+            std::cout << "  Node " << node.id << ": generation " << node.generation << ", " << node.resetCount
+                      << " resets, best fitness " << node.bestFitness << ", " << node.migrantsSent
+                      << " migrants sent\n";
+        }
+    }
+
+    std::cout << "Solution:";
+    for (auto &op : coordinator.Solution()) {
+        std::cout << ' ' << op.Str();
+    }
+    std::cout << "\n";
+    return EXIT_SUCCESS;
+}
+
+// --------------------------------------------------------------------------------
+
+// Usage: cluster-check [address]
+//   runs a coordinator on the address (default: tcp://127.0.0.1:7155) and two small searches that join it, and checks
+//   that migrants are relayed between them and that the one that can't solve its data points is told to stop once the
+//   other one solves its own
+int mainClusterCheck(int argc, char *argv[]) {
+    const std::string address = argc >= 1 ? argv[0] : "tcp://127.0.0.1:7155";
+
+    std::vector<Operation> templateOps;
+    for (auto op : kOperators) {
+        templateOps.push_back(Operation{.type = Operation::Type::Operator, .op = op});
+    }
+    for (i32 value : {0, 1, 2, 3}) {
+        templateOps.push_back(Operation{.type = Operation::Type::Constant, .constVal = value});
+    }
+
+    // The first search looks for x + y; the second one gets contradictory data points and never finishes on its own
+    std::vector<ExtDataPoint> solvable;
+    std::vector<ExtDataPoint> unsolvable;
+    for (i32 i = 0; i < 8; i++) {
+        const DataPoint dp{.x = i * 7, .y = i * 3, .width = 64 + i, .height = 16 + i * 5, .expectedOutput = i * 10};
+        solvable.push_back({.dp = dp, .upperBound = dp.expectedOutput, .left = true, .positive = true});
+        unsolvable.push_back({.dp = dp, .upperBound = 0, .left = true, .positive = true});
+        unsolvable.back().dp.expectedOutput = 0;
+        unsolvable.push_back({.dp = dp, .upperBound = 1, .left = true, .positive = true});
+        unsolvable.back().dp.expectedOutput = 1;
+    }
+
+    GACoordinator coordinator;
+    if (!coordinator.Listen(address)) {
+        std::cout << "Could not listen on " << address << "\n";
+        return EXIT_FAILURE;
+    }
+
+    const GAFuncSearch::Config config{.numWorkers = 2, .popSize = 100, .numOps = 16};
+    const GANode::Config nodeConfig{.exchangeInterval = std::chrono::milliseconds{100}};
+    GAFuncSearch solver{".", config};
+    GAFuncSearch staller{".", config};
+    GANode solverNode{solver, nodeConfig};
+    GANode stallerNode{staller, nodeConfig};
+    solver.SetTemplateOps(templateOps);
+    staller.SetTemplateOps(templateOps);
+    solver.SetFixedDataPoints(solvable);
+    staller.SetFixedDataPoints(unsolvable);
+    if (!stallerNode.Connect(address) || !solverNode.Connect(address)) {
+        std::cout << "Could not join the search at " << address << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // Hold the solver back until migrants flowed both ways
+    staller.Start();
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{30};
+    while (stallerNode.GetStats().migrantsSent == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    solver.Start();
+    while (!stallerNode.IsStopRequested() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    solver.Stop();
+    staller.Stop();
+
+    const auto solverStats = solverNode.GetStats();
+    const auto stallerStats = stallerNode.GetStats();
+    std::cout << "Solver: " << solverStats.migrantsSent << " migrants sent, " << solverStats.migrantsReceived
+              << " received, solved: " << solver.IsSolved() << "\n";
+    std::cout << "Staller: " << stallerStats.migrantsSent << " migrants sent, " << stallerStats.migrantsReceived
+              << " received, stop requested: " << stallerNode.IsStopRequested() << "\n";
+    const bool passed = solver.IsSolved() && coordinator.IsSolved() && stallerNode.IsStopRequested() &&
+                        !staller.IsSolved() && solverStats.migrantsReceived > 0 && stallerStats.migrantsReceived > 0;
+    std::cout << (passed ? "Passed" : "Failed") << "\n";
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// --------------------------------------------------------------------------------
+
+int main5(int argc, char *argv[]);
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "validate") {
+        return mainValidate(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "lut") {
+        return mainLUT(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "coordinator") {
+        return mainCoordinator(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "cluster-check") {
+        return mainClusterCheck(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "search") {
+        return main5(argc - 2, argv + 2);
+    }
+
     // convertScreenCap("data/screencap.bin", "data/screencap.tga");
     // uniqueColors("data/screencap.bin");
 
@@ -143,7 +370,22 @@ int main4() {
 
 // --------------------------------------------------------------------------------
 
-int main5() {
+// Usage: search [--coordinator=ADDR] [--node=ADDR]
+//   --coordinator=ADDR  runs a coordinator on the address (tcp://host:port, unix:///path or shm://name) and joins it,
+//                       so that other processes can join the search with --node
+//   --node=ADDR         joins the search run by the coordinator at the address
+int main5(int argc, char *argv[]) {
+    std::string coordinatorAddress;
+    std::string nodeAddress;
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.starts_with("--coordinator=")) {
+            coordinatorAddress = arg.substr(14);
+        } else if (arg.starts_with("--node=")) {
+            nodeAddress = arg.substr(7);
+        }
+    }
+
     constexpr i32 kConstants[] = {
         -1,
         Slope::kAARange,
@@ -1112,10 +1354,39 @@ int main5() {
 
     Context ctx;
 
-    auto pga = std::make_unique<GAFuncSearch>("E:/Development/_refs/NDS/Research/Antialiasing");
+    // Pick up where the last run left off
+    const std::filesystem::path checkpointPath = "ga_checkpoint.bin";
+    std::unique_ptr<GAFuncSearch> pga;
+    if (GAFuncSearch::Checkpoint checkpoint; checkpoint.Load(checkpointPath)) {
+        std::cout << "Resuming from generation " << checkpoint.generation << "\n";
+        pga = std::make_unique<GAFuncSearch>("E:/Development/_refs/NDS/Research/Antialiasing", checkpoint);
+    } else {
+        pga = std::make_unique<GAFuncSearch>("E:/Development/_refs/NDS/Research/Antialiasing");
+    }
     auto &ga = *pga;
     ga.SetTemplateOps(templateOps);
     ga.SetFixedDataPoints(dataPoints);
+    // ga.SetValidationDataSet(loadXMajorDataSet("E:/Development/_refs/NDS/Research/Antialiasing"));
+    ga.SetFitnessEvaluator(FormulaJIT::IsSupported() ? GAFuncSearch::FitnessEvaluator::JIT
+                                                     : GAFuncSearch::FitnessEvaluator::Columns);
+    // ga.SetFitnessEvaluator(GAFuncSearch::FitnessEvaluator::JIT, FormulaJIT::Mode::SelfCheck);
+
+    // Spread the search over several processes
+    GACoordinator coordinator;
+    if (!coordinatorAddress.empty()) {
+        if (!coordinator.Listen(coordinatorAddress)) {
+            std::cout << "Could not listen on " << coordinatorAddress << "\n";
+            return EXIT_FAILURE;
+        }
+        if (nodeAddress.empty()) {
+            nodeAddress = coordinatorAddress;
+        }
+    }
+    GANode node{ga};
+    if (!nodeAddress.empty() && !node.Connect(nodeAddress)) {
+        std::cout << "Could not join the search at " << nodeAddress << "\n";
+        return EXIT_FAILURE;
+    }
 
     auto updateInterval = 1000ms;
     auto t = clk::now();
@@ -1123,6 +1394,8 @@ int main5() {
     auto t0 = t;
     auto tsleep = t + updateInterval;
     ga.SetResetCallback([&] { ts = clk::now(); });
+    ga.Start();
+    ga.StartCheckpointing(checkpointPath, 5min);
 
     auto hndConsole = GetStdHandle(STD_OUTPUT_HANDLE);
     CONSOLE_CURSOR_INFO cursorInfo;
@@ -1151,7 +1424,7 @@ int main5() {
     };
 
     auto printChrom = [&](const GAFuncSearch::Chromosome &chrom, bool printDisabled) {
-        for (auto &gene : chrom.genes) {
+        for (auto &gene : ga.Genes(chrom)) {
             if (printDisabled) {
                 std::cout << ' ';
                 if (gene.enabled) {
@@ -1171,6 +1444,7 @@ int main5() {
         SetConsoleCursorInfo(hndConsole, &cursorInfo);
         SetConsoleCursorPosition(hndConsole, cursorPos);
         const auto &best = ga.BestChromosome();
+        const auto bestGenes = ga.Genes(best);
         const auto resetCount = ga.ResetCount();
         auto duration = t - ts;
         auto totalDuration = t - t0;
@@ -1184,12 +1458,43 @@ int main5() {
         std::cout << "    Total time: " << std::fixed << std::setprecision(3)
                   << (std::chrono::duration_cast<std::chrono::milliseconds>(totalDuration).count() / 1000.0) << " sec";
         newLine();
+        const auto cacheStats = ga.FitnessCacheStats();
+        std::cout << "  Fitness cache: " << cacheStats.entries << "/" << cacheStats.capacity << " entries ("
+                  << cacheStats.memorySize / 1024 / 1024 << " MiB)    Hit rate: " << std::fixed << std::setprecision(2)
+                  << cacheStats.HitRate() * 100.0 << "% of " << (cacheStats.hits + cacheStats.misses)
+                  << "    Evictions: " << cacheStats.evictions;
+        newLine();
+        const auto testSetStats = ga.TestSetStats();
+        std::cout << "  Test set: " << testSetStats.numFixed << " fixed + " << testSetStats.numDynamic << " of "
+                  << testSetStats.numValidation << " validation data points    Validations: "
+                  << testSetStats.validations << "    Added: " << testSetStats.added
+                  << "    Expired: " << testSetStats.expired;
+        newLine();
+        const auto diversity = ga.Diversity();
+        std::cout << "  Diversity: " << std::fixed << std::setprecision(2) << diversity.DistinctRate() * 100.0
+                  << "% distinct elites    Mean distance to best: " << diversity.MeanEliteDistance()
+                  << "    Cleared: " << diversity.cleared;
+        newLine();
         std::cout << "  Best chromosome: fitness=" << best.fitness << ", errors=" << best.numErrors
                   << ", stack size=" << best.stackSize << ", generation=" << best.generation;
         newLine();
         std::cout << "  Function:";
         printChrom(best, true);
         newLine();
+        std::cout << "  Optimized:";
+        {
+            std::vector<Operation> ops;
+            for (auto &gene : bestGenes) {
+                if (gene.enabled) {
+                    ops.push_back(gene.op);
+                }
+            }
+            OptimizeFormula(ops);
+            for (auto &op : ops) {
+                std::cout << ' ' << op.Str();
+            }
+        }
+        newLine();
 
         for (auto &dp : dataPoints) {
             ctx.slope = dp.slope;
@@ -1197,7 +1502,7 @@ int main5() {
             ctx.vars.Apply(dp.dp, dp.left);
 
             bool valid = true;
-            for (auto &gene : best.genes) {
+            for (auto &gene : bestGenes) {
                 if (!gene.enabled) {
                     continue;
                 }
@@ -1263,8 +1568,7 @@ int main5() {
             }
             printBest(false);
         }
-        const auto &best = ga.BestChromosome();
-        if (best.fitness == 0) {
+        if (ga.IsSolved() || node.IsStopRequested()) {
             ga.Stop();
             break;
         }
@@ -1530,3 +1834,55 @@ int main7() {
 
     return EXIT_SUCCESS;
 }
+
+// --------------------------------------------------------------------------------
+
+int main8() {
+    for (const char *name : {"T.bin", "B.bin"}) {
+        auto data = readFile(std::filesystem::path("E:/Development/_refs/NDS/Research/Antialiasing") / name);
+        if (!data) {
+            continue;
+        }
+
+        auto t1 = std::chrono::steady_clock::now();
+        auto diff = diffCapture(*data);
+        auto t2 = std::chrono::steady_clock::now();
+
+        std::cout << "Rasterized " << diff.numTargets << " targets in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1) << "\n";
+        std::cout << "## Accuracy: " << diff.numMatches << " / " << diff.testedPixels << " (" << std::fixed
+                  << std::setprecision(2) << ((double)diff.numMatches / diff.testedPixels * 100.0) << "%)\n";
+        std::cout << "mismatched targets: " << diff.mismatchedTargets << "\n";
+        std::cout << "overshoot: " << diff.overshoot << "\n";
+        std::cout << "undershoot: " << diff.undershoot << "\n";
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// --------------------------------------------------------------------------------
+
+int main9() {
+    auto atlas = std::make_unique<GapAtlas>();
+    auto t1 = std::chrono::steady_clock::now();
+    atlas->Build();
+    auto t2 = std::chrono::steady_clock::now();
+    std::cout << "Built gap atlas in " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1) << ": "
+              << atlas->TotalGaps() << " gaps, " << atlas->MemorySize() << " bytes\n";
+
+    for (i32 h = 0; h <= GapAtlas::kMaxHeight; h++) {
+        for (i32 w = h + 1; w <= GapAtlas::kMaxWidth; w++) {
+            for (bool negative : {false, true}) {
+                if (!atlas->HasGaps(w, h, negative)) {
+                    continue;
+                }
+                std::cout << std::setw(3) << std::right << w << 'x' << std::setw(3) << std::left << h << "  "
+                          << (negative ? 'N' : 'P') << "  gaps after y =";
+                atlas->ForEachGap(w, h, negative, [](i32 y) { std::cout << ' ' << y; });
+                std::cout << '\n';
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
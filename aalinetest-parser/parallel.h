@@ -0,0 +1,27 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline size_t defaultWorkerCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs func(index, workerIndex) for every index in [0, count), handing out indices to numWorkers threads on demand.
+// workerIndex is in [0, numWorkers) and can be used to address per-thread state without synchronization.
+template <typename Func>
+void parallelFor(size_t count, size_t numWorkers, Func &&func) {
+    numWorkers = std::clamp<size_t>(numWorkers, 1, std::max<size_t>(count, 1));
+    std::atomic_size_t nextIndex{0};
+    std::vector<std::jthread> workers;
+    workers.reserve(numWorkers);
+    for (size_t i = 0; i < numWorkers; i++) {
+        workers.emplace_back([&, workerIndex = i] {
+            for (size_t index = nextIndex++; index < count; index = nextIndex++) {
+                func(index, workerIndex);
+            }
+        });
+    }
+}
@@ -0,0 +1,226 @@
+#include "rasterizer.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <vector>
+
+void TriangleRasterizer::Setup(u8 testType, i32 targetX, i32 targetY) {
+    // Edge side per test:
+    //           A     B
+    // TOP      left  right
+    // BOTTOM   left  right
+    // LEFT     right right
+    // RIGHT    left  left
+    m_type = testType;
+    const i32 originAX = (testType != TEST_RIGHT) ? 0 : 256;
+    const i32 originAY = (testType != TEST_BOTTOM) ? 0 : 192;
+    const i32 originBX = (testType != TEST_LEFT) ? 256 : 0;
+    const i32 originBY = (testType != TEST_TOP) ? 192 : 0;
+    SetupEdge(m_edgeA, originAX, originAY, targetX, targetY, testType != TEST_LEFT);
+    SetupEdge(m_edgeB, originBX, originBY, targetX, targetY, testType == TEST_RIGHT);
+}
+
+void TriangleRasterizer::SetupEdge(Edge &edge, i32 originX, i32 originY, i32 targetX, i32 targetY, bool left) {
+    edge.slope.Setup(originX, originY, targetX, targetY, left);
+
+    edge.startY = originY;
+    edge.endY = targetY;
+    if (edge.startY == edge.endY) {
+        // Y0 == Y1 is drawn as a single line
+        edge.endY++;
+    } else if (edge.startY > edge.endY) {
+        // Scan from top to bottom
+        std::swap(edge.startY, edge.endY);
+    }
+
+    // Restrict to visible area
+    if (edge.endY > CoverageFrame::kHeight) {
+        edge.endY = CoverageFrame::kHeight;
+    }
+}
+
+void TriangleRasterizer::PlotEdge(CoverageFrame &frame, const Edge &edge, i32 y) const {
+    const Slope &slope = edge.slope;
+    i32 startX = slope.XStart(y);
+    i32 endX = slope.XEnd(y);
+    if ((m_type == TEST_TOP || m_type == TEST_BOTTOM) && slope.Height() == 0) {
+        // The horizontal line along the screen border overrides the slope; only the leftmost pixel of the left edge
+        // keeps its own coverage
+        for (i32 x = std::min(startX, endX); x <= std::max(startX, endX); x++) {
+            frame.Plot(x, y, CoverageFrame::Kind::Border, CoverageFrame::kFullCoverage);
+        }
+        if (slope.IsNegative() == slope.IsLeftEdge()) {
+            startX = endX;
+        } else {
+            endX = startX;
+        }
+    }
+    if (startX > endX) {
+        std::swap(startX, endX);
+    }
+    for (i32 x = startX; x <= endX; x++) {
+        frame.Plot(x, y, CoverageFrame::Kind::Edge, slope.AACoverage(x, y));
+    }
+}
+
+void TriangleRasterizer::Render(CoverageFrame &frame) const {
+    frame.Clear();
+
+    const bool leftBorder = (m_type == TEST_LEFT);
+
+    for (i32 y = 0; y < CoverageFrame::kHeight; y++) {
+        const bool activeA = m_edgeA.Contains(y);
+        const bool activeB = m_edgeB.Contains(y);
+        if (!activeA && !activeB) {
+            continue;
+        }
+
+        // Determine the extents of the left and right edges on this scanline
+        i32 leftEnd = leftBorder ? 0 : -1;
+        i32 rightStart = CoverageFrame::kWidth;
+        auto extend = [&](const Edge &edge) {
+            const Slope &slope = edge.slope;
+            const i32 startX = slope.XStart(y);
+            const i32 endX = slope.XEnd(y);
+            if (slope.IsLeftEdge()) {
+                leftEnd = std::max(leftEnd, std::max(startX, endX));
+            } else {
+                rightStart = std::min(rightStart, std::min(startX, endX));
+            }
+        };
+        if (activeA) {
+            extend(m_edgeA);
+        }
+        if (activeB) {
+            extend(m_edgeB);
+        }
+
+        // Fill the polygon interior
+        for (i32 x = leftEnd + 1; x < rightStart; x++) {
+            frame.Plot(x, y, CoverageFrame::Kind::Interior, CoverageFrame::kFullCoverage);
+        }
+
+        // Draw right edges first so that left edges take precedence where they overlap
+        for (const Edge *edge : {&m_edgeA, &m_edgeB}) {
+            if (edge->Contains(y) && edge->slope.IsRightEdge()) {
+                PlotEdge(frame, *edge, y);
+            }
+        }
+        for (const Edge *edge : {&m_edgeA, &m_edgeB}) {
+            if (edge->Contains(y) && edge->slope.IsLeftEdge()) {
+                PlotEdge(frame, *edge, y);
+            }
+        }
+
+        if (leftBorder) {
+            // The Left test draws a vertical line on the left side of the screen which is considered a left edge in
+            // all cases, and thus overrides all pixels at X=0.
+            frame.Plot(0, y, CoverageFrame::Kind::Border, CoverageFrame::kFullCoverage);
+        }
+    }
+}
+
+RasterDiff &RasterDiff::operator+=(const RasterDiff &rhs) {
+    numTargets += rhs.numTargets;
+    mismatchedTargets += rhs.mismatchedTargets;
+    testedPixels += rhs.testedPixels;
+    numMatches += rhs.numMatches;
+    overshoot += rhs.overshoot;
+    undershoot += rhs.undershoot;
+    return *this;
+}
+
+// Runs func(x, y, frame, workerIndex) for every target in the range, spreading target rows across the workers.
+// Each worker owns a CoverageFrame that is passed to func.
+template <typename Func>
+static void forEachTarget(size_t numWorkers, u16 minX, u16 maxX, u8 minY, u8 maxY, Func &&func) {
+    std::vector<std::unique_ptr<CoverageFrame>> frames(numWorkers);
+    parallelFor(maxY - minY + 1, numWorkers, [&](size_t row, size_t worker) {
+        if (!frames[worker]) {
+            frames[worker] = std::make_unique<CoverageFrame>();
+        }
+        const i32 y = minY + (i32)row;
+        for (i32 x = minX; x <= maxX; x++) {
+            func(x, y, *frames[worker], worker);
+        }
+    });
+}
+
+std::unique_ptr<Data> rasterizeCapture(u8 type, u16 minX, u16 maxX, u8 minY, u8 maxY) {
+    auto pData = std::make_unique<Data>();
+    pData->type = type;
+    pData->minX = minX;
+    pData->maxX = maxX;
+    pData->minY = minY;
+    pData->maxY = maxY;
+
+    forEachTarget(defaultWorkerCount(), minX, maxX, minY, maxY, [&](i32 x, i32 y, CoverageFrame &frame, size_t) {
+        TriangleRasterizer rasterizer;
+        rasterizer.Setup(type, x, y);
+        rasterizer.Render(frame);
+
+        // Convert each run of drawn pixels into a span
+        auto &line = pData->lines[y][x];
+        for (i32 yy = 0; yy < CoverageFrame::kHeight; yy++) {
+            auto &kinds = frame.kinds[yy];
+            i32 xx = 0;
+            while (xx < CoverageFrame::kWidth) {
+                if (kinds[xx] == CoverageFrame::Kind::Empty) {
+                    xx++;
+                    continue;
+                }
+                i32 start = xx;
+                while (xx < CoverageFrame::kWidth && kinds[xx] != CoverageFrame::Kind::Empty) {
+                    xx++;
+                }
+                line.Add(start, yy, std::span(frame.coverage[yy].begin() + start, frame.coverage[yy].begin() + xx));
+            }
+        }
+    });
+
+    return pData;
+}
+
+RasterDiff diffCapture(const Data &data) {
+    const size_t numWorkers = defaultWorkerCount();
+    std::vector<RasterDiff> workerDiffs(numWorkers);
+
+    auto diffTarget = [&](i32 x, i32 y, CoverageFrame &frame, size_t worker) {
+        TriangleRasterizer rasterizer;
+        rasterizer.Setup(data.type, x, y);
+        rasterizer.Render(frame);
+
+        RasterDiff diff{};
+        diff.numTargets = 1;
+        auto &line = data.lines[y][x];
+        for (i32 yy = 0; yy < CoverageFrame::kHeight; yy++) {
+            for (i32 xx = 0; xx < CoverageFrame::kWidth; xx++) {
+                if (frame.kinds[yy][xx] != CoverageFrame::Kind::Edge) {
+                    continue;
+                }
+                const u8 coverage = frame.coverage[yy][xx];
+                const u8 pixel = line.Pixel(xx, yy);
+                diff.testedPixels++;
+                if (coverage == pixel) {
+                    diff.numMatches++;
+                } else if (coverage > pixel) {
+                    diff.overshoot += coverage - pixel;
+                } else {
+                    diff.undershoot += pixel - coverage;
+                }
+            }
+        }
+        if (diff.numMatches != diff.testedPixels) {
+            diff.mismatchedTargets = 1;
+        }
+        workerDiffs[worker] += diff;
+    };
+    forEachTarget(numWorkers, data.minX, data.maxX, data.minY, data.maxY, diffTarget);
+
+    RasterDiff total{};
+    for (auto &diff : workerDiffs) {
+        total += diff;
+    }
+    return total;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "slope.h"
+#include "types.h"
+
+#include <array>
+#include <memory>
+
+/// <summary>
+/// A full-screen antialiasing coverage frame produced by the software rasterizer.
+/// </summary>
+struct CoverageFrame {
+    static constexpr i32 kWidth = 256;
+    static constexpr i32 kHeight = 192;
+
+    /// <summary>
+    /// The coverage value of pixels that are fully covered by the polygon (interior and screen border edges).
+    /// </summary>
+    static constexpr u8 kFullCoverage = Slope::kAARange - 1;
+
+    enum class Kind : u8 {
+        Empty,    // Pixel not drawn
+        Interior, // Pixel inside the polygon
+        Border,   // Pixel of an edge running along the screen border
+        Edge,     // Pixel of one of the tested slopes
+    };
+
+    std::array<std::array<u8, kWidth>, kHeight> coverage;
+    std::array<std::array<Kind, kWidth>, kHeight> kinds;
+
+    void Clear() {
+        for (auto &row : coverage) {
+            row.fill(0);
+        }
+        for (auto &row : kinds) {
+            row.fill(Kind::Empty);
+        }
+    }
+
+    void Plot(i32 x, i32 y, Kind kind, u8 value) {
+        if (x < 0 || x >= kWidth || y < 0 || y >= kHeight) {
+            return;
+        }
+        coverage[y][x] = value;
+        kinds[y][x] = kind;
+    }
+};
+
+/// <summary>
+/// Scanline rasterizer for the triangles drawn by the antialiasing tests.
+/// </summary>
+/// <remarks>
+/// Every capture target (X,Y) in T.bin/B.bin is a triangle with two vertices on a screen border and the third at the
+/// target coordinates. The two edges meeting at the target are interpolated with <see cref="Slope"/>; the third edge
+/// runs along the screen border:
+///
+///            vertices                 edge A              edge B
+///    TOP     (0,0)   (256,0)   (X,Y)  (0,0)-(X,Y) L       (256,0)-(X,Y) R
+///    BOTTOM  (0,192) (256,192) (X,Y)  (0,192)-(X,Y) L     (256,192)-(X,Y) R
+///    LEFT    (0,0)   (0,192)   (X,Y)  (0,0)-(X,Y) R       (0,192)-(X,Y) R      left edge is the X=0 border
+///    RIGHT   (256,0) (256,192) (X,Y)  (256,0)-(X,Y) L     (256,192)-(X,Y) L    right edge is the X=256 border
+///
+/// The rasterizer applies the same polygon drawing rules and edge precedences that testSlope() works around:
+/// - Edges with Y0 == Y1 are drawn as a single scanline
+/// - Scanlines are restricted to the visible area
+/// - Left edge pixels take precedence over right edge pixels where the spans overlap
+/// - The Left test's vertical border at X=0 is a left edge in all cases and overrides every pixel at X=0 with full
+///   coverage
+/// - The Top and Bottom tests' horizontal border overrides perfectly horizontal slopes; only the leftmost pixel of the
+///   left edge keeps its own coverage
+/// </remarks>
+class TriangleRasterizer {
+public:
+    /// <summary>
+    /// Configures the triangle for the given test type and target coordinates.
+    /// </summary>
+    /// <param name="testType">One of TEST_TOP, TEST_BOTTOM, TEST_LEFT or TEST_RIGHT</param>
+    /// <param name="targetX">The X coordinate of the target vertex</param>
+    /// <param name="targetY">The Y coordinate of the target vertex</param>
+    void Setup(u8 testType, i32 targetX, i32 targetY);
+
+    /// <summary>
+    /// Renders the triangle into the specified frame, replacing its previous contents.
+    /// </summary>
+    /// <param name="frame">The frame to render to</param>
+    void Render(CoverageFrame &frame) const;
+
+    const Slope &EdgeA() const {
+        return m_edgeA.slope;
+    }
+
+    const Slope &EdgeB() const {
+        return m_edgeB.slope;
+    }
+
+private:
+    struct Edge {
+        Slope slope;
+        i32 startY, endY; // scanline range [startY, endY)
+
+        bool Contains(i32 y) const {
+            return y >= startY && y < endY;
+        }
+    };
+
+    u8 m_type;
+    Edge m_edgeA;
+    Edge m_edgeB;
+
+    void SetupEdge(Edge &edge, i32 originX, i32 originY, i32 targetX, i32 targetY, bool left);
+    void PlotEdge(CoverageFrame &frame, const Edge &edge, i32 y) const;
+};
+
+/// <summary>
+/// Results of comparing rasterized slope pixels against a hardware capture.
+/// </summary>
+struct RasterDiff {
+    u64 numTargets = 0;
+    u64 mismatchedTargets = 0;
+    u64 testedPixels = 0;
+    u64 numMatches = 0;
+    u64 overshoot = 0;
+    u64 undershoot = 0;
+
+    RasterDiff &operator+=(const RasterDiff &rhs);
+};
+
+/// <summary>
+/// Rasterizes every target in the given range into a synthetic capture with the same layout as T.bin/B.bin.
+/// Targets are distributed across all hardware threads.
+/// </summary>
+std::unique_ptr<Data> rasterizeCapture(u8 type, u16 minX, u16 maxX, u8 minY, u8 maxY);
+
+/// <summary>
+/// Rasterizes every target in the hardware capture and compares the slope pixels against it.
+/// Targets are distributed across all hardware threads.
+/// </summary>
+RasterDiff diffCapture(const Data &data);
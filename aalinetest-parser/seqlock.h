@@ -0,0 +1,62 @@
+#pragma once
+
+#include "types.h"
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <thread>
+
+// Fixed-size buffer of 64-bit words with a single writer and any number of readers, guarded by a sequence lock.
+//
+// The writer never waits: it bumps the sequence number to an odd value, stores the words and bumps it again. Readers
+// copy the words and keep the copy only if the sequence number was even and unchanged throughout, so they never
+// observe a partial write. The words are relaxed atomics, which keeps the concurrent accesses well-defined without
+// making them any more expensive than plain loads and stores on x86 and ARM.
+class SeqLockBuffer {
+public:
+    explicit SeqLockBuffer(size_t numWords)
+        : m_words(std::make_unique<std::atomic<u64>[]>(numWords))
+        , m_size(numWords) {}
+
+    size_t Size() const {
+        return m_size;
+    }
+
+    // Publishes new contents. Only one thread may write at a time.
+    void Write(std::span<const u64> words) {
+        const u64 seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < m_size; i++) {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Copies the first words.size() words of the latest contents.
+    // Returns false, leaving garbage in words, if a write was in progress.
+    bool TryRead(std::span<u64> words) const {
+        const u64 seq = m_seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            return false;
+        }
+        for (size_t i = 0; i < words.size(); i++) {
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_seq.load(std::memory_order_relaxed) == seq;
+    }
+
+    // Copies the latest contents, retrying until no write gets in the way
+    void Read(std::span<u64> words) const {
+        while (!TryRead(words)) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    alignas(64) std::atomic<u64> m_seq{0};
+    std::unique_ptr<std::atomic<u64>[]> m_words;
+    size_t m_size;
+};
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "coverage_lut.h"
+
+#include <algorithm>
 #include <cstdint>
 #include <iomanip>
 #include <iostream>
@@ -372,6 +375,12 @@ public:
         //   - Positive gradient: full coverage
         //   - Negative gradient: zero coverage
 
+        if (m_lut != nullptr) {
+            if (const i32 coverage = LookupAACoverage(x, y); coverage >= 0) {
+                return coverage;
+            }
+        }
+
         const auto invertGradient = [&](i32 coverage) -> i32 {
             if (m_covInverted) {
                 coverage ^= kAAFracRange - 1;
@@ -450,6 +459,68 @@ public:
         }
     }
 
+    /// <summary>
+    /// Computes the antialiasing coverage of every pixel of the span at the specified Y coordinate.
+    /// </summary>
+    /// <remarks>
+    /// Produces the same values as calling AACoverage for each pixel of the span, but X-major slopes compute the
+    /// coverage bias once per scanline and step the gradient incrementally across the span.
+    /// </remarks>
+    /// <param name="y">The Y coordinate, which must be between Y0 and Y1 specified in Setup.</param>
+    /// <param name="leftX">Receives the X coordinate of the leftmost pixel of the span</param>
+    /// <param name="out">Receives the coverage values from left to right; must hold at least Width() + 1 entries</param>
+    /// <returns>The number of pixels in the span</returns>
+    constexpr i32 SpanAACoverage(i32 y, i32 &leftX, uint8_t *out) const {
+        const i32 startX = XStart(y);
+        const i32 endX = XEnd(y);
+        const i32 left = std::min(startX, endX);
+        const i32 right = std::max(startX, endX);
+        const i32 count = right - left + 1;
+        leftX = left;
+
+        // Same bias computations as FracAACoverage; the gradient originates at the leftmost pixel of the span
+        i32 coverage = -1;
+        if (m_xMajor && m_width != 0 && m_height != 0) {
+            if (m_negative && left == endX) {
+                coverage = (((2 * (m_x0 - 1 - endX) + 1) * m_height * kAAFracRange) / (2 * m_width)) % kAAFracRange;
+                coverage ^= kAAFracRange - 1;
+            } else if (!m_negative && left == startX) {
+                coverage = (((2 * (startX - m_x0) + 1) * m_height * kAAFracRange) / (2 * m_width)) % kAAFracRange;
+                if (coverage + m_covStep >= (i32)kAAFracRange && startX != endX) {
+                    coverage ^= kAAFracRange - 1;
+                }
+            }
+        }
+        if (coverage < 0) {
+            for (i32 i = 0; i < count; i++) {
+                out[i] = AACoverage(left + i, y);
+            }
+            return count;
+        }
+
+        const i32 outputXor = m_negative ? kAAFracRange - 1 : 0;
+        for (i32 i = 0; i < count; i++) {
+            out[i] = (coverage ^ outputXor) >> kAAFracBits;
+            coverage += m_covStep;
+            if (coverage >= (i32)kAAFracRange) {
+                coverage -= kAAFracRange;
+            }
+        }
+        return count;
+    }
+
+    /// <summary>
+    /// Answers antialiasing coverage queries from the specified table instead of computing them.
+    /// </summary>
+    /// <remarks>
+    /// Slopes larger than the table and pixels outside the slope's spans are still computed. The table must outlive
+    /// the slope. The setting is preserved across calls to Setup.
+    /// </remarks>
+    /// <param name="lut">The coverage table, or nullptr to compute all coverage values</param>
+    constexpr void UseCoverageLUT(const CoverageLUT *lut) {
+        m_lut = lut;
+    }
+
     i32 AACoverageStep() const {
         return m_covStep;
     }
@@ -459,6 +530,24 @@ public:
     }
 
 private:
+    /// <summary>
+    /// Looks up the antialiasing coverage at the specified coordinates from the coverage table.
+    /// </summary>
+    /// <returns>The antialiasing coverage value at (X,Y), or -1 if the table doesn't cover the pixel</returns>
+    constexpr i32 LookupAACoverage(i32 x, i32 y) const {
+        const i32 row = y - m_y0;
+        if (!CoverageLUT::Contains(m_width, m_height) || row < 0 || row > m_height) {
+            return -1;
+        }
+        const i32 startX = XStart(y);
+        const i32 endX = XEnd(y);
+        const i32 leftX = std::min(startX, endX);
+        if (x < leftX || x > std::max(startX, endX)) {
+            return -1;
+        }
+        return m_lut->FracAACoverage(m_width, m_height, m_negative, m_leftEdge, x - leftX, row);
+    }
+
     i32 m_x0;           // X0 coordinate
     i32 m_x0Frac;       // Fractional X0 coordinate (minus 1 if this is a negative slope)
     i32 m_y0;           // Y0 coordinate
@@ -472,4 +561,6 @@ private:
     i32 m_covAdjust1;   // Antialiasing coverage adjustment 1
     i32 m_covAdjust2;   // Antialiasing coverage adjustment 2
     bool m_covInverted; // True if the antialiasing coverage gradient is inverted
+
+    const CoverageLUT *m_lut = nullptr; // Coverage table used to answer coverage queries, if any
 };
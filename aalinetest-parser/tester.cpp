@@ -1,27 +1,24 @@
 #include "tester.h"
 
+#include "parallel.h"
 #include "slope.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 
-struct TestResult {
-    bool mismatch = false;
-    u64 numMatches = 0;
-    u64 testedPixels = 0;
-    u64 overshoot = 0;
-    u64 undershoot = 0;
+// The pair of slopes drawn by a test for a given slope size and the capture targets where they can be found
+struct TestSlopes {
+    Slope ltSlope; // left or top
+    Slope rbSlope; // right or bottom
+    i32 ltTargetX, ltTargetY;
+    i32 rbTargetX, rbTargetY;
+    i32 ltStartY, ltEndY;
+    i32 rbStartY, rbEndY;
 };
 
-void testSlope(const Data &data, i32 slopeWidth, i32 slopeHeight, TestResult &result) {
-    // Helper function that prints the mismatch message on the first occurrence of a mismatch
-    auto foundMismatch = [&] {
-        if (!result.mismatch) {
-            result.mismatch = true;
-            // std::cout << "found mismatch\n";
-        }
-    };
-
+TestSlopes setupTestSlopes(const Data &data, i32 slopeWidth, i32 slopeHeight) {
     // Create and configure the slopes
     //              origins            targets   (+ means w or h; - means 256-w or 192-h)
     //         ltSlope  rtSlope    ltSlope  rtSlope
@@ -37,25 +34,22 @@ void testSlope(const Data &data, i32 slopeWidth, i32 slopeHeight, TestResult &re
     // LEFT     right right
     // RIGHT    left  left
 
-    Slope ltSlope; // left or top
-    Slope rbSlope; // right or bottom
-    i32 ltOriginX = (data.type != TEST_RIGHT) ? 0 : 256;
-    i32 ltOriginY = (data.type != TEST_BOTTOM) ? 0 : 192;
-    i32 rbOriginX = (data.type != TEST_LEFT) ? 256 : 0;
-    i32 rbOriginY = (data.type != TEST_TOP) ? 192 : 0;
-    i32 ltTargetX = (data.type != TEST_RIGHT) ? slopeWidth : 256 - slopeWidth;
-    i32 ltTargetY = (data.type != TEST_BOTTOM) ? slopeHeight : 192 - slopeHeight;
-    i32 rbTargetX = (data.type != TEST_LEFT) ? 256 - slopeWidth : slopeWidth;
-    i32 rbTargetY = (data.type != TEST_TOP) ? 192 - slopeHeight : slopeHeight;
-    ltSlope.Setup(ltOriginX, ltOriginY, ltTargetX, ltTargetY, data.type != TEST_LEFT);
-    rbSlope.Setup(rbOriginX, rbOriginY, rbTargetX, rbTargetY, data.type == TEST_RIGHT);
-    /*std::cout << ltSlope.Width() << "x" << ltSlope.Height() << " | " << rbSlope.Width() << "x" << rbSlope.Height()
-              << "\n";*/
-
-    i32 ltStartY = ltOriginY;
-    i32 ltEndY = ltTargetY;
-    i32 rbStartY = rbOriginY;
-    i32 rbEndY = rbTargetY;
+    TestSlopes slopes;
+    const i32 ltOriginX = (data.type != TEST_RIGHT) ? 0 : 256;
+    const i32 ltOriginY = (data.type != TEST_BOTTOM) ? 0 : 192;
+    const i32 rbOriginX = (data.type != TEST_LEFT) ? 256 : 0;
+    const i32 rbOriginY = (data.type != TEST_TOP) ? 192 : 0;
+    slopes.ltTargetX = (data.type != TEST_RIGHT) ? slopeWidth : 256 - slopeWidth;
+    slopes.ltTargetY = (data.type != TEST_BOTTOM) ? slopeHeight : 192 - slopeHeight;
+    slopes.rbTargetX = (data.type != TEST_LEFT) ? 256 - slopeWidth : slopeWidth;
+    slopes.rbTargetY = (data.type != TEST_TOP) ? 192 - slopeHeight : slopeHeight;
+    slopes.ltSlope.Setup(ltOriginX, ltOriginY, slopes.ltTargetX, slopes.ltTargetY, data.type != TEST_LEFT);
+    slopes.rbSlope.Setup(rbOriginX, rbOriginY, slopes.rbTargetX, slopes.rbTargetY, data.type == TEST_RIGHT);
+
+    slopes.ltStartY = ltOriginY;
+    slopes.ltEndY = slopes.ltTargetY;
+    slopes.rbStartY = rbOriginY;
+    slopes.rbEndY = slopes.rbTargetY;
 
     auto adjustY = [&](i32 &startY, i32 &endY) {
         if (startY == endY) {
@@ -71,11 +65,84 @@ void testSlope(const Data &data, i32 slopeWidth, i32 slopeHeight, TestResult &re
             endY = 192;
         }
     };
-    adjustY(ltStartY, ltEndY);
-    adjustY(rbStartY, rbEndY);
+    adjustY(slopes.ltStartY, slopes.ltEndY);
+    adjustY(slopes.rbStartY, slopes.rbEndY);
+    return slopes;
+}
+
+// Computes the coverage of every pixel of the slope between startY and endY and invokes
+// func(x, y, fracCoverage, coverage, pixel) with the matching pixel from the hardware capture.
+template <typename Func>
+void compareSlopeCoverage(const Data &data, const Slope &slope, i32 testX, i32 testY, i32 startY, i32 endY,
+                          Func &&func) {
+    auto &line = data.lines[testY][testX];
+    for (i32 y = startY; y < endY; y++) {
+        i32 startX = slope.XStart(y);
+        i32 endX = slope.XEnd(y);
+        i32 incX = slope.IsNegative() ? -1 : +1;
+
+        // All tests draw a triangle with one edge covering the entire span of the screen border given by the test
+        // name. Due to polygon drawing rules and edge precedences, in some cases these pixels will override the
+        // tested slopes with pixels of full coverage, producing false negatives if checked blindly. The following
+        // conditions skip such pixels.
+        if (data.type == TEST_LEFT && startX == 0) {
+            // The Left test draws a vertical line on the left side of the screen which is considered a left edge in
+            // all cases, and thus overrides all pixels at X=0.
+            startX++;
+        }
+        if ((data.type == TEST_TOP || data.type == TEST_BOTTOM) && slope.Height() == 0) {
+            // The Top and bottom tests draw a horizontal line at the top or bottom of the screen. Only the leftmost
+            // pixel of the left edge is valid.
+            if (slope.IsNegative() == slope.IsLeftEdge()) {
+                startX = endX;
+            } else {
+                endX = startX;
+            }
+        }
+        for (i32 x = startX; slope.IsNegative() ? x >= endX : x <= endX; x += incX) {
+            const i32 fracCoverage = slope.FracAACoverage(x, y);
+            const i32 coverage = fracCoverage >> Slope::kAAFracBits;
+
+            // Compare against data captured from hardware
+            func(x, y, fracCoverage, coverage, line.Pixel(x, y));
+        }
+    }
+}
+
+void accumulate(TestResult &result, i32 coverage, u8 pixel) {
+    result.testedPixels++;
+    if (coverage == pixel) {
+        result.numMatches++;
+    } else {
+        result.mismatch = true;
+    }
+    if (coverage > pixel) {
+        result.overshoot += coverage - pixel;
+    } else if (coverage < pixel) {
+        result.undershoot += pixel - coverage;
+    }
+}
+
+void testSlope(const Data &data, i32 slopeWidth, i32 slopeHeight, TestResult &result) {
+    // Helper function that prints the mismatch message on the first occurrence of a mismatch
+    auto foundMismatch = [&] {
+        if (!result.mismatch) {
+            result.mismatch = true;
+            // std::cout << "found mismatch\n";
+        }
+    };
+
+    const TestSlopes slopes = setupTestSlopes(data, slopeWidth, slopeHeight);
+    const Slope &rbSlope = slopes.rbSlope;
+    const i32 rbTargetX = slopes.rbTargetX;
+    const i32 rbTargetY = slopes.rbTargetY;
+    const i32 rbStartY = slopes.rbStartY;
+    const i32 rbEndY = slopes.rbEndY;
+    /*std::cout << slopes.ltSlope.Width() << "x" << slopes.ltSlope.Height() << " | " << rbSlope.Width() << "x"
+              << rbSlope.Height() << "\n";*/
 
     // Dump gradients from the data set
-    auto dumpGradient = [&](Slope &slope, i32 targetX, i32 targetY, i32 startY, i32 endY) {
+    auto dumpGradient = [&](const Slope &slope, i32 targetX, i32 targetY, i32 startY, i32 endY) {
         // Avoid division by zero.
         // Also, we're not interested in perfectly vertical or horizontal edges; those are solved already.
         if (slope.Width() == 0 || slope.Height() == 0) {
@@ -341,7 +408,7 @@ void testSlope(const Data &data, i32 slopeWidth, i32 slopeHeight, TestResult &re
     // dumpGradient(rbSlope, rbTargetX, rbTargetY, rbStartY, rbEndY);
 
     // Generate X-major gradients using the new bias method and compare against the data set
-    auto calcGradient = [&](Slope &slope, i32 targetX, i32 targetY, i32 startY, i32 endY) {
+    auto calcGradient = [&](const Slope &slope, i32 targetX, i32 targetY, i32 startY, i32 endY) {
         if (slope.IsXMajor() && slope.Width() > 0) {
             const i32 gradFlip = slope.IsCoverageInverted() ? 31 : 0;
             const i32 aaStep = slope.Height() * 1024 / slope.Width();
@@ -478,71 +545,35 @@ void testSlope(const Data &data, i32 slopeWidth, i32 slopeHeight, TestResult &re
 
     // Generate slopes and check the coverage values
     auto calcSlope = [&](const Slope &slope, std::string slopeName, i32 testX, i32 testY, i32 startY, i32 endY) {
-        for (i32 y = startY; y < endY; y++) {
-            i32 startX = slope.XStart(y);
-            i32 endX = slope.XEnd(y);
-            i32 incX = slope.IsNegative() ? -1 : +1;
-
-            // All tests draw a triangle with one edge covering the entire span of the screen border given by the test
-            // name. Due to polygon drawing rules and edge precedences, in some cases these pixels will override the
-            // tested slopes with pixels of full coverage, producing false negatives if checked blindly. The following
-            // conditions skip such pixels.
-            if (data.type == TEST_LEFT && startX == 0) {
-                // The Left test draws a vertical line on the left side of the screen which is considered a left edge in
-                // all cases, and thus overrides all pixels at X=0.
-                startX++;
-            }
-            if ((data.type == TEST_TOP || data.type == TEST_BOTTOM) && slope.Height() == 0) {
-                // The Top and bottom tests draw a horizontal line at the top or bottom of the screen. Only the leftmost
-                // pixel of the left edge is valid.
-                if (slope.IsNegative() == slope.IsLeftEdge()) {
-                    startX = endX;
-                } else {
-                    endX = startX;
-                }
-            }
-            for (i32 x = startX; slope.IsNegative() ? x >= endX : x <= endX; x += incX) {
-                const i32 fracCoverage = slope.FracAACoverage(x, y);
-                const i32 aaFracBits = Slope::kAAFracBits;
-                const i32 coverage = fracCoverage >> aaFracBits;
-
-                // Compare against data captured from hardware
-                auto &line = data.lines[testY][testX];
-                u8 pixel = line.Pixel(x, y);
-                result.testedPixels++;
-                if (coverage == pixel) {
-                    result.numMatches++;
-                } else {
-                    foundMismatch();
-                }
-                if (coverage > pixel) {
-                    result.overshoot += coverage - pixel;
-                } else if (coverage < pixel) {
-                    result.undershoot += pixel - coverage;
-                }
-                // if (coverage != pixel) {
-                /*const auto w = slopeWidth;
-                const auto h = slopeHeight;
-                std::cout << std::setw(3) << std::right << w << 'x' << std::setw(3) << std::left << h //
-                          << " @ "                                                                    //
-                          << std::setw(3) << std::right << x << 'x' << std::setw(3) << std::left << y //
-                          << "  " << slopeName << ": "                                                //
-                          << std::setw(2) << std::right << coverage                                   //
-                          << ((coverage == pixel) ? " == " : " != ")                                  //
-                          << std::setw(2) << (u32)pixel                                               //
-                          << "  ("                                                                    //
-                          << std::setw(4) << fracCoverage << "  "                                     //
-                          << std::setw(2) << std::right << (fracCoverage >> aaFracBits)               //
-                          << '.' << std::setw(2)                                                      //
-                          << std::left << (fracCoverage & ((1 << aaFracBits) - 1))                    //
-                          << ")   "                                                                   //
-                          << (slope.IsLeftEdge() ? 'L' : 'R')                                         //
-                          << (slope.IsPositive() ? 'P' : 'N')                                         //
-                          << (slope.IsXMajor() ? 'X' : 'Y')                                           //
-                          << '\n';*/
-                //}
-            }
-        }
+        compareSlopeCoverage(data, slope, testX, testY, startY, endY,
+                             [&](i32 x, i32 y, i32 fracCoverage, i32 coverage, u8 pixel) {
+                                 if (coverage != pixel) {
+                                     foundMismatch();
+                                 }
+                                 accumulate(result, coverage, pixel);
+                                 // if (coverage != pixel) {
+                                 /*const i32 aaFracBits = Slope::kAAFracBits;
+                                 const auto w = slopeWidth;
+                                 const auto h = slopeHeight;
+                                 std::cout << std::setw(3) << std::right << w << 'x' << std::setw(3) << std::left << h
+                                           << " @ "
+                                           << std::setw(3) << std::right << x << 'x' << std::setw(3) << std::left << y
+                                           << "  " << slopeName << ": "
+                                           << std::setw(2) << std::right << coverage
+                                           << ((coverage == pixel) ? " == " : " != ")
+                                           << std::setw(2) << (u32)pixel
+                                           << "  ("
+                                           << std::setw(4) << fracCoverage << "  "
+                                           << std::setw(2) << std::right << (fracCoverage >> aaFracBits)
+                                           << '.' << std::setw(2)
+                                           << std::left << (fracCoverage & ((1 << aaFracBits) - 1))
+                                           << ")   "
+                                           << (slope.IsLeftEdge() ? 'L' : 'R')
+                                           << (slope.IsPositive() ? 'P' : 'N')
+                                           << (slope.IsXMajor() ? 'X' : 'Y')
+                                           << '\n';*/
+                                 //}
+                             });
     };
     // calcSlope(ltSlope, "LT", ltTargetX, ltTargetY, ltStartY, ltEndY);
     calcSlope(rbSlope, "RB", rbTargetX, rbTargetY, rbStartY, rbEndY);
@@ -639,4 +670,130 @@ void test(Data &data) {
     case 2: testSlopes(data, 0, 192, "left"); break;
     case 3: testSlopes(data, 256, 192, "right"); break;
     }
-}
\ No newline at end of file
+}
+// --------------------------------------------------------------------------------
+
+const char *ValidationReport::OrientationName(size_t index) {
+    static constexpr const char *kNames[kNumOrientations] = {"LPX", "LPY", "LNX", "LNY", "RPX", "RPY", "RNX", "RNY"};
+    return index < kNumOrientations ? kNames[index] : "invalid";
+}
+
+ValidationReport &ValidationReport::operator+=(const ValidationReport &rhs) {
+    total += rhs.total;
+    for (size_t i = 0; i < kNumOrientations; i++) {
+        byOrientation[i] += rhs.byOrientation[i];
+        for (size_t w = 0; w < byWidth[i].size(); w++) {
+            byWidth[i][w] += rhs.byWidth[i][w];
+        }
+        for (size_t h = 0; h < byHeight[i].size(); h++) {
+            byHeight[i][h] += rhs.byHeight[i][h];
+        }
+    }
+    return *this;
+}
+
+void ValidationReport::Print(std::ostream &os, bool perSize) const {
+    auto printResult = [&](const TestResult &result) {
+        os << std::setw(9) << std::right << result.numMatches << " / " << std::setw(9) << std::left
+           << result.testedPixels << " (" << std::setw(6) << std::right << std::fixed << std::setprecision(2)
+           << (result.testedPixels > 0 ? (double)result.numMatches / result.testedPixels * 100.0 : 100.0) << "%)"
+           << "  overshoot: " << std::setw(8) << std::left << result.overshoot << "  undershoot: " << result.undershoot
+           << "\n";
+    };
+
+    os << "## Accuracy: ";
+    printResult(total);
+    for (size_t i = 0; i < kNumOrientations; i++) {
+        if (byOrientation[i].testedPixels == 0) {
+            continue;
+        }
+        os << "  " << OrientationName(i) << ": ";
+        printResult(byOrientation[i]);
+    }
+
+    if (!perSize) {
+        return;
+    }
+    for (size_t i = 0; i < kNumOrientations; i++) {
+        for (size_t w = 0; w < byWidth[i].size(); w++) {
+            auto &result = byWidth[i][w];
+            if (result.testedPixels != result.numMatches) {
+                os << "  " << OrientationName(i) << " width=" << std::setw(3) << std::left << w << ": ";
+                printResult(result);
+            }
+        }
+        for (size_t h = 0; h < byHeight[i].size(); h++) {
+            auto &result = byHeight[i][h];
+            if (result.testedPixels != result.numMatches) {
+                os << "  " << OrientationName(i) << " height=" << std::setw(3) << std::left << h << ": ";
+                printResult(result);
+            }
+        }
+    }
+}
+
+ValidationReport validate(const std::vector<const Data *> &captures, const ValidationOptions &options) {
+    // Every capture row is a work item
+    struct WorkItem {
+        const Data *data;
+        i32 slopeHeight;
+    };
+    std::vector<WorkItem> workItems;
+    for (auto *data : captures) {
+        for (i32 y = data->minY; y <= data->maxY; y++) {
+            workItems.push_back({data, y});
+        }
+    }
+
+    const size_t numWorkers = options.numWorkers != 0 ? options.numWorkers : defaultWorkerCount();
+    std::vector<std::unique_ptr<ValidationReport>> workerReports(numWorkers);
+
+    parallelFor(workItems.size(), numWorkers, [&](size_t index, size_t worker) {
+        if (!workerReports[worker]) {
+            workerReports[worker] = std::make_unique<ValidationReport>();
+        }
+        auto &report = *workerReports[worker];
+        const Data &data = *workItems[index].data;
+        const i32 slopeHeight = workItems[index].slopeHeight;
+
+        auto inCapture = [&](i32 x, i32 y) {
+            return x >= data.minX && x <= data.maxX && y >= data.minY && y <= data.maxY;
+        };
+
+        // Each slope of a test runs in the sweep of its own orientation
+        auto checkSlope = [&](const Slope &slope, i32 testX, i32 testY, i32 startY, i32 endY) {
+            const bool enabled = slope.IsXMajor()   ? options.xMajor
+                                 : slope.IsYMajor() ? options.yMajor
+                                                    : options.diagonals;
+            if (!enabled || !inCapture(testX, testY)) {
+                return;
+            }
+            const size_t orientation =
+                ValidationReport::OrientationIndex(slope.IsLeftEdge(), slope.IsPositive(), slope.IsXMajor());
+            auto &orientationResult = report.byOrientation[orientation];
+            auto &widthResult = report.byWidth[orientation][slope.Width()];
+            auto &heightResult = report.byHeight[orientation][slope.Height()];
+            compareSlopeCoverage(data, slope, testX, testY, startY, endY,
+                                 [&](i32 x, i32 y, i32 fracCoverage, i32 coverage, u8 pixel) {
+                                     accumulate(report.total, coverage, pixel);
+                                     accumulate(orientationResult, coverage, pixel);
+                                     accumulate(widthResult, coverage, pixel);
+                                     accumulate(heightResult, coverage, pixel);
+                                 });
+        };
+
+        for (i32 slopeWidth = data.minX; slopeWidth <= data.maxX; slopeWidth++) {
+            const TestSlopes slopes = setupTestSlopes(data, slopeWidth, slopeHeight);
+            checkSlope(slopes.ltSlope, slopes.ltTargetX, slopes.ltTargetY, slopes.ltStartY, slopes.ltEndY);
+            checkSlope(slopes.rbSlope, slopes.rbTargetX, slopes.rbTargetY, slopes.rbStartY, slopes.rbEndY);
+        }
+    });
+
+    ValidationReport total{};
+    for (auto &report : workerReports) {
+        if (report) {
+            total += *report;
+        }
+    }
+    return total;
+}
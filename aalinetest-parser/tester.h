@@ -2,4 +2,59 @@
 
 #include "types.h"
 
+#include <array>
+#include <ostream>
+#include <vector>
+
+struct TestResult {
+    bool mismatch = false;
+    u64 numMatches = 0;
+    u64 testedPixels = 0;
+    u64 overshoot = 0;
+    u64 undershoot = 0;
+
+    TestResult &operator+=(const TestResult &rhs) {
+        mismatch |= rhs.mismatch;
+        numMatches += rhs.numMatches;
+        testedPixels += rhs.testedPixels;
+        overshoot += rhs.overshoot;
+        undershoot += rhs.undershoot;
+        return *this;
+    }
+};
+
+struct ValidationOptions {
+    // Sweeps to run
+    bool xMajor = true;
+    bool yMajor = true;
+    bool diagonals = true;
+
+    // Number of worker threads; 0 uses all hardware threads
+    size_t numWorkers = 0;
+};
+
+struct ValidationReport {
+    // Orientations are indexed in the same order as the data set groups: LPX, LPY, LNX, LNY, RPX, RPY, RNX, RNY.
+    // Diagonals are accounted as Y-major.
+    static constexpr size_t kNumOrientations = 8;
+
+    TestResult total;
+    std::array<TestResult, kNumOrientations> byOrientation;
+    std::array<std::array<TestResult, 256 + 1>, kNumOrientations> byWidth;
+    std::array<std::array<TestResult, 192 + 1>, kNumOrientations> byHeight;
+
+    static size_t OrientationIndex(bool left, bool positive, bool xMajor) {
+        return (left ? 0 : 4) + (positive ? 0 : 2) + (xMajor ? 0 : 1);
+    }
+
+    static const char *OrientationName(size_t index);
+
+    ValidationReport &operator+=(const ValidationReport &rhs);
+
+    void Print(std::ostream &os, bool perSize) const;
+};
+
 void test(Data &data);
+
+// Validates Slope coverage against every target of the given captures, spreading the work across a thread pool
+ValidationReport validate(const std::vector<const Data *> &captures, const ValidationOptions &options);